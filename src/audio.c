@@ -11,8 +11,15 @@
 #include <string.h>
 
 void SDLCALL audio_callback(void *userdata, SDL_AudioStream *stream, int additional_amount, int total_amount) {
-    (void)total_amount;
     AudioMixer *mx = (AudioMixer *)userdata;
+    /* The device cannot tell us it starved: a callback that comes after the
+       stream must have run dry (twice the audio it held, for scheduling slack)
+       is counted as a likely underrun */
+    if (mx->bytes_per_second > 0) {
+        Uint64 now = SDL_GetTicksNS();
+        if (mx->late_after_ns && now > mx->late_after_ns) SDL_AddAtomicInt(&mx->underruns, 1);
+        mx->late_after_ns = now + 2 * (Uint64)total_amount * SDL_NS_PER_SECOND / (Uint64)mx->bytes_per_second;
+    }
     int remaining = additional_amount;
     while (remaining > 0) {
         int chunk = (remaining > AUDIO_SCRATCH_BYTES) ? AUDIO_SCRATCH_BYTES : remaining;
@@ -21,6 +28,7 @@ void SDLCALL audio_callback(void *userdata, SDL_AudioStream *stream, int additio
         for (int i = 0; i < MAX_ACTIVE_SOUNDS; i++) {
             ActiveSound *s = &mx->slots[i];
             if (!s->active) continue;
+            if (s->play_pos == 0 && mx->events) event_queue_push(mx->events, s->intended_ms, SDL_GetTicks(), mx->ev_mixed, s->label);
             Uint32 sound_remaining = s->resource->len - s->play_pos;
             Uint32 to_mix = (chunk > (int)sound_remaining) ? sound_remaining : (Uint32)chunk;
             
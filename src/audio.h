@@ -11,6 +11,7 @@
 #define AUDIO_H
 
 #include <SDL3/SDL.h>
+#include "event_queue.h"
 
 #define MAX_ACTIVE_SOUNDS   16
 #define AUDIO_SCRATCH_BYTES 4096
@@ -19,17 +20,25 @@ typedef struct {
     Uint8        *data;
     Uint32        len;
     SDL_AudioSpec spec;
+    bool          borrowed;     /* data points into a mapped bundle and must not be freed */
 } SoundResource;
 
 typedef struct {
     const SoundResource *resource;
     Uint32               play_pos;
     bool                 active;
+    Uint64               intended_ms;   /* Scheduled onset, for the SOUND_MIXED event */
+    StrId                label;
 } ActiveSound;
 
 typedef struct {
     ActiveSound  slots[MAX_ACTIVE_SOUNDS];
     SDL_Mutex   *mutex;
+    EventQueue  *events;        /* Receives SOUND_MIXED when a sound starts being mixed (may be NULL) */
+    StrId        ev_mixed;
+    int          bytes_per_second;  /* Of the device stream; 0 disables the underrun count */
+    Uint64       late_after_ns;     /* A callback after this one found the stream dry */
+    SDL_AtomicInt underruns;        /* Likely underruns, read by the telemetry */
     Uint8        scratch[AUDIO_SCRATCH_BYTES];
 } AudioMixer;
 
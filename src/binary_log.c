@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "binary_log.h"
+#include "mapped_file.h"
+#include "argparse.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/*
+ * File layout (little-endian):
+ *
+ *   LogHeader | metadata text, NUL, padding to 8 bytes |
+ *   LogRecord[num_records] mixed with string records | trailer text | LogFooter
+ *
+ * A string record is a LogRecord whose type is LOG_STRING_RECORD, with the
+ * string id as label and its length as timestamp, followed by the bytes
+ * padded to 8. It comes before the first event that uses the string. The
+ * records are appended during the run, the trailer and the footer at the
+ * end: a file without a footer comes from an interrupted session, and its
+ * records can still be exported. Version 1 logs had the strings at the end
+ * only, just before the trailer.
+ */
+
+#define LOG_MAGIC      "E3KELOG"
+#define LOG_END_MAGIC  "E3KLEND"
+#define LOG_VERSION    2
+#define LOG_STRING_RECORD 0xFFFFFFFFu
+#define MAX_RECORD_BATCH 256
+
+typedef struct {
+    char   magic[8];
+    Uint32 version;
+    Uint32 reserved;
+} LogHeader;
+
+typedef struct {
+    Uint64 intended_ms;
+    Uint64 timestamp_ms;        /* String record: the length */
+    Uint32 type;                /* String ids, or LOG_STRING_RECORD */
+    Uint32 label;
+} LogRecord;
+
+typedef struct {
+    Uint32 id;
+    Uint32 length;              /* Followed by length bytes, without NUL */
+} LogString;                    /* Version 1 */
+
+typedef struct {
+    char   magic[8];
+    Uint64 records_offset;
+    Uint64 num_records;         /* Events only */
+    Uint64 records_end;         /* Version 1: offset of the LogString table */
+    Uint32 num_strings;
+    Uint32 trailer_size;
+} LogFooter;
+
+SDL_COMPILE_TIME_ASSERT(log_record_size, sizeof(LogRecord) == 24);
+SDL_COMPILE_TIME_ASSERT(log_footer_size, sizeof(LogFooter) == 40);
+
+bool is_binary_log(const char *path) {
+    char magic[8] = {0};
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    return n == sizeof(magic) && memcmp(magic, LOG_MAGIC, sizeof(magic)) == 0;
+}
+
+bool binary_log_begin(FILE *f) {
+    LogHeader h = {0};
+    memcpy(h.magic, LOG_MAGIC, sizeof(h.magic));
+    h.version = LOG_VERSION;
+    return fwrite(&h, sizeof(h), 1, f) == 1;
+}
+
+bool binary_log_end_header(FILE *f) {
+    static const char zeros[8] = {0};
+    Sint64 pos = file_tell(f);
+    if (pos < 0) return false;
+    size_t pad = 8 - (size_t)pos % 8;       /* At least the NUL */
+    return fwrite(zeros, 1, pad, f) == pad;
+}
+
+/* Adds id to the set; true if it was not there yet. The set doubles when half full. */
+static bool add_id(BinaryLogStrings *set, Uint32 id, bool *failed) {
+    if ((size_t)(set->count + 1) * 2 > set->mask + 1) {
+        size_t mask = set->mask ? set->mask * 2 + 1 : 1023;
+        Uint32 *ids = malloc((mask + 1) * sizeof(Uint32));
+        if (!ids) { *failed = true; return false; }
+        memset(ids, 0xFF, (mask + 1) * sizeof(Uint32));
+        for (size_t i = 0; set->ids && i <= set->mask; i++) {
+            if (set->ids[i] == 0xFFFFFFFFu) continue;
+            size_t j = (set->ids[i] * 2654435761u) & mask;
+            while (ids[j] != 0xFFFFFFFFu) j = (j + 1) & mask;
+            ids[j] = set->ids[i];
+        }
+        free(set->ids);
+        set->ids = ids;
+        set->mask = mask;
+    }
+    size_t i = (id * 2654435761u) & set->mask;
+    while (set->ids[i] != 0xFFFFFFFFu) {
+        if (set->ids[i] == id) return false;
+        i = (i + 1) & set->mask;
+    }
+    set->ids[i] = id;
+    set->count++;
+    return true;
+}
+
+static bool write_string(FILE *f, const StringTable *strings, Uint32 id) {
+    static const char zeros[8] = {0};
+    const char *str = strtab_get(strings, id);
+    size_t len = strlen(str), pad = (8 - len % 8) % 8;
+    LogRecord r = { 0, len, LOG_STRING_RECORD, id };
+    return fwrite(&r, sizeof(r), 1, f) == 1 && fwrite(str, 1, len, f) == len && fwrite(zeros, 1, pad, f) == pad;
+}
+
+bool binary_log_write(FILE *f, BinaryLogStrings *written, const StringTable *strings, const EventLogEntry *entries, int n) {
+    LogRecord batch[MAX_RECORD_BATCH];
+    int k = 0;
+    bool failed = false;
+    for (int i = 0; i < n; i++) {
+        Uint32 ids[2] = { entries[i].type, entries[i].label };
+        for (int j = 0; j < 2; j++) {
+            if (!add_id(written, ids[j], &failed)) {
+                if (failed) return false;
+                continue;
+            }
+            /* The events before it go first, to keep the order */
+            if (k > 0 && fwrite(batch, sizeof(LogRecord), (size_t)k, f) != (size_t)k) return false;
+            k = 0;
+            if (!write_string(f, strings, ids[j])) return false;
+        }
+        batch[k++] = (LogRecord){ entries[i].intended_ms, entries[i].timestamp_ms, entries[i].type, entries[i].label };
+        if (k == MAX_RECORD_BATCH) {
+            if (fwrite(batch, sizeof(LogRecord), (size_t)k, f) != (size_t)k) return false;
+            k = 0;
+        }
+    }
+    return k == 0 || fwrite(batch, sizeof(LogRecord), (size_t)k, f) == (size_t)k;
+}
+
+bool binary_log_finish(FILE *f, Uint64 records_offset, BinaryLogStrings *written, Uint64 num_records, const char *trailer) {
+    Sint64 records_end = file_tell(f);
+    Uint32 num_strings = written->count;
+    free(written->ids);
+    *written = (BinaryLogStrings){0};
+    if (records_end < 0) return false;
+
+    size_t trailer_size = trailer ? strlen(trailer) : 0;
+    if (trailer_size > 0 && fwrite(trailer, 1, trailer_size, f) != trailer_size) return false;
+
+    LogFooter footer = {0};
+    memcpy(footer.magic, LOG_END_MAGIC, sizeof(footer.magic));
+    footer.records_offset = records_offset;
+    footer.num_records = num_records;
+    footer.records_end = (Uint64)records_end;
+    footer.num_strings = num_strings;
+    footer.trailer_size = (Uint32)trailer_size;
+    return fwrite(&footer, sizeof(footer), 1, f) == 1;
+}
+
+/* ─── export ─── */
+
+typedef struct {
+    Uint32 id;
+    Uint32 length;
+    const char *str;
+} ExportString;
+
+typedef struct {
+    ExportString *slots;
+    size_t mask;
+    size_t count;
+} ExportTable;
+
+static bool table_add(ExportTable *t, Uint32 id, Uint32 length, const char *str) {
+    if ((t->count + 1) * 2 > t->mask + 1) {
+        size_t mask = t->mask ? t->mask * 2 + 1 : 1023;
+        ExportString *slots = calloc(mask + 1, sizeof(ExportString));
+        if (!slots) return false;
+        for (size_t i = 0; t->slots && i <= t->mask; i++) {
+            if (!t->slots[i].str) continue;
+            size_t j = (t->slots[i].id * 2654435761u) & mask;
+            while (slots[j].str) j = (j + 1) & mask;
+            slots[j] = t->slots[i];
+        }
+        free(t->slots);
+        t->slots = slots;
+        t->mask = mask;
+    }
+    size_t j = (id * 2654435761u) & t->mask;
+    while (t->slots[j].str) {
+        if (t->slots[j].id == id) return true;
+        j = (j + 1) & t->mask;
+    }
+    t->slots[j] = (ExportString){ id, length, str };
+    t->count++;
+    return true;
+}
+
+static const ExportString *find_string(const ExportTable *t, Uint32 id) {
+    if (!t->slots) return NULL;
+    for (size_t i = (id * 2654435761u) & t->mask; t->slots[i].str; i = (i + 1) & t->mask) {
+        if (t->slots[i].id == id) return &t->slots[i];
+    }
+    return NULL;
+}
+
+static void print_string(FILE *out, const ExportTable *t, Uint32 id) {
+    const ExportString *s = find_string(t, id);
+    if (s) fwrite(s->str, 1, s->length, out);
+    else fprintf(out, "#%" PRIu32, id);
+}
+
+int export_log_main(int argc, const char *argv[]) {
+    const char *output = NULL;
+    static const char *const usage_lines[] = { "expe3000 export <results.e3l> [-o results.csv]", NULL };
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_STRING('o', "output", &output, "CSV results file (default: the log name with a .csv extension)"),
+        OPT_END(),
+    };
+    struct argparse ap;
+    argparse_init(&ap, options, usage_lines, 0);
+    argparse_describe(&ap, "\nConverts a binary event log to the CSV results layout.", NULL);
+    argc = argparse_parse(&ap, argc, argv);
+    if (argc < 1) {
+        argparse_usage(&ap);
+        return 1;
+    }
+    const char *log_file = argv[0];
+
+    char out_path[1024];
+    if (output) {
+        strncpy(out_path, output, sizeof(out_path) - 1); out_path[sizeof(out_path) - 1] = '\0';
+    } else {
+        strncpy(out_path, log_file, sizeof(out_path) - 5); out_path[sizeof(out_path) - 5] = '\0';
+        char *dot = strrchr(out_path, '.');
+        if (dot && !strpbrk(dot, "/\\")) *dot = '\0';
+        strcat(out_path, ".csv");
+    }
+
+    MappedFile *mf = map_file(log_file);
+    if (!mf || mf->size < sizeof(LogHeader) || memcmp(mf->data, LOG_MAGIC, 8) != 0) {
+        fprintf(stderr, "Error: '%s' is not a binary event log\n", log_file);
+        unmap_file(mf);
+        return 1;
+    }
+    LogHeader h;
+    memcpy(&h, mf->data, sizeof(h));
+    if (h.version != 1 && h.version != LOG_VERSION) {
+        fprintf(stderr, "Error: '%s' has version %" PRIu32 ", this program reads versions 1 to %d\n", log_file, h.version, LOG_VERSION);
+        unmap_file(mf);
+        return 1;
+    }
+    const char *text = (const char *)mf->data + sizeof(LogHeader);
+    const char *text_end = memchr(text, '\0', mf->size - sizeof(LogHeader));
+    if (!text_end) {
+        fprintf(stderr, "Error: '%s' is truncated\n", log_file);
+        unmap_file(mf);
+        return 1;
+    }
+    Uint64 records_offset = ((Uint64)(text_end - (const char *)mf->data) + 8) & ~(Uint64)7;
+
+    /* Without a valid footer, export the records that made it to disk */
+    LogFooter footer = {0};
+    bool complete = false;
+    if (mf->size >= records_offset + sizeof(LogFooter)) {
+        Uint64 footer_at = mf->size - sizeof(LogFooter);
+        memcpy(&footer, mf->data + footer_at, sizeof(footer));
+        complete = memcmp(footer.magic, LOG_END_MAGIC, sizeof(footer.magic)) == 0 && footer.records_offset == records_offset &&
+                   footer.records_end >= records_offset && footer.records_end + footer.trailer_size <= footer_at;
+        if (complete && h.version == 1) complete = footer.records_end == records_offset + footer.num_records * sizeof(LogRecord);
+    }
+    Uint64 records_end = complete ? footer.records_end : mf->size;
+    if (records_end < records_offset) records_end = records_offset;
+    const char *trailer = complete ? (const char *)mf->data + mf->size - sizeof(LogFooter) - footer.trailer_size : NULL;
+
+    ExportTable table = {0};
+    bool ok = true;
+    if (complete && h.version == 1) {
+        const Uint8 *p = mf->data + footer.records_end, *end = (const Uint8 *)trailer;
+        for (Uint32 i = 0; i < footer.num_strings && ok; i++) {
+            LogString ls;
+            if ((size_t)(end - p) < sizeof(ls)) break;
+            memcpy(&ls, p, sizeof(ls));
+            p += sizeof(ls);
+            if ((size_t)(end - p) < ls.length) break;
+            ok = table_add(&table, ls.id, ls.length, (const char *)p);
+            p += ls.length;
+        }
+    }
+
+    FILE *out = fopen(out_path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: cannot write '%s'\n", out_path);
+        free(table.slots);
+        unmap_file(mf);
+        return 1;
+    }
+    fwrite(text, 1, (size_t)(text_end - text), out);
+    fprintf(out, "intended_ms,timestamp_ms,event_type,label\n");
+    Uint64 num_events = 0;
+    const Uint8 *rec = mf->data + records_offset, *end = mf->data + records_end;
+    while (ok && (size_t)(end - rec) >= sizeof(LogRecord)) {
+        LogRecord r;
+        memcpy(&r, rec, sizeof(r));
+        rec += sizeof(r);
+        if (h.version >= 2 && r.type == LOG_STRING_RECORD) {
+            if ((Uint64)(end - rec) < r.timestamp_ms) break;    /* Cut short by a crash */
+            ok = table_add(&table, r.label, (Uint32)r.timestamp_ms, (const char *)rec);
+            Uint64 padded = (r.timestamp_ms + 7) & ~(Uint64)7;
+            rec += padded < (Uint64)(end - rec) ? padded : (Uint64)(end - rec);
+            continue;
+        }
+        fprintf(out, "%" PRIu64 ",%" PRIu64 ",", r.intended_ms, r.timestamp_ms);
+        print_string(out, &table, r.type);
+        fputc(',', out);
+        print_string(out, &table, r.label);
+        fputc('\n', out);
+        num_events++;
+    }
+    if (trailer) fwrite(trailer, 1, footer.trailer_size, out);
+    if (fclose(out) != 0) ok = false;
+    free(table.slots);
+    unmap_file(mf);
+    if (!ok) {
+        fprintf(stderr, "Error: cannot write '%s'\n", out_path);
+        return 1;
+    }
+    if (!complete) {
+        fprintf(stderr, "Warning: '%s' has no footer (interrupted session?): exported the %" PRIu64 " events that reached the disk%s\n",
+                log_file, num_events, h.version == 1 ? ", with numeric labels" : ", without the trailer");
+    }
+    printf("Exported %" PRIu64 " events to %s\n", num_events, out_path);
+    return complete ? 0 : 2;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+#include <stdio.h>
+#include "experiment.h"
+
+/*
+ * Binary event logs (.e3l).
+ *
+ * The same content as the CSV results file, with fixed-size event records
+ * carrying string ids instead of text: the metadata header as text, the
+ * records, then the trailer and a footer. Each string is written once, as a
+ * record of its own just before the first event that uses it, so a log cut
+ * short by a crash keeps its labels. "export" turns a binary log back into
+ * the CSV layout.
+ */
+
+/* Ids of the strings already written to a log; zero-initialize */
+typedef struct {
+    Uint32 *ids;
+    size_t  mask;
+    Uint32  count;
+} BinaryLogStrings;
+
+/**
+ * @brief Returns true if the file starts with the binary log magic.
+ */
+bool is_binary_log(const char *path);
+
+/**
+ * @brief Writes the file header. The '#' metadata lines are written next, as text.
+ */
+bool binary_log_begin(FILE *f);
+
+/**
+ * @brief Ends the metadata text; the records follow.
+ */
+bool binary_log_end_header(FILE *f);
+
+/**
+ * @brief Appends n event records, each preceded by the strings it uses that are not in written yet.
+ */
+bool binary_log_write(FILE *f, BinaryLogStrings *written, const StringTable *strings, const EventLogEntry *entries, int n);
+
+/**
+ * @brief Appends the trailer and the footer, and frees written.
+ *
+ * @param records_offset File offset of the first record.
+ * @param num_records Number of events written.
+ */
+bool binary_log_finish(FILE *f, Uint64 records_offset, BinaryLogStrings *written, Uint64 num_records, const char *trailer);
+
+/**
+ * @brief Entry point of the "export" subcommand (argv[0] is "export").
+ */
+int export_log_main(int argc, const char *argv[]);
+
+#endif // BINARY_LOG_H
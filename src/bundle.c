@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "bundle.h"
+#include "mapped_file.h"
+#include "csv_parser.h"
+#include "argparse.h"
+#include <SDL3_image/SDL_image.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/*
+ * File layout (little-endian):
+ *
+ *   BundleHeader | BundleStimulus[num_stimuli] | BundleAsset[num_assets] |
+ *   string table | asset data, each blob aligned to BUNDLE_ALIGN
+ */
+
+#define BUNDLE_MAGIC   "E3KBNDL"
+#define BUNDLE_VERSION 2
+#define BUNDLE_ALIGN   4096
+#define BUNDLE_NO_ASSET 0xFFFFFFFFu
+
+typedef struct {
+    char   magic[8];
+    Uint32 version;
+    Uint32 num_stimuli;
+    Uint32 num_assets;
+    Uint32 strings_size;
+    Uint64 stimuli_offset;
+    Uint64 assets_offset;
+    Uint64 strings_offset;
+    Uint64 file_size;
+} BundleHeader;
+
+typedef struct {
+    Uint64 timestamp_ms;
+    Uint64 duration_ms;
+    Uint32 type;
+    Uint32 asset;           /* Index in the asset table */
+    Uint8  color[4];        /* RGBA, a == 0: default text colour */
+    Uint16 trigger_width_ms;
+    Uint8  trigger_lines;
+    Uint8  reserved;
+} BundleStimulus;
+
+typedef struct {
+    Uint32 type;
+    Uint32 path;            /* Offset in the string table (the text itself for TEXT) */
+    Uint64 data_offset;
+    Uint64 data_size;       /* 0: no data (TEXT, or missing when packed) */
+    Uint32 width, height, pitch, pixel_format;
+    Uint32 freq, channels, audio_format, reserved;
+} BundleAsset;
+
+typedef struct {
+    const BundleHeader   *header;
+    const BundleStimulus *stimuli;
+    const BundleAsset    *assets;
+    const char           *strings;
+} BundleView;
+
+bool is_bundle_file(const char *path) {
+    char magic[8] = {0};
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    return n == sizeof(magic) && memcmp(magic, BUNDLE_MAGIC, sizeof(magic)) == 0;
+}
+
+/* Checks the header and that every table lies inside the mapping. */
+static bool get_view(const MappedFile *mf, BundleView *v) {
+    if (mf->size < sizeof(BundleHeader)) return false;
+    const BundleHeader *h = (const BundleHeader *)mf->data;
+    if (memcmp(h->magic, BUNDLE_MAGIC, sizeof(h->magic)) != 0) return false;
+    /* Version 1 has the same layout, with zeros in place of the trigger code */
+    if (h->version != BUNDLE_VERSION && h->version != 1) {
+        fprintf(stderr, "Unsupported bundle version %u (expected %d), pack the CSV file again\n", h->version, BUNDLE_VERSION);
+        return false;
+    }
+    if (h->file_size != mf->size) {
+        fprintf(stderr, "Truncated bundle (%zu of %" PRIu64 " bytes)\n", mf->size, h->file_size);
+        return false;
+    }
+    if (h->stimuli_offset + (Uint64)h->num_stimuli * sizeof(BundleStimulus) > mf->size ||
+        h->assets_offset + (Uint64)h->num_assets * sizeof(BundleAsset) > mf->size ||
+        h->strings_offset + h->strings_size > mf->size ||
+        h->strings_size == 0 || mf->data[h->strings_offset + h->strings_size - 1] != '\0')
+        return false;
+    v->header = h;
+    v->stimuli = (const BundleStimulus *)(mf->data + h->stimuli_offset);
+    v->assets = (const BundleAsset *)(mf->data + h->assets_offset);
+    v->strings = (const char *)(mf->data + h->strings_offset);
+    return true;
+}
+
+Experiment *bundle_load_experiment(const char *path) {
+#if SDL_BYTEORDER != SDL_LIL_ENDIAN
+    fprintf(stderr, "%s: bundles are only supported on little-endian machines\n", path);
+    return NULL;
+#endif
+    MappedFile *mf = map_file(path);
+    if (!mf) return NULL;
+    BundleView v;
+    if (!get_view(mf, &v)) {
+        fprintf(stderr, "%s: invalid bundle file\n", path);
+        unmap_file(mf);
+        return NULL;
+    }
+
+    Experiment *exp = calloc(1, sizeof(Experiment));
+    if (!exp) { unmap_file(mf); return NULL; }
+    exp->bundle = mf;
+    exp->stimuli = calloc(v.header->num_stimuli > 0 ? v.header->num_stimuli : 1, sizeof(Stimulus));
+    exp->strings = strtab_create();
+    if (!exp->stimuli || !exp->strings) { free_experiment(exp); return NULL; }
+
+    for (Uint32 i = 0; i < v.header->num_stimuli; i++) {
+        const BundleStimulus *bs = &v.stimuli[i];
+        Stimulus *s = &exp->stimuli[i];
+        if (bs->asset >= v.header->num_assets || v.assets[bs->asset].path >= v.header->strings_size) {
+            fprintf(stderr, "%s: corrupted stimulus table (row %u)\n", path, i + 1);
+            free_experiment(exp);
+            return NULL;
+        }
+        s->timestamp_ms = bs->timestamp_ms;
+        s->duration_ms = bs->duration_ms;
+        s->type = (StimType)bs->type;
+        const char *content = v.strings + v.assets[bs->asset].path;
+        s->content = strtab_intern(exp->strings, content);
+        if (s->content == STR_EMPTY && content[0]) {
+            fprintf(stderr, "%s: out of memory reading the stimulus table\n", path);
+            free_experiment(exp);
+            return NULL;
+        }
+        s->color = (SDL_Color){ bs->color[0], bs->color[1], bs->color[2], bs->color[3] };
+        s->asset = (int)bs->asset;
+        if (v.header->version == 1) stimulus_default_trigger(s);
+        else {
+            s->trigger_lines = bs->trigger_lines;
+            s->trigger_width_ms = bs->trigger_width_ms;
+        }
+        exp->count++;
+    }
+    SDL_Log("Opened bundle %s: %d stimuli, %u assets", path, exp->count, v.header->num_assets);
+    if (v.header->version == 1) SDL_Log("%s was packed without trigger codes: each row sends the default trigger of its type", path);
+    return exp;
+}
+
+bool bundle_get_asset(const MappedFile *bundle, CacheEntry *entry) {
+    BundleView v;
+    if (!get_view(bundle, &v) || entry->first_row < 0 || (Uint32)entry->first_row >= v.header->num_stimuli) return false;
+    const BundleAsset *a = &v.assets[v.stimuli[entry->first_row].asset];
+    if (a->data_size == 0 || a->data_offset + a->data_size > bundle->size) return false;
+    Uint8 *data = (Uint8 *)(bundle->data + a->data_offset);
+
+    if (entry->type == STIM_IMAGE) {
+        /* The surface borrows the mapped pixels; it is only ever read */
+        entry->surface = SDL_CreateSurfaceFrom((int)a->width, (int)a->height, (SDL_PixelFormat)a->pixel_format, data, (int)a->pitch);
+        if (!entry->surface) return false;
+        entry->w = (float)a->width; entry->h = (float)a->height;
+    } else if (entry->type == STIM_SOUND) {
+        entry->sound.data = data;
+        entry->sound.len = (Uint32)a->data_size;
+        entry->sound.spec.format = (SDL_AudioFormat)a->audio_format;
+        entry->sound.spec.channels = (int)a->channels;
+        entry->sound.spec.freq = (int)a->freq;
+        entry->sound.borrowed = true;
+        entry->mem.ram_bytes = entry->sound.len;
+    }
+    return true;
+}
+
+/* ─── Packing ─── */
+
+static bool write_padding(FILE *f, Sint64 alignment) {
+    static const Uint8 zeros[BUNDLE_ALIGN];
+    Sint64 pos = file_tell(f);
+    if (pos < 0) return false;
+    Sint64 pad = (alignment - pos % alignment) % alignment;
+    return pad == 0 || fwrite(zeros, 1, (size_t)pad, f) == (size_t)pad;
+}
+
+/* Decodes one asset and appends its data to the file. */
+static bool pack_asset(FILE *f, const char *base_path, const CacheEntry *entry, BundleAsset *a) {
+    if (entry->type != STIM_IMAGE && entry->type != STIM_SOUND) return true;
+    char full_path[1024]; snprintf(full_path, 1024, "%s%s", base_path, entry->file_path);
+    if (!write_padding(f, BUNDLE_ALIGN)) return false;
+    Sint64 offset = file_tell(f);
+    if (offset < 0) return false;
+    a->data_offset = (Uint64)offset;
+
+    if (entry->type == STIM_IMAGE) {
+        SDL_Surface *loaded = IMG_Load(full_path);
+        if (!loaded) {
+            fprintf(stderr, "Failed to load image %s: %s\n", full_path, SDL_GetError());
+            return false;
+        }
+        SDL_Surface *rgba = SDL_ConvertSurface(loaded, SDL_PIXELFORMAT_RGBA32);
+        SDL_DestroySurface(loaded);
+        if (!rgba) return false;
+        bool ok = true;
+        for (int y = 0; y < rgba->h && ok; y++)
+            ok = fwrite((Uint8 *)rgba->pixels + (size_t)y * rgba->pitch, 4, (size_t)rgba->w, f) == (size_t)rgba->w;
+        a->width = (Uint32)rgba->w; a->height = (Uint32)rgba->h;
+        a->pitch = (Uint32)rgba->w * 4; a->pixel_format = SDL_PIXELFORMAT_RGBA32;
+        a->data_size = (Uint64)a->pitch * a->height;
+        SDL_DestroySurface(rgba);
+        return ok;
+    }
+
+    /* STIM_SOUND, the only other type with data */
+    SoundResource sound = {0};
+    size_t peak;
+    if (!decode_sound(full_path, &sound, &peak)) return false;
+    bool ok = fwrite(sound.data, 1, sound.len, f) == sound.len;
+    a->data_size = sound.len;
+    a->freq = (Uint32)sound.spec.freq; a->channels = (Uint32)sound.spec.channels;
+    a->audio_format = (Uint32)sound.spec.format;
+    SDL_free(sound.data);
+    return ok;
+}
+
+int bundle_pack_main(int argc, const char *argv[]) {
+    const char *stimuli_dir = NULL, *output = NULL;
+    static const char *const usage_lines[] = { "expe3000 pack <stimuli_csv_file> [--stimuli-dir DIR] [-o bundle.e3b]", NULL };
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_STRING('S', "stimuli-dir", &stimuli_dir, "directory containing the stimuli files"),
+        OPT_STRING('o', "output", &output, "bundle file (default: the CSV name with a .e3b extension)"),
+        OPT_END(),
+    };
+    struct argparse ap;
+    argparse_init(&ap, options, usage_lines, 0);
+    argparse_describe(&ap, "\nPacks a schedule and its decoded stimuli into a single bundle file.", NULL);
+    argc = argparse_parse(&ap, argc, argv);
+    if (argc < 1) {
+        argparse_usage(&ap);
+        return 1;
+    }
+    const char *csv_file = argv[0];
+
+    char base_path[1024] = "";
+    if (stimuli_dir && stimuli_dir[0]) {
+        size_t len = strlen(stimuli_dir);
+        bool has_sep = stimuli_dir[len-1] == '/' || stimuli_dir[len-1] == '\\';
+        snprintf(base_path, sizeof(base_path), "%s%s", stimuli_dir, has_sep ? "" : "/");
+    }
+    char out_path[1024];
+    if (output) {
+        strncpy(out_path, output, sizeof(out_path) - 1); out_path[sizeof(out_path) - 1] = '\0';
+    } else {
+        strncpy(out_path, csv_file, sizeof(out_path) - 5); out_path[sizeof(out_path) - 5] = '\0';
+        char *dot = strrchr(out_path, '.');
+        if (dot && !strpbrk(dot, "/\\")) *dot = '\0';
+        strcat(out_path, ".e3b");
+    }
+
+    Experiment *exp = parse_csv(csv_file);
+    if (!exp) return 1;
+    CacheEntry *cache, **entries;
+    int n;
+    Resource *res = prepare_resources(exp, (SDL_Color){0, 0, 0, 0}, &cache, &entries, &n);
+    if (!res) { free_experiment(exp); return 1; }
+
+    /* String table: one NUL-terminated path (or text) per asset, plus a leading empty string */
+    size_t strings_size = 1;
+    for (int i = 0; i < n; i++) strings_size += strlen(entries[i]->file_path) + 1;
+    char *strings = calloc(1, strings_size);
+    BundleAsset *assets = calloc(n > 0 ? n : 1, sizeof(BundleAsset));
+    BundleStimulus *stimuli = calloc(exp->count > 0 ? exp->count : 1, sizeof(BundleStimulus));
+    FILE *f = fopen(out_path, "wb");
+    bool ok = strings && assets && stimuli && f;
+    if (!f) perror(out_path);
+
+    BundleHeader h = {0};
+    if (ok) {
+        memcpy(h.magic, BUNDLE_MAGIC, sizeof(h.magic));
+        h.version = BUNDLE_VERSION;
+        h.num_stimuli = (Uint32)exp->count;
+        h.num_assets = (Uint32)n;
+        h.strings_size = (Uint32)strings_size;
+        h.stimuli_offset = sizeof(BundleHeader);
+        h.assets_offset = h.stimuli_offset + (Uint64)exp->count * sizeof(BundleStimulus);
+        h.strings_offset = h.assets_offset + (Uint64)n * sizeof(BundleAsset);
+        /* Tables are rewritten once the data offsets are known */
+        ok = file_seek(f, (Sint64)(h.strings_offset + strings_size));
+    }
+
+    int missing = 0;
+    size_t pos = 1;
+    for (int i = 0; ok && i < n; i++) {
+        const CacheEntry *e = entries[i];
+        BundleAsset *a = &assets[e->id];
+        a->type = (Uint32)e->type;
+        a->path = (Uint32)pos;
+        strcpy(strings + pos, e->file_path);
+        pos += strlen(e->file_path) + 1;
+        if (!pack_asset(f, base_path, e, a)) {
+            a->data_size = 0;
+            missing++;
+        }
+    }
+    for (int i = 0; ok && i < exp->count; i++) {
+        const Stimulus *s = &exp->stimuli[i];
+        BundleStimulus *bs = &stimuli[i];
+        bs->timestamp_ms = s->timestamp_ms;
+        bs->duration_ms = s->duration_ms;
+        bs->type = (Uint32)s->type;
+        bs->asset = res[i].entry ? (Uint32)res[i].entry->id : BUNDLE_NO_ASSET;
+        bs->color[0] = s->color.r; bs->color[1] = s->color.g; bs->color[2] = s->color.b; bs->color[3] = s->color.a;
+        bs->trigger_width_ms = s->trigger_width_ms;
+        bs->trigger_lines = s->trigger_lines;
+        if (!res[i].entry) ok = false;
+    }
+
+    if (ok) {
+        Sint64 end = file_tell(f);
+        h.file_size = (Uint64)end;
+        ok = end >= 0 && file_seek(f, 0) &&
+             fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(stimuli, sizeof(BundleStimulus), (size_t)exp->count, f) == (size_t)exp->count &&
+             fwrite(assets, sizeof(BundleAsset), (size_t)n, f) == (size_t)n &&
+             fwrite(strings, 1, strings_size, f) == strings_size;
+    }
+    if (f && fclose(f) != 0) ok = false;
+
+    if (ok && missing > 0) {
+        fprintf(stderr, "%d stimulus file(s) could not be loaded; not writing an incomplete bundle\n", missing);
+        ok = false;
+    }
+    if (ok) {
+        printf("Wrote %s: %d stimuli, %d assets, %" PRIu64 " bytes\n", out_path, exp->count, n, h.file_size);
+    } else if (f) {
+        remove(out_path);
+    }
+
+    free(strings); free(assets); free(stimuli); free(entries);
+    free_resources(res, cache);
+    free_experiment(exp);
+    return ok ? 0 : 1;
+}
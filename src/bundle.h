@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include "stimuli.h"
+#include "resources.h"
+
+/*
+ * Experiment bundles (.e3b).
+ *
+ * A bundle holds the schedule together with every asset already decoded to
+ * the format the run needs (RGBA32 pixels, S16 stereo 44.1 kHz samples).
+ * Asset data is page-aligned so that, once the file is mapped, images are
+ * wrapped in surfaces and sounds are played without any copy or decode.
+ */
+
+/**
+ * @brief Returns true if the file starts with the bundle magic.
+ */
+bool is_bundle_file(const char *path);
+
+/**
+ * @brief Entry point of the "pack" subcommand (argv[0] is "pack").
+ *
+ * @return The process exit code.
+ */
+int bundle_pack_main(int argc, const char *argv[]);
+
+/**
+ * @brief Maps a bundle and builds its experiment. free_experiment() unmaps it.
+ */
+Experiment *bundle_load_experiment(const char *path);
+
+/**
+ * @brief Points a cache entry to its asset data inside the mapped bundle.
+ *
+ * @return false if the asset was missing when the bundle was packed.
+ */
+bool bundle_get_asset(const struct MappedFile *bundle, CacheEntry *entry);
+
+#endif // BUNDLE_H
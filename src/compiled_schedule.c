@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "compiled_schedule.h"
+#include "csv_parser.h"
+#include "mapped_file.h"
+#include "resources.h"
+#include "argparse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+ * File layout (little-endian):
+ *
+ *   ScheduleHeader | ScheduleRow[num_rows] | ScheduleAsset[num_assets] | string table
+ *
+ * The CRC-32 covers every byte after the header. Version 1 rows end before
+ * the trigger code (SCHEDULE_V1_ROW_SIZE bytes): they get the default
+ * trigger of their type, as the runner then sent.
+ */
+
+#define SCHEDULE_MAGIC   "E3KSCHD"
+#define SCHEDULE_VERSION 2
+#define SCHEDULE_V1_ROW_SIZE 32
+
+typedef struct {
+    char   magic[8];
+    Uint32 version;
+    Uint32 crc32;
+    Uint32 num_rows;
+    Uint32 num_assets;
+    Uint32 strings_size;
+    Uint32 refresh_mhz;         /* Refresh rate of the frame targets, in mHz */
+    Uint64 rows_offset;
+    Uint64 assets_offset;
+    Uint64 strings_offset;
+    Uint64 file_size;
+} ScheduleHeader;
+
+typedef struct {
+    Uint64 timestamp_ms;
+    Uint64 duration_ms;
+    Uint32 onset_frame;         /* Frame targets at refresh_mhz, counted from the start (not used to schedule) */
+    Uint32 offset_frame;
+    Uint32 asset;
+    Uint8  color[4];            /* RGBA, a == 0: default text colour */
+    Uint16 trigger_width_ms;
+    Uint8  trigger_lines;
+    Uint8  reserved[5];
+} ScheduleRow;
+
+typedef struct {
+    Uint32 type;
+    Uint32 content;             /* Offset in the string table */
+} ScheduleAsset;
+
+SDL_COMPILE_TIME_ASSERT(schedule_v1_row, offsetof(ScheduleRow, trigger_width_ms) == SCHEDULE_V1_ROW_SIZE);
+
+static size_t row_size(const ScheduleHeader *h) {
+    return h->version == 1 ? SCHEDULE_V1_ROW_SIZE : sizeof(ScheduleRow);
+}
+
+/* Only the fields before trigger_width_ms may be read from a version 1 row */
+static const ScheduleRow *row_at(const MappedFile *mf, Uint32 i) {
+    const ScheduleHeader *h = (const ScheduleHeader *)mf->data;
+    return (const ScheduleRow *)(mf->data + h->rows_offset + (Uint64)i * row_size(h));
+}
+
+/* The trigger code of a row, or the default of its type in a version 1 file */
+static void row_trigger(const ScheduleHeader *h, const ScheduleRow *r, StimType type, Uint8 *lines, Uint16 *width_ms) {
+    if (h->version == 1) {
+        Stimulus d = { .type = type };
+        stimulus_default_trigger(&d);
+        *lines = d.trigger_lines;
+        *width_ms = d.trigger_width_ms;
+    } else {
+        *lines = r->trigger_lines;
+        *width_ms = r->trigger_width_ms;
+    }
+}
+
+static const char *type_name(StimType type) {
+    switch (type) {
+        case STIM_IMAGE: return "IMAGE";
+        case STIM_SOUND: return "SOUND";
+        case STIM_TEXT:  return "TEXT";
+        default:         return "END";
+    }
+}
+
+static Uint32 frame_at(Uint64 ms, double refresh_hz) {
+    double f = (double)ms * refresh_hz / 1000.0 + 0.5;
+    return f >= 4294967295.0 ? 0xFFFFFFFFu : (Uint32)f;
+}
+
+bool is_compiled_schedule(const char *path) {
+    char magic[8] = {0};
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    return n == sizeof(magic) && memcmp(magic, SCHEDULE_MAGIC, sizeof(magic)) == 0;
+}
+
+/* Maps a compiled schedule and checks its version, checksum and tables. */
+static MappedFile *open_schedule(const char *path) {
+#if SDL_BYTEORDER != SDL_LIL_ENDIAN
+    fprintf(stderr, "%s: compiled schedules are only supported on little-endian machines\n", path);
+    return NULL;
+#endif
+    MappedFile *mf = map_file(path);
+    if (!mf) return NULL;
+
+    const ScheduleHeader *h = (const ScheduleHeader *)mf->data;
+    const char *error = NULL;
+    if (mf->size < sizeof(ScheduleHeader) || memcmp(h->magic, SCHEDULE_MAGIC, sizeof(h->magic)) != 0) error = "not a compiled schedule";
+    else if (h->version != SCHEDULE_VERSION && h->version != 1) error = "unsupported version, recompile the CSV file";
+    else if (h->file_size != mf->size) error = "truncated file";
+    else if (SDL_crc32(0, mf->data + sizeof(ScheduleHeader), mf->size - sizeof(ScheduleHeader)) != h->crc32) error = "checksum mismatch";
+    else if (h->rows_offset + (Uint64)h->num_rows * row_size(h) > mf->size ||
+             h->assets_offset + (Uint64)h->num_assets * sizeof(ScheduleAsset) > mf->size ||
+             h->strings_offset + h->strings_size > mf->size || h->strings_size == 0 ||
+             mf->data[h->strings_offset + h->strings_size - 1] != '\0') error = "corrupted tables";
+    else {
+        const ScheduleAsset *assets = (const ScheduleAsset *)(mf->data + h->assets_offset);
+        for (Uint32 i = 0; i < h->num_rows && !error; i++)
+            if (row_at(mf, i)->asset >= h->num_assets) error = "corrupted rows";
+        for (Uint32 i = 0; i < h->num_assets && !error; i++)
+            if (assets[i].content >= h->strings_size) error = "corrupted assets";
+    }
+    if (error) {
+        fprintf(stderr, "%s: %s\n", path, error);
+        unmap_file(mf);
+        return NULL;
+    }
+    return mf;
+}
+
+Experiment *load_compiled_schedule(const char *path) {
+    Uint64 t0 = SDL_GetTicksNS();
+    MappedFile *mf = open_schedule(path);
+    if (!mf) return NULL;
+    const ScheduleHeader *h = (const ScheduleHeader *)mf->data;
+    const ScheduleAsset *assets = (const ScheduleAsset *)(mf->data + h->assets_offset);
+    const char *strings = (const char *)(mf->data + h->strings_offset);
+
+    Experiment *exp = calloc(1, sizeof(Experiment));
+    if (exp) {
+        exp->stimuli = malloc((h->num_rows > 0 ? h->num_rows : 1) * sizeof(Stimulus));
+        exp->strings = strtab_create();
+    }
+    if (!exp || !exp->stimuli || !exp->strings) {
+        free_experiment(exp);
+        unmap_file(mf);
+        return NULL;
+    }
+    exp->frame_rate = h->refresh_mhz / 1000.0f;
+    if (h->version == 1) SDL_Log("%s was compiled without trigger codes: each row sends the default trigger of its type", path);
+
+    for (Uint32 i = 0; i < h->num_rows; i++) {
+        const ScheduleRow *r = row_at(mf, i);
+        Stimulus *s = &exp->stimuli[i];
+        s->timestamp_ms = r->timestamp_ms;
+        s->duration_ms = r->duration_ms;
+        s->type = (StimType)assets[r->asset].type;
+        const char *content = strings + assets[r->asset].content;
+        s->content = strtab_intern(exp->strings, content);
+        if (s->content == STR_EMPTY && content[0]) {
+            SDL_Log("Error: out of memory reading the compiled schedule %s", path);
+            free_experiment(exp);
+            unmap_file(mf);
+            return NULL;
+        }
+        s->color = (SDL_Color){ r->color[0], r->color[1], r->color[2], r->color[3] };
+        s->asset = (int)r->asset;
+        row_trigger(h, r, s->type, &s->trigger_lines, &s->trigger_width_ms);
+        exp->count++;
+    }
+    SDL_Log("Loaded compiled schedule %s: %d events, %u assets in %.1f ms", path, exp->count, h->num_assets, (SDL_GetTicksNS() - t0) / 1e6);
+    unmap_file(mf);
+    return exp;
+}
+
+int compile_schedule_main(int argc, const char *argv[]) {
+    const char *output = NULL;
+    float refresh_hz = 60.0f;
+    static const char *const usage_lines[] = { "expe3000 compile <stimuli_csv_file> [-o schedule.e3s] [--refresh-rate HZ]", NULL };
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_STRING('o', "output", &output, "compiled schedule (default: the CSV name with a .e3s extension)"),
+        OPT_FLOAT (  0, "refresh-rate", &refresh_hz, "refresh rate used for the frame targets (default: 60)"),
+        OPT_END(),
+    };
+    struct argparse ap;
+    argparse_init(&ap, options, usage_lines, 0);
+    argparse_describe(&ap, "\nValidates a CSV schedule and writes it in binary form.", NULL);
+    argc = argparse_parse(&ap, argc, argv);
+    if (argc < 1 || refresh_hz <= 0.0f) {
+        argparse_usage(&ap);
+        return 1;
+    }
+    const char *csv_file = argv[0];
+
+    char out_path[1024];
+    if (output) {
+        strncpy(out_path, output, sizeof(out_path) - 1); out_path[sizeof(out_path) - 1] = '\0';
+    } else {
+        strncpy(out_path, csv_file, sizeof(out_path) - 5); out_path[sizeof(out_path) - 5] = '\0';
+        char *dot = strrchr(out_path, '.');
+        if (dot && !strpbrk(dot, "/\\")) *dot = '\0';
+        strcat(out_path, ".e3s");
+    }
+
+    Experiment *exp = parse_csv(csv_file);
+    if (!exp) return 1;
+    CacheEntry *cache, **entries;
+    int n;
+    Resource *res = prepare_resources(exp, (SDL_Color){0, 0, 0, 0}, &cache, &entries, &n);
+    if (!res) { free_experiment(exp); return 1; }
+
+    /* One string per asset, plus a leading empty string */
+    size_t strings_size = 1;
+    for (int i = 0; i < n; i++) strings_size += strlen(entries[i]->file_path) + 1;
+
+    ScheduleHeader h = {0};
+    memcpy(h.magic, SCHEDULE_MAGIC, sizeof(h.magic));
+    h.version = SCHEDULE_VERSION;
+    h.num_rows = (Uint32)exp->count;
+    h.num_assets = (Uint32)n;
+    h.strings_size = (Uint32)strings_size;
+    h.refresh_mhz = (Uint32)(refresh_hz * 1000.0f + 0.5f);
+    h.rows_offset = sizeof(ScheduleHeader);
+    h.assets_offset = h.rows_offset + (Uint64)exp->count * sizeof(ScheduleRow);
+    h.strings_offset = h.assets_offset + (Uint64)n * sizeof(ScheduleAsset);
+    h.file_size = h.strings_offset + strings_size;
+
+    /* The body is built in memory so that its checksum is known before writing */
+    size_t body_size = (size_t)(h.file_size - sizeof(ScheduleHeader));
+    Uint8 *body = calloc(1, body_size > 0 ? body_size : 1);
+    bool ok = body != NULL;
+    if (ok) {
+        ScheduleRow *rows = (ScheduleRow *)(body + (h.rows_offset - sizeof(ScheduleHeader)));
+        ScheduleAsset *assets = (ScheduleAsset *)(body + (h.assets_offset - sizeof(ScheduleHeader)));
+        char *strings = (char *)(body + (h.strings_offset - sizeof(ScheduleHeader)));
+        size_t pos = 1;
+        for (int i = 0; i < n; i++) {
+            assets[entries[i]->id].type = (Uint32)entries[i]->type;
+            assets[entries[i]->id].content = (Uint32)pos;
+            strcpy(strings + pos, entries[i]->file_path);
+            pos += strlen(entries[i]->file_path) + 1;
+        }
+        for (int i = 0; ok && i < exp->count; i++) {
+            const Stimulus *s = &exp->stimuli[i];
+            ScheduleRow *r = &rows[i];
+            if (!res[i].entry) { ok = false; break; }
+            r->timestamp_ms = s->timestamp_ms;
+            r->duration_ms = s->duration_ms;
+            r->onset_frame = frame_at(s->timestamp_ms, refresh_hz);
+            r->offset_frame = frame_at(s->timestamp_ms + s->duration_ms, refresh_hz);
+            r->asset = (Uint32)res[i].entry->id;
+            r->color[0] = s->color.r; r->color[1] = s->color.g; r->color[2] = s->color.b; r->color[3] = s->color.a;
+            r->trigger_width_ms = s->trigger_width_ms;
+            r->trigger_lines = s->trigger_lines;
+        }
+        h.crc32 = SDL_crc32(0, body, body_size);
+    }
+
+    FILE *f = ok ? fopen(out_path, "wb") : NULL;
+    if (ok && !f) { perror(out_path); ok = false; }
+    if (f) {
+        ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(body, 1, body_size, f) == body_size;
+        if (fclose(f) != 0) ok = false;
+        if (!ok) remove(out_path);
+    }
+    if (ok) printf("Wrote %s: %d events, %d assets, %" PRIu64 " bytes\n", out_path, exp->count, n, h.file_size);
+
+    free(body); free(entries);
+    free_resources(res, cache);
+    free_experiment(exp);
+    return ok ? 0 : 1;
+}
+
+int decompile_schedule_main(int argc, const char *argv[]) {
+    const char *output = NULL;
+    int frames = 0;
+    static const char *const usage_lines[] = { "expe3000 decompile <schedule.e3s> [-o schedule.csv] [--frames]", NULL };
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_STRING ('o', "output", &output, "CSV file (default: standard output)"),
+        OPT_BOOLEAN(  0, "frames", &frames, "append the onset and offset frame targets as two extra columns (@frame)"),
+        OPT_END(),
+    };
+    struct argparse ap;
+    argparse_init(&ap, options, usage_lines, 0);
+    argparse_describe(&ap, "\nConverts a compiled schedule back to CSV.", NULL);
+    argc = argparse_parse(&ap, argc, argv);
+    if (argc < 1) {
+        argparse_usage(&ap);
+        return 1;
+    }
+
+    MappedFile *mf = open_schedule(argv[0]);
+    if (!mf) return 1;
+    FILE *f = output ? fopen(output, "w") : stdout;
+    if (!f) {
+        perror(output);
+        unmap_file(mf);
+        return 1;
+    }
+    const ScheduleHeader *h = (const ScheduleHeader *)mf->data;
+    const ScheduleAsset *assets = (const ScheduleAsset *)(mf->data + h->assets_offset);
+    const char *strings = (const char *)(mf->data + h->strings_offset);
+
+    fprintf(f, "# timestamp, duration, type, content, color, trigger%s\n", frames ? ", @onset_frame, @offset_frame" : "");
+    if (frames) fprintf(f, "# frame targets at %.3f Hz\n", h->refresh_mhz / 1000.0);
+    for (Uint32 i = 0; i < h->num_rows; i++) {
+        const ScheduleRow *r = row_at(mf, i);
+        const ScheduleAsset *a = &assets[r->asset];
+        /* The trigger column is only written when it differs from the default of the type */
+        Stimulus d = { .type = (StimType)a->type };
+        stimulus_default_trigger(&d);
+        Uint8 lines;
+        Uint16 width_ms;
+        row_trigger(h, r, d.type, &lines, &width_ms);
+        bool trigger = lines != d.trigger_lines || width_ms != d.trigger_width_ms;
+        fprintf(f, "%" PRIu64 ",%" PRIu64 ",%s,%s", r->timestamp_ms, r->duration_ms, type_name((StimType)a->type), strings + a->content);
+        if (r->color[3]) fprintf(f, ",#%02X%02X%02X", r->color[0], r->color[1], r->color[2]);
+        else if (trigger || frames) fputc(',', f);
+        if (trigger) {
+            fprintf(f, ",%u", lines);
+            if (width_ms && !(a->type == STIM_SOUND && width_ms == DEFAULT_SOUND_TRIGGER_MS)) fprintf(f, ":%u", width_ms);
+        } else if (frames) fputc(',', f);
+        /* Marked, so that the parser skips them and never reads them as a trigger code */
+        if (frames) fprintf(f, ",@%u,@%u", r->onset_frame, r->offset_frame);
+        fputc('\n', f);
+    }
+
+    bool ok = !ferror(f);
+    if (output && fclose(f) != 0) ok = false;
+    unmap_file(mf);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef COMPILED_SCHEDULE_H
+#define COMPILED_SCHEDULE_H
+
+#include "stimuli.h"
+
+/*
+ * Compiled schedules (.e3s).
+ *
+ * A compiled schedule is a validated CSV schedule in binary form: rows with
+ * resolved asset ids and their onset/offset frames at a given refresh rate
+ * (informational: the runner schedules from the times in ms),
+ * a string table for the contents, and a CRC-32 of everything after the
+ * header. Loading one needs no text parsing and no re-validation. The CSV
+ * stays the reference form; "decompile" gives it back.
+ */
+
+/**
+ * @brief Returns true if the file starts with the compiled schedule magic.
+ */
+bool is_compiled_schedule(const char *path);
+
+/**
+ * @brief Loads a compiled schedule after checking its version and checksum.
+ */
+Experiment *load_compiled_schedule(const char *path);
+
+/**
+ * @brief Entry point of the "compile" subcommand (argv[0] is "compile").
+ */
+int compile_schedule_main(int argc, const char *argv[]);
+
+/**
+ * @brief Entry point of the "decompile" subcommand (argv[0] is "decompile").
+ */
+int decompile_schedule_main(int argc, const char *argv[]);
+
+#endif // COMPILED_SCHEDULE_H
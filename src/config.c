@@ -81,12 +81,19 @@ bool parse_args(int argc, const char **argv, Config *cfg) {
     cfg->font_size = 24; cfg->screen_w = 1920; cfg->screen_h = 1080;
     cfg->display_index = 0; cfg->scale_factor = 1.0f; cfg->use_fixation = true;
     cfg->vsync = true;
+    cfg->scale_filter = RESAMPLE_LANCZOS;
+    cfg->refresh_rate = 60.0f;
+    cfg->max_overlaps = -1;
+    cfg->stream_ahead = 64;
+    cfg->timing_tolerance_ms = 5.0f;
+    cfg->photodiode_size = 50;
     cfg->bg_color = (SDL_Color){0, 0, 0, 255};
     cfg->text_color = (SDL_Color){255, 255, 255, 255};
     cfg->fixation_color = (SDL_Color){255, 255, 255, 255};
 
-    int no_vsync = 0, use_fixation = 0, fullscreen = 0, show_version = 0, force_gui = 0;
-    const char *scale_str = NULL, *duration_str = NULL, *res_str = NULL;
+    int no_vsync = 0, use_fixation = 0, fullscreen = 0, show_version = 0, force_gui = 0, prescale = 0, check = 0, stream = 0, binary_log = 0, trigger_drain = 0;
+    const char *scale_str = NULL, *scale_filter_str = NULL, *duration_str = NULL, *res_str = NULL, *trigger_timing_str = NULL, *dlp_inputs_str = NULL;
+    const char *photodiode_str = NULL, *photodiode_pattern_str = NULL;
     const char *output_file_arg = NULL, *stim_dir_arg = NULL;
     const char *bg_color_str = NULL, *text_color_str = NULL, *fixation_color_str = NULL;
 
@@ -96,23 +103,48 @@ bool parse_args(int argc, const char **argv, Config *cfg) {
         OPT_GROUP("Output"),
         OPT_STRING ('o', "output", &output_file_arg, "output csv"),
         OPT_STRING (  0, "stimuli-dir", &stim_dir_arg, "stimuli dir"),
+        OPT_BOOLEAN(  0, "binary-log", &binary_log, "write the results as a compact binary log (see the export command)"),
+        OPT_STRING (  0, "status-file", &cfg->status_file, "rewrite the progress of the run to this CSV file a few times per second"),
+        OPT_STRING (  0, "control-socket", &cfg->control_socket, "serve live telemetry and accept pause, abort and mark commands on this local socket"),
+        OPT_FLOAT  (  0, "timing-tolerance", &cfg->timing_tolerance_ms, "timing report: count events off by more than this many ms (default: 5)"),
         OPT_GROUP("Display"),
         OPT_BOOLEAN('g', "gui", &force_gui, "force starting with the GUI"),
         OPT_BOOLEAN('F', "fullscreen", &fullscreen, "fullscreen"),
         OPT_INTEGER('d', "display", &cfg->display_index, "display index"),
         OPT_STRING ('r', "res", &res_str, "WxH"),
         OPT_STRING ('s', "scale", &scale_str, "scale"),
+        OPT_BOOLEAN(  0, "prescale", &prescale, "resample images to their on-screen size at load time"),
+        OPT_STRING (  0, "scale-filter", &scale_filter_str, "image scaling filter: nearest, linear or lanczos"),
         OPT_BOOLEAN('x', "no-fixation", &use_fixation, "no-fixation"),
         OPT_STRING (  0, "bg-color", &bg_color_str, "background color R,G,B"),
         OPT_STRING (  0, "fixation-color", &fixation_color_str, "fixation cross color R,G,B"),
+        OPT_STRING (  0, "start-splash", &cfg->start_splash, "image shown before the run, until a key is pressed"),
+        OPT_STRING (  0, "end-splash", &cfg->end_splash, "image shown after the run, until a key is pressed"),
+        OPT_STRING (  0, "photodiode", &photodiode_str, "draw a photodiode patch in a corner: tl, tr, bl or br"),
+        OPT_INTEGER(  0, "photodiode-size", &cfg->photodiode_size, "side of the photodiode patch in pixels (default: 50)"),
+        OPT_STRING (  0, "photodiode-pattern", &photodiode_pattern_str, "hold (white while the stimulus is shown, default) or flash (onset frame only)"),
         OPT_GROUP("Text"),
         OPT_STRING ('f', "font", &cfg->font_file, "font file"),
         OPT_INTEGER('z', "font-size", &cfg->font_size, "font size"),
         OPT_STRING (  0, "text-color", &text_color_str, "text color R,G,B"),
+        OPT_INTEGER(  0, "wrap-width", &cfg->wrap_width, "text wrap width in pixels (default: 90% of screen width)"),
         OPT_GROUP("Other"),
         OPT_STRING ('D', "total-duration", &duration_str, "duration ms"),
         OPT_STRING (  0, "dlp", &cfg->dlp_device, "dlp device"),
+        OPT_STRING (  0, "trigger-timing", &trigger_timing_str, "when visual triggers are sent: render (default) or present"),
+        OPT_INTEGER(  0, "trigger-offset", &cfg->trigger_offset_ms, "with --trigger-timing present, delay the triggers by this many ms"),
+        OPT_BOOLEAN(  0, "trigger-drain", &trigger_drain, "also log when each trigger has left the serial port (TRIGGER_DRAINED)"),
+        OPT_STRING (  0, "dlp-inputs", &dlp_inputs_str, "DLP lines to log as inputs, e.g. 5678 (lines 1-3 are trigger outputs)"),
         OPT_BOOLEAN(  0, "no-vsync", &no_vsync, "no-vsync"),
+        OPT_STRING (  0, "memory-report", &cfg->memory_report, "write the per-stimulus memory footprint to a CSV file"),
+        OPT_INTEGER(  0, "memory-budget", &cfg->memory_budget_mb, "refuse to start if resources need more than this many MB"),
+        OPT_BOOLEAN(  0, "stream", &stream, "read and decode the CSV schedule while it runs, in constant memory"),
+        OPT_INTEGER(  0, "stream-ahead", &cfg->stream_ahead, "rows decoded ahead of the playhead with --stream (default: 64)"),
+        OPT_GROUP("Schedule check"),
+        OPT_BOOLEAN(  0, "check", &check, "analyze the schedule and its stimuli without opening a window"),
+        OPT_FLOAT  (  0, "refresh-rate", &cfg->refresh_rate, "refresh rate assumed by --check (default: 60)"),
+        OPT_FLOAT  (  0, "max-frame-error", &cfg->max_frame_error_ms, "--check fails if a quantization error exceeds this many ms"),
+        OPT_INTEGER(  0, "max-overlaps", &cfg->max_overlaps, "--check fails if more visual stimuli than this overlap (e.g. 0)"),
         OPT_END(),
     };
 
@@ -127,6 +159,17 @@ bool parse_args(int argc, const char **argv, Config *cfg) {
     if (output_file_arg) strncpy(cfg->output_file, output_file_arg, 1023);
     if (stim_dir_arg) strncpy(cfg->stimuli_dir, stim_dir_arg, 1023);
 
+    if (check > 0) {
+        cfg->check = true;
+        if (text_color_str) parse_color(text_color_str, &cfg->text_color);
+        if (argc < 1 || cfg->refresh_rate <= 0.0f) {
+            fprintf(stderr, "--check needs a schedule file and a positive refresh rate\n");
+            return false;
+        }
+        strncpy(cfg->csv_file, (const char *)argv[0], 1023);
+        return true;
+    }
+
     if (force_gui) {
         load_config_cache(cfg);
         /* If user provided arguments, they should override the cache */
@@ -161,6 +204,36 @@ bool parse_args(int argc, const char **argv, Config *cfg) {
     cfg->vsync = !no_vsync;
     if (res_str) sscanf(res_str, "%dx%d", &cfg->screen_w, &cfg->screen_h);
     if (scale_str) cfg->scale_factor = (float)atof(scale_str);
+    if (prescale > 0) cfg->prescale = true;
+    if (stream > 0) cfg->stream = true;
+    if (binary_log > 0) cfg->binary_log = true;
+    if (trigger_drain > 0) cfg->trigger_drain = true;
+    if (cfg->stream_ahead < 2) cfg->stream_ahead = 2;
+    if (scale_filter_str && !parse_resample_filter(scale_filter_str, &cfg->scale_filter)) {
+        fprintf(stderr, "Unknown scale filter '%s', using lanczos.\n", scale_filter_str);
+    }
+    if (trigger_timing_str) {
+        if (strcmp(trigger_timing_str, "present") == 0) cfg->trigger_timing = TRIGGER_AT_PRESENT;
+        else if (strcmp(trigger_timing_str, "render") != 0) fprintf(stderr, "Unknown trigger timing '%s', using render.\n", trigger_timing_str);
+    }
+    for (const char *c = dlp_inputs_str; c && *c; c++) {
+        if (*c >= '1' && *c <= '8') cfg->dlp_inputs |= (Uint8)(1u << (*c - '1'));
+        else fprintf(stderr, "Ignoring '%c' in --dlp-inputs: lines are numbered 1 to 8.\n", *c);
+    }
+    if (photodiode_str) {
+        static const char *const corners[] = { "tl", "tr", "bl", "br" };
+        for (int i = 0; i < 4; i++) if (strcmp(photodiode_str, corners[i]) == 0) cfg->photodiode = (PhotodiodeCorner)(PHOTODIODE_TOP_LEFT + i);
+        if (cfg->photodiode == PHOTODIODE_OFF) fprintf(stderr, "Unknown photodiode corner '%s' (expected tl, tr, bl or br), no patch.\n", photodiode_str);
+    }
+    if (photodiode_pattern_str) {
+        if (strcmp(photodiode_pattern_str, "flash") == 0) cfg->photodiode_pattern = PHOTODIODE_FLASH;
+        else if (strcmp(photodiode_pattern_str, "hold") != 0) fprintf(stderr, "Unknown photodiode pattern '%s', using hold.\n", photodiode_pattern_str);
+    }
+    if (cfg->photodiode_size < 1) cfg->photodiode_size = 50;
+    if (cfg->trigger_offset_ms < 0) {
+        fprintf(stderr, "The trigger offset cannot be negative, using 0.\n");
+        cfg->trigger_offset_ms = 0;
+    }
     if (duration_str) cfg->total_duration = (Uint64)atoll(duration_str);
     if (bg_color_str) parse_color(bg_color_str, &cfg->bg_color);
     if (text_color_str) parse_color(text_color_str, &cfg->text_color);
@@ -178,6 +251,7 @@ bool parse_args(int argc, const char **argv, Config *cfg) {
             ext[15] = '\0';
             *dot = '\0';
         }
+        if (cfg->binary_log && strcmp(ext, ".csv") == 0) strcpy(ext, ".e3l");
 
         char csv_base[256];
         const char *last_slash = strrchr(cfg->csv_file, '/');
@@ -12,6 +12,25 @@
 
 #include <SDL3/SDL.h>
 #include <stdbool.h>
+#include "resample.h"
+
+typedef enum {
+    TRIGGER_AT_RENDER,      /* Queued when the frame is drawn, before the present */
+    TRIGGER_AT_PRESENT      /* Written after the present returns, plus trigger_offset_ms */
+} TriggerTiming;
+
+typedef enum {
+    PHOTODIODE_OFF,
+    PHOTODIODE_TOP_LEFT,
+    PHOTODIODE_TOP_RIGHT,
+    PHOTODIODE_BOTTOM_LEFT,
+    PHOTODIODE_BOTTOM_RIGHT
+} PhotodiodeCorner;
+
+typedef enum {
+    PHOTODIODE_HOLD,        /* White while the stimulus is on screen */
+    PHOTODIODE_FLASH        /* White on the onset frame only */
+} PhotodiodePattern;
 
 typedef struct {
     char csv_file[1024];
@@ -21,11 +40,33 @@ typedef struct {
     char *end_splash;
     char *font_file;
     char *dlp_device;
+    TriggerTiming trigger_timing;   /* When visual triggers go out */
+    int   trigger_offset_ms;        /* Delay after the present with TRIGGER_AT_PRESENT */
+    bool  trigger_drain;            /* Log when each trigger has been sent (TRIGGER_DRAINED) */
+    Uint8 dlp_inputs;               /* DLP lines polled as inputs (bit i is line i+1) */
+    PhotodiodeCorner photodiode;    /* Corner of the photodiode patch */
+    int   photodiode_size;          /* Side of the patch in pixels */
+    PhotodiodePattern photodiode_pattern;
+    char *memory_report;
+    bool  binary_log;               /* Write the results as a binary event log (.e3l) */
+    char *status_file;              /* Progress rewritten a few times per second, or NULL */
+    char *control_socket;           /* Local socket for operator consoles, or NULL */
+    float timing_tolerance_ms;      /* Timing report: events off by more than this are counted */
+    int   memory_budget_mb;
+    bool  check;
+    float refresh_rate;             /* Assumed by --check */
+    float max_frame_error_ms;       /* --check fails above this error (0: no limit) */
+    int   max_overlaps;             /* --check fails above this many visual overlaps (-1: no limit) */
+    bool  stream;                   /* Read and decode the schedule while it runs */
+    int   stream_ahead;             /* Rows decoded ahead of the playhead */
     int   font_size;
+    int   wrap_width;
     int   screen_w;
     int   screen_h;
     int   display_index;
     float scale_factor;
+    bool  prescale;
+    ResampleFilter scale_filter;
     Uint64 total_duration;
     bool  use_fixation;
     bool  fullscreen;
@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "control_socket.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#else
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#include <fcntl.h>
+#include <unistd.h>
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL     /* A console that went away must not kill the run with SIGPIPE */
+#else
+#define SEND_FLAGS 0
+#endif
+
+#define CONTROL_QUEUE_SIZE   16     /* Power of two */
+#define CONTROL_PERIOD_MS    250    /* Telemetry at most this often */
+#define CONTROL_POLL_MS      50
+#define MAX_CLIENTS          4
+#define CONTROL_LINE_SIZE    256
+#define CONTROL_OUT_SIZE     1024   /* Whole lines waiting for a client that reads slowly */
+
+typedef struct {
+    socket_t fd;
+    char line[CONTROL_LINE_SIZE];
+    int len;                        /* -1 while skipping a line that was too long */
+    char out[CONTROL_OUT_SIZE];     /* Lines not sent yet, the first one maybe in part */
+    int out_len;
+} Client;
+
+/* Single-producer, single-consumer mailbox: head is only written by the
+   socket thread, tail only by the frame loop. */
+struct ControlSocket {
+    char *path;
+    socket_t listener;
+    Client clients[MAX_CLIENTS];
+    void *progress;                 /* ProgressMonitor, set atomically once the run has started */
+    AudioMixer *mixer;
+    StringTable *strings;
+    ControlCommand ring[CONTROL_QUEUE_SIZE];
+    SDL_AtomicInt head;
+    SDL_AtomicInt tail;
+    SDL_AtomicInt paused;
+    SDL_AtomicInt quit;
+    SDL_Thread *thread;
+};
+
+static void set_nonblocking(socket_t fd) {
+#ifdef _WIN32
+    u_long on = 1;
+    ioctlsocket(fd, FIONBIO, &on);
+#else
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+#endif
+}
+
+/* Sends what the socket takes now; the rest waits for the socket to be writable */
+static void flush_client(Client *c) {
+    while (c->out_len > 0) {
+        int n = (int)send(c->fd, c->out, c->out_len, SEND_FLAGS);
+        if (n <= 0) return;
+        c->out_len -= n;
+        memmove(c->out, c->out + n, (size_t)c->out_len);
+    }
+}
+
+/* A client that does not read misses whole lines rather than blocking the thread */
+static void send_line(Client *c, const char *line) {
+    int len = (int)strlen(line);
+    if (c->out_len + len > CONTROL_OUT_SIZE) return;
+    memcpy(c->out + c->out_len, line, (size_t)len);
+    c->out_len += len;
+    flush_client(c);
+}
+
+static bool post(ControlSocket *cs, ControlType type, StrId label) {
+    int head = SDL_GetAtomicInt(&cs->head);
+    if (head - SDL_GetAtomicInt(&cs->tail) >= CONTROL_QUEUE_SIZE) return false;
+    cs->ring[head & (CONTROL_QUEUE_SIZE - 1)] = (ControlCommand){ type, label };
+    SDL_SetAtomicInt(&cs->head, head + 1);
+    return true;
+}
+
+static void handle_command(ControlSocket *cs, Client *c, char *line) {
+    size_t n = strlen(line);
+    while (n > 0 && (line[n - 1] == '\r' || line[n - 1] == ' ')) line[--n] = '\0';
+    if (n == 0) return;
+    bool posted;
+    if (strcmp(line, "abort") == 0) posted = post(cs, CONTROL_ABORT, STR_EMPTY);
+    else if (strcmp(line, "pause") == 0) posted = post(cs, CONTROL_PAUSE, STR_EMPTY);
+    else if (strcmp(line, "resume") == 0) posted = post(cs, CONTROL_RESUME, STR_EMPTY);
+    else if (strncmp(line, "mark ", 5) == 0 && line[5]) {
+        if (n - 5 > CONTROL_LABEL_SIZE) {
+            send_line(c, "error: label too long (at most 64 bytes)\n");
+            return;
+        }
+        /* Interned here, so that the frame loop never waits on the table lock */
+        StrId label = strtab_intern(cs->strings, line + 5);
+        if (label == STR_EMPTY) {
+            send_line(c, "error: out of memory\n");
+            return;
+        }
+        posted = post(cs, CONTROL_MARK, label);
+    } else {
+        send_line(c, "error: unknown command (abort, pause, resume or mark <label>)\n");
+        return;
+    }
+    send_line(c, posted ? "ok\n" : "error: busy, try again\n");
+}
+
+/* Returns false when the client has disconnected */
+static bool read_client(ControlSocket *cs, Client *c) {
+    char buf[CONTROL_LINE_SIZE];
+    int n = (int)recv(c->fd, buf, sizeof(buf), 0);
+    if (n <= 0) return false;
+    for (int i = 0; i < n; i++) {
+        if (buf[i] == '\n') {
+            if (c->len >= 0) {
+                c->line[c->len] = '\0';
+                handle_command(cs, c, c->line);
+            }
+            c->len = 0;
+        } else if (c->len >= 0) {
+            if (c->len < CONTROL_LINE_SIZE - 1) c->line[c->len++] = buf[i];
+            else {
+                send_line(c, "error: line too long\n");
+                c->len = -1;
+            }
+        }
+    }
+    return true;
+}
+
+static void accept_client(ControlSocket *cs) {
+    socket_t fd = accept(cs->listener, NULL, NULL);
+    if (fd == INVALID_SOCKET) return;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (cs->clients[i].fd != INVALID_SOCKET) continue;
+        set_nonblocking(fd);
+        cs->clients[i] = (Client){ .fd = fd, .len = 0 };
+        return;
+    }
+    Client full = { .fd = fd };
+    send_line(&full, "error: too many clients\n");
+    close_socket(fd);
+}
+
+static void format_status(ControlSocket *cs, ProgressMonitor *progress, char *buf, size_t size) {
+    int total;
+    ProgressState st = progress_snapshot(progress, &total);
+    int underruns = cs->mixer ? SDL_GetAtomicInt(&cs->mixer->underruns) : 0;
+    SDL_snprintf(buf, size, "status rows=%d total=%d last_onset_error_ms=%d max_onset_error_ms=%d dropped_frames=%d audio_underruns=%d paused=%d\n",
+                 st.rows, total, st.last_error_ms, st.max_error_ms, st.dropped_frames, underruns, SDL_GetAtomicInt(&cs->paused));
+}
+
+static int SDLCALL control_thread(void *data) {
+    ControlSocket *cs = (ControlSocket *)data;
+    SDL_SetCurrentThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    char sent[CONTROL_LINE_SIZE] = "", status[CONTROL_LINE_SIZE];
+    Uint64 sent_at = 0;
+    while (!SDL_GetAtomicInt(&cs->quit)) {
+        fd_set readable, writable;
+        FD_ZERO(&readable);
+        FD_ZERO(&writable);
+        FD_SET(cs->listener, &readable);
+        socket_t max_fd = cs->listener;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (cs->clients[i].fd == INVALID_SOCKET) continue;
+            FD_SET(cs->clients[i].fd, &readable);
+            if (cs->clients[i].out_len > 0) FD_SET(cs->clients[i].fd, &writable);
+            if (cs->clients[i].fd > max_fd) max_fd = cs->clients[i].fd;
+        }
+        struct timeval timeout = { 0, CONTROL_POLL_MS * 1000 };
+        bool joined = false;
+        if (select((int)max_fd + 1, &readable, &writable, NULL, &timeout) > 0) {
+            for (int i = 0; i < MAX_CLIENTS; i++) {
+                Client *c = &cs->clients[i];
+                if (c->fd == INVALID_SOCKET) continue;
+                if (FD_ISSET(c->fd, &writable)) flush_client(c);
+                if (FD_ISSET(c->fd, &readable) && !read_client(cs, c)) {
+                    close_socket(c->fd);
+                    c->fd = INVALID_SOCKET;
+                }
+            }
+            if (FD_ISSET(cs->listener, &readable)) {
+                accept_client(cs);
+                joined = true;
+            }
+        }
+
+        /* Only what changed is sent, except to a client that just connected; nothing before the run */
+        ProgressMonitor *progress = (ProgressMonitor *)SDL_GetAtomicPointer(&cs->progress);
+        Uint64 now = SDL_GetTicks();
+        if (!progress || (!joined && now - sent_at < CONTROL_PERIOD_MS)) continue;
+        format_status(cs, progress, status, sizeof(status));
+        if (!joined && strcmp(status, sent) == 0) continue;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (cs->clients[i].fd != INVALID_SOCKET) send_line(&cs->clients[i], status);
+        }
+        SDL_strlcpy(sent, status, sizeof(sent));
+        sent_at = now;
+    }
+    return 0;
+}
+
+/* A socket left by a run that crashed would make bind() fail; anything else at path is not ours to remove */
+static bool clear_path(const char *path, const struct sockaddr_un *addr) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path);
+    if (attributes == INVALID_FILE_ATTRIBUTES) return true;
+    bool is_socket = (attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+#else
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        if (errno == ENOENT) return true;
+        SDL_Log("Error: cannot check the control socket path '%s': %s", path, strerror(errno));
+        return false;
+    }
+    bool is_socket = S_ISSOCK(st.st_mode);
+#endif
+    if (!is_socket) {
+        SDL_Log("Error: '%s' exists and is not a socket, refusing to replace it with the control socket", path);
+        return false;
+    }
+    /* A session still serving it answers */
+    socket_t probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool live = probe != INVALID_SOCKET && connect(probe, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    if (probe != INVALID_SOCKET) close_socket(probe);
+    if (live) {
+        SDL_Log("Error: the control socket '%s' is in use by another session", path);
+        return false;
+    }
+    if (remove(path) != 0) {
+        SDL_Log("Error: cannot remove the stale control socket '%s'", path);
+        return false;
+    }
+    return true;
+}
+
+ControlSocket *control_socket_start(const char *path, StringTable *strings, AudioMixer *mixer) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        SDL_Log("Error: the control socket path '%s' is too long", path);
+        return NULL;
+    }
+    SDL_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        SDL_Log("Error: cannot initialize Winsock for the control socket");
+        return NULL;
+    }
+#endif
+
+    ControlSocket *cs = calloc(1, sizeof(ControlSocket));
+    if (!cs) goto fail;
+    cs->mixer = mixer;
+    cs->strings = strings;
+    cs->listener = INVALID_SOCKET;
+    for (int i = 0; i < MAX_CLIENTS; i++) cs->clients[i].fd = INVALID_SOCKET;
+    if (!clear_path(path, &addr)) goto fail;
+    cs->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (cs->listener == INVALID_SOCKET || bind(cs->listener, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        SDL_Log("Error: cannot create the control socket '%s'", path);
+        goto fail;
+    }
+#ifndef _WIN32
+    chmod(path, S_IRUSR | S_IWUSR);     /* Only the user running the session may control it */
+#endif
+    cs->path = SDL_strdup(path);
+    if (listen(cs->listener, MAX_CLIENTS) != 0) {
+        SDL_Log("Error: cannot listen on the control socket '%s'", path);
+        goto fail;
+    }
+    cs->thread = SDL_CreateThread(control_thread, "expe3000-control", cs);
+    if (!cs->thread) {
+        SDL_Log("Error: cannot start the control socket thread: %s", SDL_GetError());
+        goto fail;
+    }
+    return cs;
+
+fail:
+    if (cs) {
+        if (cs->listener != INVALID_SOCKET) close_socket(cs->listener);
+        if (cs->path) remove(cs->path);
+        SDL_free(cs->path);
+        free(cs);
+    }
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return NULL;
+}
+
+void control_socket_stop(ControlSocket *cs) {
+    if (!cs) return;
+    SDL_SetAtomicInt(&cs->quit, 1);
+    SDL_WaitThread(cs->thread, NULL);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (cs->clients[i].fd != INVALID_SOCKET) close_socket(cs->clients[i].fd);
+    }
+    close_socket(cs->listener);
+    remove(cs->path);
+    SDL_free(cs->path);
+    free(cs);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void control_socket_set_progress(ControlSocket *cs, ProgressMonitor *progress) {
+    if (cs) SDL_SetAtomicPointer(&cs->progress, progress);
+}
+
+bool control_poll(ControlSocket *cs, ControlCommand *cmd) {
+    if (!cs) return false;
+    int tail = SDL_GetAtomicInt(&cs->tail);
+    if (tail == SDL_GetAtomicInt(&cs->head)) return false;
+    *cmd = cs->ring[tail & (CONTROL_QUEUE_SIZE - 1)];
+    SDL_SetAtomicInt(&cs->tail, tail + 1);
+    return true;
+}
+
+void control_set_paused(ControlSocket *cs, bool paused) {
+    if (cs) SDL_SetAtomicInt(&cs->paused, paused ? 1 : 0);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+
+#include <SDL3/SDL.h>
+#include "audio.h"
+#include "progress_monitor.h"
+#include "strtab.h"
+
+/*
+ * Control socket.
+ *
+ * A low-priority thread serves a local (Unix domain) socket for operator
+ * consoles. Clients receive a status line whenever the telemetry changes:
+ *
+ *   status rows=12 total=300 last_onset_error_ms=1 max_onset_error_ms=3 dropped_frames=0 audio_underruns=0 paused=0
+ *
+ * and may send line commands: abort, pause, resume and mark <label>, each
+ * answered with "ok" or "error: ...". Commands reach the frame loop through
+ * a lock-free mailbox that it polls once per frame; mark labels are interned
+ * by the socket thread, so the frame loop takes no lock.
+ */
+
+#define CONTROL_LABEL_SIZE 64       /* Longest mark label, in bytes */
+
+typedef enum {
+    CONTROL_ABORT,
+    CONTROL_PAUSE,                  /* At the next trial boundary */
+    CONTROL_RESUME,
+    CONTROL_MARK
+} ControlType;
+
+typedef struct {
+    ControlType type;
+    StrId label;                    /* CONTROL_MARK only */
+} ControlCommand;
+
+typedef struct ControlSocket ControlSocket;
+
+/**
+ * @brief Creates the socket at path and starts serving it, or returns NULL.
+ *
+ * A socket file left at path is replaced, unless a session still serves it;
+ * any other file is left alone and the call fails. Mark labels are interned
+ * in strings; mixer is read for the telemetry and may be NULL.
+ */
+ControlSocket *control_socket_start(const char *path, StringTable *strings, AudioMixer *mixer);
+
+/**
+ * @brief Starts sending the telemetry of progress, once the run has started. cs may be NULL.
+ */
+void control_socket_set_progress(ControlSocket *cs, ProgressMonitor *progress);
+
+/**
+ * @brief Disconnects the clients, removes the socket and stops the thread.
+ */
+void control_socket_stop(ControlSocket *cs);
+
+/**
+ * @brief Takes the next command, if any. Lock-free, to be called from a single thread (the frame loop). cs may be NULL.
+ */
+bool control_poll(ControlSocket *cs, ControlCommand *cmd);
+
+/**
+ * @brief Reports whether the run is paused, for the telemetry. cs may be NULL.
+ */
+void control_set_paused(ControlSocket *cs, bool paused);
+
+#endif // CONTROL_SOCKET_H
@@ -9,56 +9,203 @@
 
 #include <SDL3/SDL.h>
 #include "csv_parser.h"
+#include "mapped_file.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 
+#define MAX_REPORTED_ERRORS 20
+#define MAX_FIELDS          8       /* Up to the trigger code, then the two frame targets of decompile --frames */
+#define FRAME_MARK          '@'     /* Frame targets are written "@123", so that they can never pass for a trigger code */
+
+/* Parses an optional "#RRGGBB" colour column. */
+static bool parse_hex_color(const char *str, size_t len, SDL_Color *color) {
+    while (len > 0 && *str == ' ') { str++; len--; }
+    if (len != 7 || str[0] != '#') return false;
+    Uint8 rgb[3];
+    for (int i = 0; i < 3; i++) {
+        int v = 0;
+        for (int j = 1; j <= 2; j++) {
+            char c = str[2 * i + j];
+            v <<= 4;
+            if (c >= '0' && c <= '9') v |= c - '0';
+            else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+            else return false;
+        }
+        rgb[i] = (Uint8)v;
+    }
+    *color = (SDL_Color){rgb[0], rgb[1], rgb[2], 255};
+    return true;
+}
+
+/* Parses a field made of digits, optionally surrounded by spaces. */
+static bool parse_u64(const char *str, size_t len, Uint64 *value) {
+    while (len > 0 && *str == ' ') { str++; len--; }
+    while (len > 0 && str[len - 1] == ' ') len--;
+    if (len == 0) return false;
+    Uint64 v = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] < '0' || str[i] > '9') return false;
+        Uint64 d = (Uint64)(str[i] - '0');
+        if (v > (SDL_MAX_UINT64 - d) / 10) return false;
+        v = v * 10 + d;
+    }
+    *value = v;
+    return true;
+}
+
+/* Parses an optional "code" or "code:width_ms" trigger column; code is the mask of DLP lines (0-255). */
+static bool parse_trigger(const char *str, size_t len, StimType type, Uint8 *lines, Uint16 *width_ms) {
+    const char *colon = memchr(str, ':', len);
+    size_t code_len = colon ? (size_t)(colon - str) : len;
+    Uint64 code, width = 0;
+    if (!parse_u64(str, code_len, &code) || code > 255) return false;
+    if (colon && (!parse_u64(colon + 1, len - code_len - 1, &width) || width == 0 || width > SDL_MAX_UINT16)) return false;
+    /* A sound has no offset to end a held trigger */
+    if (!colon && type == STIM_SOUND) width = DEFAULT_SOUND_TRIGGER_MS;
+    *lines = (Uint8)code;
+    *width_ms = (Uint16)width;
+    return true;
+}
+
+/* A frame target column of decompile --frames: "@" and digits, skipped by the parser */
+static bool is_frame_target(const char *str, size_t len) {
+    Uint64 frame;
+    while (len > 0 && *str == ' ') { str++; len--; }
+    return len > 1 && str[0] == FRAME_MARK && parse_u64(str + 1, len - 1, &frame);
+}
+
+static StimType parse_type(const char *str, size_t len) {
+    if (len == 5 && memcmp(str, "IMAGE", 5) == 0) return STIM_IMAGE;
+    if (len == 5 && memcmp(str, "SOUND", 5) == 0) return STIM_SOUND;
+    if (len == 4 && memcmp(str, "TEXT", 4) == 0) return STIM_TEXT;
+    return STIM_END;
+}
+
+CsvLine parse_csv_line(const char *line, size_t len, StringTable *strings, Stimulus *s, const char **error) {
+    *error = NULL;
+    if (len > 0 && line[len - 1] == '\r') len--;
+    if (len == 0 || line[0] == '#' || line[0] == ' ') return CSV_SKIP;
+
+    /* Split on commas: timestamp, duration, type, content, optional colour, trigger code and frame targets */
+    const char *field[MAX_FIELDS];
+    size_t field_len[MAX_FIELDS];
+    int n = 0;
+    const char *f = line, *line_end = line + len;
+    bool more = false;
+    while (n < MAX_FIELDS) {
+        const char *comma = memchr(f, ',', (size_t)(line_end - f));
+        field[n] = f;
+        field_len[n] = (size_t)((comma ? comma : line_end) - f);
+        n++;
+        if (!comma) break;
+        f = comma + 1;
+        more = n == MAX_FIELDS;
+    }
+
+    /* Before trigger codes, decompile --frames wrote its frame targets unmarked from the sixth column on:
+       such a row must not be read as a trigger code */
+    if (n < 4) *error = "expected at least 4 columns (timestamp,duration,type,content)";
+    else if (more) *error = "too many columns";
+    else if (n >= 7 && (!is_frame_target(field[6], field_len[6]) || (n == 8 && !is_frame_target(field[7], field_len[7]))))
+        *error = "unexpected column after the trigger code (frame targets are marked @; output of an older decompile --frames must be decompiled again)";
+    else if (n >= 6 && is_frame_target(field[5], field_len[5])) *error = "frame target in the trigger column";
+    else if (!parse_u64(field[0], field_len[0], &s->timestamp_ms)) *error = "invalid timestamp";
+    else if (!parse_u64(field[1], field_len[1], &s->duration_ms)) *error = "invalid duration";
+    else if ((s->type = parse_type(field[2], field_len[2])) == STIM_END) *error = "unknown type (expected IMAGE, SOUND or TEXT)";
+    else if (field_len[3] == 0) *error = "empty content";
+    if (*error) return CSV_ERROR;
+
+    s->content = strtab_intern_len(strings, field[3], field_len[3]);
+    if (s->content == STR_EMPTY) return CSV_ERROR;
+    s->color = (SDL_Color){0, 0, 0, 0};
+    s->asset = -1;
+    stimulus_default_trigger(s);
+    if (n >= 6 && field_len[5] > 0 && !parse_trigger(field[5], field_len[5], s->type, &s->trigger_lines, &s->trigger_width_ms)) {
+        *error = "invalid trigger code (expected 0-255 or code:width_ms)";
+        return CSV_ERROR;
+    }
+    if (n >= 5 && field_len[4] > 0 && !parse_hex_color(field[4], field_len[4], &s->color))
+        *error = "invalid colour (expected #RRGGBB)";
+    return CSV_ROW;
+}
+
+/* The schedule is mapped and tokenized in place, in a single pass: fields are
+   (pointer, length) views into the mapping and only the content is copied. */
 Experiment* parse_csv(const char *file_path) {
-    FILE *file = fopen(file_path, "r");
-    if (!file) {
-        perror("Error opening CSV file");
+    Uint64 t0 = SDL_GetTicksNS();
+    MappedFile *mf = map_file(file_path);
+    if (!mf) {
+        fprintf(stderr, "Error opening CSV file '%s'\n", file_path);
         return NULL;
     }
+    const char *p = (const char *)mf->data, *end = p + mf->size;
 
-    Experiment *exp = malloc(sizeof(Experiment));
-    exp->stimuli = NULL;
-    exp->count = 0;
+    /* Every row ends with a newline except maybe the last one */
+    size_t capacity = 1;
+    for (const char *q = p; (q = memchr(q, '\n', (size_t)(end - q))) != NULL; q++) capacity++;
 
-    char line[512];
-    Uint64 last_timestamp = 0;
-    while (fgets(line, sizeof(line), file)) {
-        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r' || line[0] == ' ') continue;
+    Experiment *exp = calloc(1, sizeof(Experiment));
+    if (exp) {
+        exp->stimuli = malloc(capacity * sizeof(Stimulus));
+        exp->strings = strtab_create();
+    }
+    if (!exp || !exp->stimuli || !exp->strings) {
+        fprintf(stderr, "Out of memory reading '%s'\n", file_path);
+        free_experiment(exp);
+        unmap_file(mf);
+        return NULL;
+    }
 
-        exp->stimuli = realloc(exp->stimuli, (exp->count + 1) * sizeof(Stimulus));
+    int line_no = 0, errors = 0;
+    Uint64 last_timestamp = 0;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        const char *line = p;
+        size_t len = (size_t)(eol - line);
+        p = eol + 1;
+        line_no++;
+        const char *error = NULL;
         Stimulus *s = &exp->stimuli[exp->count];
-
-        char type_str[16];
-        if (sscanf(line, "%" SCNu64 ",%" SCNu64 ",%15[^,],%255[^,\n\r]", &s->timestamp_ms, &s->duration_ms, type_str, s->file_path) == 4) {
-            if (exp->count > 0 && s->timestamp_ms < last_timestamp) {
-                fprintf(stderr, "Error: Stimulus at line %d has a timestamp (%" PRIu64 ") smaller than the previous one (%" PRIu64 "). The CSV file must be sorted by the first column.\n", exp->count + 1, s->timestamp_ms, last_timestamp);
-                fclose(file);
-                free_experiment(exp);
-                return NULL;
+        CsvLine kind = parse_csv_line(line, len, exp->strings, s, &error);
+        if (kind == CSV_SKIP) continue;
+        if (kind == CSV_ERROR) {
+            if (!error) {
+                fprintf(stderr, "Out of memory reading '%s'\n", file_path);
+                errors++;
+                break;
             }
-            last_timestamp = s->timestamp_ms;
-
-            if (strcmp(type_str, "IMAGE") == 0) s->type = STIM_IMAGE;
-            else if (strcmp(type_str, "SOUND") == 0) s->type = STIM_SOUND;
-            else if (strcmp(type_str, "TEXT") == 0) s->type = STIM_TEXT;
-            else s->type = STIM_END;
-            exp->count++;
+            if (++errors <= MAX_REPORTED_ERRORS) fprintf(stderr, "Error: %s line %d: %s.\n", file_path, line_no, error);
+            continue;
+        }
+        if (error) fprintf(stderr, "Warning: %s line %d: %s, using the default.\n", file_path, line_no, error);
+        if (exp->count > 0 && s->timestamp_ms < last_timestamp) {
+            fprintf(stderr, "Error: %s line %d has a timestamp (%" PRIu64 ") smaller than the previous one (%" PRIu64 "). The CSV file must be sorted by the first column.\n", file_path, line_no, s->timestamp_ms, last_timestamp);
+            errors++;
+            break;
         }
+        last_timestamp = s->timestamp_ms;
+        exp->count++;
     }
+    unmap_file(mf);
 
-    fclose(file);
-    SDL_Log("parse_csv: read %d events from '%s'", exp->count, file_path);
+    if (errors > 0) {
+        if (errors > MAX_REPORTED_ERRORS) fprintf(stderr, "... %d more malformed lines\n", errors - MAX_REPORTED_ERRORS);
+        free_experiment(exp);
+        return NULL;
+    }
+    SDL_Log("parse_csv: read %d events from '%s' in %.1f ms", exp->count, file_path, (SDL_GetTicksNS() - t0) / 1e6);
     return exp;
 }
 
 void free_experiment(Experiment *exp) {
     if (exp) {
         if (exp->stimuli) free(exp->stimuli);
+        strtab_destroy(exp->strings);
+        unmap_file(exp->bundle);
         free(exp);
     }
 }
@@ -3,6 +3,20 @@
 
 #include "stimuli.h"
 
+typedef enum {
+    CSV_ROW,        /* A stimulus was parsed */
+    CSV_SKIP,       /* Blank line or comment */
+    CSV_ERROR       /* Malformed line (error set), or out of memory (error NULL) */
+} CsvLine;
+
+/**
+ * @brief Parses one schedule line, without its newline, into s.
+ *
+ * The content is interned in strings. For a row with a recoverable problem
+ * (an invalid colour), CSV_ROW is returned with *error set to a warning.
+ */
+CsvLine parse_csv_line(const char *line, size_t len, StringTable *strings, Stimulus *s, const char **error);
+
 Experiment* parse_csv(const char *file_path);
 void free_experiment(Experiment *exp);
 
@@ -8,15 +8,107 @@
  */
 
 #include "dlp.h"
+#include <SDL3/SDL.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* Command bytes of lines 1 to 8 */
+static const char set_cmd[8]   = {'1', '2', '3', '4', '5', '6', '7', '8'};
+static const char unset_cmd[8] = {'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I'};
+static const char read_cmd[8]  = {'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K'};
+
+/* Fills buf (at least 8 bytes) with the commands for the lines that change */
+static size_t encode_mask(char* buf, unsigned char old_mask, unsigned char new_mask) {
+    unsigned char off = old_mask & ~new_mask, on = new_mask & ~old_mask;
+    size_t n = 0;
+    for (int i = 0; i < 8; i++) if (off & (1u << i)) buf[n++] = unset_cmd[i];
+    for (int i = 0; i < 8; i++) if (on & (1u << i)) buf[n++] = set_cmd[i];
+    return n;
+}
+
+/* State of the lines once the first written bytes of encode_mask() are sent */
+static unsigned char mask_after(unsigned char old_mask, unsigned char new_mask, size_t written) {
+    unsigned char off = old_mask & ~new_mask, on = new_mask & ~old_mask, mask = old_mask;
+    size_t n = 0;
+    for (int i = 0; i < 8; i++) if ((off & (1u << i)) && n++ < written) mask &= (unsigned char)~(1u << i);
+    for (int i = 0; i < 8; i++) if ((on & (1u << i)) && n++ < written) mask |= (unsigned char)(1u << i);
+    return mask;
+}
+
+/* Fills buf (at least 8 bytes) with the read commands of the lines */
+static size_t encode_read(char* buf, unsigned char lines) {
+    size_t n = 0;
+    for (int i = 0; i < 8; i++) if (lines & (1u << i)) buf[n++] = read_cmd[i];
+    return n;
+}
+
+/* Turns the binary answers, in line order, into a mask */
+static unsigned char decode_levels(const unsigned char* answers, unsigned char lines) {
+    unsigned char levels = 0;
+    size_t k = 0;
+    for (int i = 0; i < 8; i++) {
+        if (!(lines & (1u << i))) continue;
+        if (answers[k++]) levels |= (unsigned char)(1u << i);
+    }
+    return levels;
+}
+
+/* Turns a string of line numbers ("123") into a mask */
+static unsigned char lines_mask(const char* lines) {
+    unsigned char mask = 0;
+    for (; *lines; lines++) if (*lines >= '1' && *lines <= '8') mask |= (unsigned char)(1u << (*lines - '1'));
+    return mask;
+}
+
+/* Null backend, for testing without a device: each change of the output
+   lines is appended to a file as "time_ms,lines" (lines is the mask), and
+   every input reads low. Times are on the clock of the results, from the
+   origin given by dlp_set_origin() (until then, from the opening). */
+
+static dlp_io8g_t* file_new(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror("Error opening the trigger file");
+        return NULL;
+    }
+    dlp_io8g_t* dlp = (dlp_io8g_t*)calloc(1, sizeof(dlp_io8g_t));
+    if (!dlp) {
+        fclose(f);
+        return NULL;
+    }
+    dlp->fd = -1;
+    dlp->file = f;
+    dlp->file_origin_ns = SDL_GetTicksNS();
+    fprintf(f, "time_ms,lines\n");
+    return dlp;
+}
+
+static bool file_write(dlp_io8g_t* dlp, unsigned char mask) {
+    if (mask == dlp->file_state) return true;
+    dlp->file_state = mask;
+    double ms = (double)(Sint64)(SDL_GetTicksNS() - dlp->file_origin_ns) / 1e6;
+    return fprintf(dlp->file, "%.3f,%u\n", ms, mask) > 0;
+}
+
+void dlp_set_origin(dlp_io8g_t* dlp, uint64_t origin_ms) {
+    if (dlp && dlp->file) dlp->file_origin_ns = SDL_MS_TO_NS(origin_ms);
+}
+
+static void file_close(dlp_io8g_t* dlp) {
+    fclose(dlp->file);
+    free(dlp);
+}
+
 #ifndef _WIN32
 #include <unistd.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <errno.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
 
 static speed_t get_baudrate(int baudrate) {
     switch (baudrate) {
@@ -30,7 +122,9 @@ static speed_t get_baudrate(int baudrate) {
 }
 
 dlp_io8g_t* dlp_new(const char* device, int baudrate) {
-    int fd = open(device, O_RDWR | O_NOCTTY | O_SYNC);
+    if (strncmp(device, DLP_FILE_PREFIX, strlen(DLP_FILE_PREFIX)) == 0) return file_new(device + strlen(DLP_FILE_PREFIX));
+    /* No O_SYNC: it does not wait for the bytes to be sent on a tty anyway; see dlp_drain() */
+    int fd = open(device, O_RDWR | O_NOCTTY);
     if (fd < 0) {
         perror("Error opening serial port");
         return NULL;
@@ -75,6 +169,17 @@ dlp_io8g_t* dlp_new(const char* device, int baudrate) {
         return NULL;
     }
     dlp->fd = fd;
+    dlp->low_latency = false;
+    dlp->file = NULL;
+
+#ifdef __linux__
+    /* Ask the driver (e.g. ftdi_sio) to pass bytes on at once rather than on its latency timer */
+    struct serial_struct serial;
+    if (ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        dlp->low_latency = ioctl(fd, TIOCSSERIAL, &serial) == 0;
+    }
+#endif
 
     // Ping to check the device (sending 0x27 is ')
     unsigned char ping_cmd = 0x27;
@@ -104,6 +209,7 @@ dlp_io8g_t* dlp_new(const char* device, int baudrate) {
 }
 
 void dlp_close(dlp_io8g_t* dlp) {
+    if (dlp && dlp->file) { file_close(dlp); return; }
     if (dlp) {
         if (dlp->fd >= 0) {
             close(dlp->fd);
@@ -113,6 +219,7 @@ void dlp_close(dlp_io8g_t* dlp) {
 }
 
 bool dlp_ping(dlp_io8g_t* dlp) {
+    if (dlp && dlp->file) return true;
     unsigned char ping_cmd = 0x27;
     if (write(dlp->fd, &ping_cmd, 1) != 1) return false;
 
@@ -122,6 +229,7 @@ bool dlp_ping(dlp_io8g_t* dlp) {
 }
 
 size_t dlp_read(dlp_io8g_t* dlp, unsigned char* states) {
+    if (dlp && dlp->file) { memset(states, 0, 8); return 8; }
     const char* cmds = "ASDFGHJK";
     
     // Clear buffers
@@ -140,13 +248,14 @@ size_t dlp_read(dlp_io8g_t* dlp, unsigned char* states) {
 }
 
 void dlp_set(dlp_io8g_t* dlp, const char* lines) {
-    tcflush(dlp->fd, TCOFLUSH);
+    if (dlp && dlp->file) { file_write(dlp, dlp->file_state | lines_mask(lines)); return; }
     if (write(dlp->fd, lines, strlen(lines)) < 0) {
         perror("write error in dlp_set");
     }
 }
 
 void dlp_unset(dlp_io8g_t* dlp, const char* lines) {
+    if (dlp && dlp->file) { file_write(dlp, dlp->file_state & (unsigned char)~lines_mask(lines)); return; }
     char* cmd = strdup(lines);
     if (!cmd) return;
 
@@ -163,13 +272,55 @@ void dlp_unset(dlp_io8g_t* dlp, const char* lines) {
         }
     }
 
-    tcflush(dlp->fd, TCOFLUSH);
     if (write(dlp->fd, cmd, strlen(cmd)) < 0) {
         perror("write error in dlp_unset");
     }
     free(cmd);
 }
 
+bool dlp_write_mask(dlp_io8g_t* dlp, unsigned char old_mask, unsigned char new_mask, unsigned char* state) {
+    if (state) *state = old_mask;
+    if (!dlp) return false;
+    if (dlp->file) {
+        bool ok = file_write(dlp, new_mask);
+        if (state) *state = dlp->file_state;
+        return ok;
+    }
+    char buf[8];
+    size_t n = encode_mask(buf, old_mask, new_mask);
+    ssize_t written = n > 0 ? write(dlp->fd, buf, n) : 0;
+    if (state) *state = mask_after(old_mask, new_mask, written > 0 ? (size_t)written : 0);
+    if (written != (ssize_t)n) {
+        perror("write error in dlp_write_mask");
+        return false;
+    }
+    return true;
+}
+
+bool dlp_read_mask(dlp_io8g_t* dlp, unsigned char lines, unsigned char* levels) {
+    if (dlp && dlp->file) { *levels = 0; return true; }
+    char cmd[8];
+    unsigned char answers[8];
+    size_t n = encode_read(cmd, lines), got = 0;
+    if (n == 0) { *levels = 0; return true; }
+    if (write(dlp->fd, cmd, n) != (ssize_t)n) return false;
+    while (got < n) {
+        ssize_t r = read(dlp->fd, answers + got, n - got);
+        if (r <= 0) {
+            tcflush(dlp->fd, TCIFLUSH);     /* Drop a partial answer, so the next one is not shifted */
+            return false;
+        }
+        got += (size_t)r;
+    }
+    *levels = decode_levels(answers, lines);
+    return true;
+}
+
+bool dlp_drain(dlp_io8g_t* dlp) {
+    if (dlp && dlp->file) return fflush(dlp->file) == 0;
+    return tcdrain(dlp->fd) == 0;
+}
+
 #else
 /* Windows implementation */
 #include <windows.h>
@@ -180,6 +331,7 @@ typedef struct {
 } dlp_io8g_win_t;
 
 dlp_io8g_t* dlp_new(const char* device, int baudrate) {
+    if (strncmp(device, DLP_FILE_PREFIX, strlen(DLP_FILE_PREFIX)) == 0) return file_new(device + strlen(DLP_FILE_PREFIX));
     char full_device[64];
     // COM ports higher than 9 need the \\.\ prefix
     if (strncmp(device, "COM", 3) == 0) {
@@ -243,6 +395,8 @@ dlp_io8g_t* dlp_new(const char* device, int baudrate) {
        This is hacky but avoids changing dlp_io8g_t in dlp.h which 
        would require more refactoring. */
     dlp->fd = (intptr_t)hSerial;
+    dlp->low_latency = false;
+    dlp->file = NULL;
 
     // Ping
     unsigned char ping_cmd = 0x27;
@@ -269,6 +423,7 @@ dlp_io8g_t* dlp_new(const char* device, int baudrate) {
 }
 
 void dlp_close(dlp_io8g_t* dlp) {
+    if (dlp && dlp->file) { file_close(dlp); return; }
     if (dlp) {
         CloseHandle((HANDLE)(intptr_t)dlp->fd);
         free(dlp);
@@ -276,6 +431,7 @@ void dlp_close(dlp_io8g_t* dlp) {
 }
 
 bool dlp_ping(dlp_io8g_t* dlp) {
+    if (dlp && dlp->file) return true;
     if (!dlp) return false;
     unsigned char ping_cmd = 0x27;
     DWORD written, read_bytes;
@@ -287,6 +443,7 @@ bool dlp_ping(dlp_io8g_t* dlp) {
 }
 
 size_t dlp_read(dlp_io8g_t* dlp, unsigned char* states) {
+    if (dlp && dlp->file) { memset(states, 0, 8); return 8; }
     if (!dlp) return 0;
     const char* cmds = "ASDFGHJK";
     HANDLE h = (HANDLE)(intptr_t)dlp->fd;
@@ -305,6 +462,7 @@ size_t dlp_read(dlp_io8g_t* dlp, unsigned char* states) {
 }
 
 void dlp_set(dlp_io8g_t* dlp, const char* lines) {
+    if (dlp && dlp->file) { file_write(dlp, dlp->file_state | lines_mask(lines)); return; }
     if (!dlp) return;
     HANDLE h = (HANDLE)(intptr_t)dlp->fd;
     DWORD written;
@@ -312,6 +470,7 @@ void dlp_set(dlp_io8g_t* dlp, const char* lines) {
 }
 
 void dlp_unset(dlp_io8g_t* dlp, const char* lines) {
+    if (dlp && dlp->file) { file_write(dlp, dlp->file_state & (unsigned char)~lines_mask(lines)); return; }
     if (!dlp) return;
     HANDLE h = (HANDLE)(intptr_t)dlp->fd;
     char* cmd = _strdup(lines);
@@ -334,4 +493,47 @@ void dlp_unset(dlp_io8g_t* dlp, const char* lines) {
     free(cmd);
 }
 
+bool dlp_write_mask(dlp_io8g_t* dlp, unsigned char old_mask, unsigned char new_mask, unsigned char* state) {
+    if (state) *state = old_mask;
+    if (!dlp) return false;
+    if (dlp->file) {
+        bool ok = file_write(dlp, new_mask);
+        if (state) *state = dlp->file_state;
+        return ok;
+    }
+    char buf[8];
+    DWORD n = (DWORD)encode_mask(buf, old_mask, new_mask), written = 0;
+    if (n == 0) { if (state) *state = new_mask; return true; }
+    bool ok = WriteFile((HANDLE)(intptr_t)dlp->fd, buf, n, &written, NULL) && written == n;
+    if (state) *state = mask_after(old_mask, new_mask, written);
+    return ok;
+}
+
+bool dlp_read_mask(dlp_io8g_t* dlp, unsigned char lines, unsigned char* levels) {
+    if (dlp && dlp->file) { *levels = 0; return true; }
+    if (!dlp) return false;
+    HANDLE h = (HANDLE)(intptr_t)dlp->fd;
+    char cmd[8];
+    unsigned char answers[8];
+    DWORD n = (DWORD)encode_read(cmd, lines), written = 0, got = 0;
+    if (n == 0) { *levels = 0; return true; }
+    if (!WriteFile(h, cmd, n, &written, NULL) || written != n) return false;
+    while (got < n) {
+        DWORD r;
+        if (!ReadFile(h, answers + got, n - got, &r, NULL) || r == 0) {
+            PurgeComm(h, PURGE_RXCLEAR);
+            return false;
+        }
+        got += r;
+    }
+    *levels = decode_levels(answers, lines);
+    return true;
+}
+
+bool dlp_drain(dlp_io8g_t* dlp) {
+    if (dlp && dlp->file) return fflush(dlp->file) == 0;
+    if (!dlp) return false;
+    return FlushFileBuffers((HANDLE)(intptr_t)dlp->fd) != 0;
+}
+
 #endif
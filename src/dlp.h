@@ -12,15 +12,24 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Device name of the null backend: "file:triggers.csv" logs the line changes to triggers.csv */
+#define DLP_FILE_PREFIX "file:"
 
 typedef struct {
     int fd;
+    bool low_latency;   /* The serial driver accepted the low-latency mode */
+    FILE* file;         /* Null backend: output log, NULL for a device */
+    uint64_t file_origin_ns;    /* Null backend: SDL_GetTicksNS() time of the line change times */
+    unsigned char file_state;
 } dlp_io8g_t;
 
 /**
  * @brief Initialize and open the DLP-IO8-G device.
  * 
- * @param device The device path (e.g., "/dev/ttyUSB0").
+ * @param device The device path (e.g., "/dev/ttyUSB0"), or DLP_FILE_PREFIX and a file path.
  * @param baudrate The baud rate (e.g., 9600).
  * @return dlp_io8g_t* Pointer to the initialized structure, or NULL on error.
  */
@@ -33,6 +42,14 @@ dlp_io8g_t* dlp_new(const char* device, int baudrate);
  */
 void dlp_close(dlp_io8g_t* dlp);
 
+/**
+ * @brief Null backend: times the line changes from origin_ms, the SDL_GetTicks() time the run started. No effect on a device.
+ *
+ * @param dlp Pointer to the device structure, or NULL.
+ * @param origin_ms Origin of the times written to the file.
+ */
+void dlp_set_origin(dlp_io8g_t* dlp, uint64_t origin_ms);
+
 /**
  * @brief Ping the device to check if it's responsive.
  * 
@@ -66,4 +83,41 @@ void dlp_set(dlp_io8g_t* dlp, const char* lines);
  */
 void dlp_unset(dlp_io8g_t* dlp, const char* lines);
 
+/**
+ * @brief Drives the lines from one state to another in a single write.
+ *
+ * Bit i of a mask is line i+1. Only the lines that change are sent, unset
+ * commands first; nothing is allocated and the output queue is not flushed.
+ *
+ * @param dlp Pointer to the device structure.
+ * @param old_mask Current state of the lines.
+ * @param new_mask Wanted state of the lines.
+ * @param state Receives the state of the lines after the write: new_mask, or what a short write left. May be NULL.
+ * @return true if the whole command was written (or nothing had to be).
+ */
+bool dlp_write_mask(dlp_io8g_t* dlp, unsigned char old_mask, unsigned char new_mask, unsigned char* state);
+
+/**
+ * @brief Reads some of the lines, in binary mode, with one write and without flushing.
+ *
+ * Reading a line makes it an input on the device: do not pass output lines.
+ * Unlike dlp_read(), it can run while another thread sends output commands.
+ *
+ * @param dlp Pointer to the device structure.
+ * @param lines Mask of the lines to read (bit i is line i+1).
+ * @param levels Receives the mask of the lines read high.
+ * @return true if every line answered.
+ */
+bool dlp_read_mask(dlp_io8g_t* dlp, unsigned char lines, unsigned char* levels);
+
+/**
+ * @brief Blocks until everything written so far has left the serial port.
+ *
+ * Can run on another thread while commands are being written.
+ *
+ * @param dlp Pointer to the device structure.
+ * @return true on success.
+ */
+bool dlp_drain(dlp_io8g_t* dlp);
+
 #endif // DLP_H
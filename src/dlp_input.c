@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "dlp_input.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_LINES          8
+#define POLL_RETRY_MS      10       /* Pause after a query the device did not answer */
+#define POLL_MIN_PERIOD_NS SDL_NS_PER_MS    /* Fast ports and ptys answer at once: do not saturate the link */
+#define QUERY_BYTE_NS      1041667  /* 10 bits at 9600 baud */
+#define TRIGGER_WAIT_NS    (SDL_NS_PER_MS / 4)
+
+struct DlpInput {
+    dlp_io8g_t *dlp;
+    TriggerOutput *triggers;
+    Uint8 lines;
+    EventQueue *events;
+    Uint64 origin_ms;
+    StrId ev_input;
+    StrId labels[NUM_LINES][2];     /* "<line>:0" and "<line>:1" */
+    SDL_Thread *thread;
+    SDL_AtomicInt quit;
+    int samples;                    /* Thread only until it is joined */
+    int failures;
+    int deferred;                   /* Queries put off for a trigger */
+    Uint64 first_ns, last_ns;
+};
+
+static int SDLCALL poll_thread(void *data) {
+    DlpInput *in = (DlpInput *)data;
+    SDL_SetCurrentThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    Uint8 state = 0;
+    Uint64 query_ns = 0;
+    for (int i = 0; i < NUM_LINES; i++) if (in->lines & (1u << i)) query_ns += QUERY_BYTE_NS;
+    bool waiting = false;
+    while (!SDL_GetAtomicInt(&in->quit)) {
+        /* A query still going out when a trigger is written would delay it */
+        if (trigger_output_busy(in->triggers, query_ns)) {
+            if (!waiting) in->deferred++;
+            waiting = true;
+            SDL_DelayPrecise(TRIGGER_WAIT_NS);
+            continue;
+        }
+        waiting = false;
+        Uint64 start_ns = SDL_GetTicksNS();
+        Uint8 levels;
+        if (!dlp_read_mask(in->dlp, in->lines, &levels)) {
+            in->failures++;
+            SDL_Delay(POLL_RETRY_MS);
+            continue;
+        }
+        /* The device sampled the lines somewhere during the round trip */
+        Uint64 t_ns = start_ns + (SDL_GetTicksNS() - start_ns) / 2;
+        Uint8 changed = in->samples > 0 ? (Uint8)(levels ^ state) : 0;  /* The first sample is the baseline */
+        if (changed && in->events) {
+            Uint64 ticks_ms = t_ns / SDL_NS_PER_MS;
+            Uint64 t_ms = ticks_ms > in->origin_ms ? ticks_ms - in->origin_ms : 0;
+            for (int i = 0; i < NUM_LINES; i++) {
+                if (changed & (1u << i)) event_queue_push(in->events, t_ms, ticks_ms, in->ev_input, in->labels[i][(levels >> i) & 1]);
+            }
+        }
+        state = levels;
+        if (in->samples++ == 0) in->first_ns = t_ns;
+        in->last_ns = t_ns;
+        /* Idle at least as long as the query took: the link stays free half of the time */
+        Uint64 elapsed = SDL_GetTicksNS() - start_ns;
+        SDL_DelayPrecise(elapsed > POLL_MIN_PERIOD_NS ? elapsed : POLL_MIN_PERIOD_NS);
+    }
+    return 0;
+}
+
+DlpInput *dlp_input_start(dlp_io8g_t *dlp, Uint8 lines, EventQueue *events, StringTable *strings, Uint64 origin_ms,
+                          TriggerOutput *triggers) {
+    DlpInput *in = calloc(1, sizeof(DlpInput));
+    if (!in) return NULL;
+    in->dlp = dlp;
+    in->triggers = triggers;
+    in->lines = lines;
+    in->events = events;
+    in->origin_ms = origin_ms;
+    /* Interned here: the poller thread cannot take the string table lock */
+    in->ev_input = strtab_intern(strings, "DLP_INPUT");
+    for (int i = 0; i < NUM_LINES; i++) {
+        char label[8];
+        for (int level = 0; level < 2; level++) {
+            snprintf(label, sizeof(label), "%d:%d", i + 1, level);
+            in->labels[i][level] = strtab_intern(strings, label);
+        }
+    }
+    in->thread = SDL_CreateThread(poll_thread, "expe3000-dlp-input", in);
+    if (!in->thread) {
+        SDL_Log("Error: cannot start the DLP input poller: %s", SDL_GetError());
+        free(in);
+        return NULL;
+    }
+    return in;
+}
+
+void dlp_input_stop(DlpInput *in) {
+    if (!in) return;
+    SDL_SetAtomicInt(&in->quit, 1);
+    SDL_WaitThread(in->thread, NULL);
+    if (in->samples > 1)
+        SDL_Log("DLP inputs sampled %d times, every %.2f ms on average", in->samples,
+                (double)(in->last_ns - in->first_ns) / SDL_NS_PER_MS / (in->samples - 1));
+    if (in->deferred > 0) SDL_Log("DLP input queries put off %d times for a trigger", in->deferred);
+    if (in->failures > 0) SDL_Log("Warning: the DLP did not answer %d input queries", in->failures);
+    free(in);
+}
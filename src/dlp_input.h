@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef DLP_INPUT_H
+#define DLP_INPUT_H
+
+#include <SDL3/SDL.h>
+#include "dlp.h"
+#include "event_queue.h"
+#include "trigger_output.h"
+
+/*
+ * DLP-IO8-G input poller.
+ *
+ * A background thread reads the input lines over and over (button boxes,
+ * scanner pulses) and pushes a DLP_INPUT event for each change of a line,
+ * labelled "<line>:1" for a rising edge and "<line>:0" for a falling one.
+ * An edge is timestamped at the middle of the query that first saw it, so
+ * its uncertainty is half the query round trip (a few ms at 9600 baud).
+ *
+ * The queries share the 9600-baud link with the triggers, and a trigger
+ * written during a query waits for the query bytes to go out. The poller
+ * leaves the link idle at least as long as each query took, and skips the
+ * queries that would still be on the wire when a trigger is due, so only
+ * triggers sent "now" can be delayed, by one query at most (about 1 ms per
+ * polled line).
+ */
+
+typedef struct DlpInput DlpInput;
+
+/**
+ * @brief Starts polling some lines of an open device (bit i of lines is line i+1).
+ *
+ * The lines must not be used for output. Events are timed relative to
+ * origin_ms (SDL_GetTicks() at the start of the run). triggers, the output
+ * on the same device, may be NULL.
+ */
+DlpInput *dlp_input_start(dlp_io8g_t *dlp, Uint8 lines, EventQueue *events, StringTable *strings, Uint64 origin_ms,
+                          TriggerOutput *triggers);
+
+/**
+ * @brief Stops the poller and logs how often the lines were sampled.
+ */
+void dlp_input_stop(DlpInput *in);
+
+#endif // DLP_INPUT_H
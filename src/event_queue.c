@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "event_queue.h"
+#include <stdlib.h>
+
+/* Each cell carries a sequence number: it equals the cell's position when
+   the cell is free for that position, and position + 1 once it is filled.
+   Producers claim a position with a compare-and-swap on head, fill the
+   cell, then publish it by bumping its sequence. */
+typedef struct {
+    SDL_AtomicU32 seq;
+    QueuedEvent   ev;
+} Cell;
+
+struct EventQueue {
+    Cell         *cells;
+    Uint32        mask;
+    SDL_AtomicU32 head;         /* Next position to claim (producers) */
+    Uint32        tail;         /* Next position to read (consumer) */
+    SDL_AtomicInt dropped;
+};
+
+EventQueue *event_queue_create(int capacity) {
+    EventQueue *q = calloc(1, sizeof(EventQueue));
+    if (!q) return NULL;
+    Uint32 size = 2;
+    while ((int)size < capacity) size *= 2;
+    q->cells = calloc(size, sizeof(Cell));
+    if (!q->cells) { free(q); return NULL; }
+    q->mask = size - 1;
+    for (Uint32 i = 0; i < size; i++) SDL_SetAtomicU32(&q->cells[i].seq, i);
+    return q;
+}
+
+void event_queue_destroy(EventQueue *q) {
+    if (!q) return;
+    free(q->cells);
+    free(q);
+}
+
+bool event_queue_push(EventQueue *q, Uint64 intended_ms, Uint64 ticks_ms, StrId type, StrId label) {
+    Uint32 pos = SDL_GetAtomicU32(&q->head);
+    Cell *c;
+    for (;;) {
+        c = &q->cells[pos & q->mask];
+        Sint32 diff = (Sint32)(SDL_GetAtomicU32(&c->seq) - pos);
+        if (diff == 0) {
+            if (SDL_CompareAndSwapAtomicU32(&q->head, pos, pos + 1)) break;
+        } else if (diff < 0) {
+            SDL_AddAtomicInt(&q->dropped, 1);   /* Full: the consumer is a whole lap behind */
+            return false;
+        }
+        pos = SDL_GetAtomicU32(&q->head);
+    }
+    c->ev.intended_ms = intended_ms;
+    c->ev.ticks_ms = ticks_ms;
+    c->ev.type = type;
+    c->ev.label = label;
+    SDL_SetAtomicU32(&c->seq, pos + 1);
+    return true;
+}
+
+bool event_queue_pop(EventQueue *q, QueuedEvent *ev) {
+    Cell *c = &q->cells[q->tail & q->mask];
+    if ((Sint32)(SDL_GetAtomicU32(&c->seq) - (q->tail + 1)) < 0) return false;
+    *ev = c->ev;
+    SDL_SetAtomicU32(&c->seq, q->tail + q->mask + 1);
+    q->tail++;
+    return true;
+}
+
+int event_queue_dropped(EventQueue *q) {
+    return SDL_GetAtomicInt(&q->dropped);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <SDL3/SDL.h>
+#include "strtab.h"
+
+/*
+ * Bounded lock-free multi-producer, single-consumer event queue.
+ *
+ * Any thread (the audio callback, trigger or input threads) can push an
+ * event without blocking; when the queue is full the event is dropped and
+ * counted. Only one thread may pop. Event names and labels must be
+ * interned beforehand, since interning takes a lock.
+ */
+
+typedef struct {
+    Uint64 intended_ms;
+    Uint64 ticks_ms;        /* SDL_GetTicks() when the event happened */
+    StrId  type;
+    StrId  label;
+} QueuedEvent;
+
+typedef struct EventQueue EventQueue;
+
+/**
+ * @brief Creates a queue holding at least capacity events (rounded up to a power of two).
+ */
+EventQueue *event_queue_create(int capacity);
+
+void event_queue_destroy(EventQueue *q);
+
+/**
+ * @brief Pushes an event. Lock-free, callable from any thread.
+ *
+ * @return false if the queue was full and the event was dropped.
+ */
+bool event_queue_push(EventQueue *q, Uint64 intended_ms, Uint64 ticks_ms, StrId type, StrId label);
+
+/**
+ * @brief Pops the oldest event. Consumer thread only.
+ *
+ * @return false if the queue is empty.
+ */
+bool event_queue_pop(EventQueue *q, QueuedEvent *ev);
+
+/**
+ * @brief Returns the number of events dropped because the queue was full.
+ */
+int event_queue_dropped(EventQueue *q);
+
+#endif // EVENT_QUEUE_H
@@ -8,33 +8,122 @@
  */
 
 #include "experiment.h"
+#include "trigger_output.h"
+#include "progress_monitor.h"
+#include "dlp_input.h"
+#include "control_socket.h"
 #include <SDL3_image/SDL_image.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #define CROSS_SIZE 20
+#define STREAM_UPLOADS_PER_FRAME 4      /* Bounds the upload time after each present */
+#define STREAM_UPLOAD_SHARE 4           /* ... as does spending at most 1/4 of a frame on it */
+#define STREAM_PREFILL_ROWS 16
+#define EXPECTED_RESPONSES_PER_S 2      /* Key presses budgeted per second of schedule */
+#define EVENT_LOG_SLACK 1024
+#define TRIGGER_EVENTS 4                /* TRIGGER_ISSUED and TRIGGER_WRITTEN, at onset and at release */
+#define STREAM_LOG_EVENTS 65536         /* Ring of the events not written yet, when the length is unknown */
+#define EVENT_QUEUE_SIZE 4096
+#define EVENT_COMMIT_DELAY_MS 1000      /* Queued events later than this may be logged slightly out of order */
+#define TRIGGER_OUTPUT_LINES (TRIGGER_LINE(1) | TRIGGER_LINE(2) | TRIGGER_LINE(3))
 
-bool log_event(EventLog *log, Uint64 intended_ms, Uint64 actual_ms, const char *type, const char *label) {
-    if (log->count >= log->capacity) {
-        int new_cap = log->capacity == 0 ? 64 : log->capacity * 2;
-        EventLogEntry *tmp = realloc(log->entries, new_cap * sizeof(EventLogEntry));
-        if (!tmp) return false;
-        log->entries  = tmp;
-        log->capacity = new_cap;
+int event_log_estimate(const Experiment *exp, const Config *cfg) {
+    /* Streaming: the results writer drains the ring well within a second */
+    if (!exp) return STREAM_LOG_EVENTS;
+    Uint64 span_ms = cfg->total_duration;
+    Uint64 events = 2 * (Uint64)exp->count;
+    if (cfg->dlp_device) {
+        /* With --trigger-drain, each write is also logged once it has left the port */
+        Uint8 output_lines = TRIGGER_OUTPUT_LINES & (Uint8)~cfg->dlp_inputs;
+        int per_trigger = cfg->trigger_drain ? TRIGGER_EVENTS + 2 : TRIGGER_EVENTS;
+        for (int i = 0; i < exp->count; i++) {
+            if (exp->stimuli[i].trigger_lines & output_lines) events += per_trigger;
+        }
+    }
+    if (exp->count > 0) {
+        const Stimulus *last = &exp->stimuli[exp->count - 1];
+        if (last->timestamp_ms + last->duration_ms > span_ms) span_ms = last->timestamp_ms + last->duration_ms;
+    }
+    events += span_ms / 1000 * EXPECTED_RESPONSES_PER_S + EVENT_LOG_SLACK;
+    return events > INT_MAX / 2 ? INT_MAX / 2 : (int)events;
+}
+
+bool event_log_init(EventLog *log, int capacity) {
+    log->entries = malloc((size_t)capacity * sizeof(EventLogEntry));
+    log->queue = event_queue_create(EVENT_QUEUE_SIZE);
+    log->lock = SDL_CreateMutex();
+    if (!log->entries || !log->queue || !log->lock) {
+        free_event_log(log);
+        return false;
     }
-    EventLogEntry *e = &log->entries[log->count];
+    log->capacity = capacity;
+    log->count = 0;
+    log->committed = 0;
+    SDL_SetAtomicInt(&log->published, 0);
+    SDL_SetAtomicInt(&log->written, 0);
+    return true;
+}
+
+/* Last resort when the results writer fell behind: this allocates in the loop */
+static bool grow_event_log(EventLog *log) {
+    int new_cap = log->capacity == 0 ? 64 : log->capacity * 2;
+    EventLogEntry *tmp = malloc((size_t)new_cap * sizeof(EventLogEntry));
+    if (!tmp) return false;
+    SDL_LockMutex(log->lock);
+    for (int i = SDL_GetAtomicInt(&log->written); i < log->count; i++) tmp[i % new_cap] = log->entries[i % log->capacity];
+    free(log->entries);
+    log->entries = tmp;
+    SDL_UnlockMutex(log->lock);
+    if (log->capacity > 0) SDL_Log("Warning: the event log is full (%d events not written yet), growing it during the run", log->capacity);
+    log->capacity = new_cap;
+    return true;
+}
+
+static bool event_log_full(EventLog *log) {
+    return log->count - SDL_GetAtomicInt(&log->written) >= log->capacity;
+}
+
+bool log_event(EventLog *log, Uint64 intended_ms, Uint64 actual_ms, StrId type, StrId label) {
+    if (event_log_full(log) && !grow_event_log(log)) return false;
+    EventLogEntry *e = event_log_entry(log, log->count);
     e->intended_ms = intended_ms;
     e->timestamp_ms = actual_ms;
-    strncpy(e->type,  type,  sizeof(e->type)  - 1); e->type[sizeof(e->type)   - 1] = '\0';
-    strncpy(e->label, label, sizeof(e->label) - 1); e->label[sizeof(e->label) - 1] = '\0';
+    e->type = type;
+    e->label = label;
     log->count++;
     return true;
 }
 
+void event_log_collect(EventLog *log) {
+    if (!log->queue) return;
+    QueuedEvent ev;
+    while (event_queue_pop(log->queue, &ev)) {
+        if (event_log_full(log) && !grow_event_log(log)) return;
+        Uint64 t = ev.ticks_ms > log->origin_ms ? ev.ticks_ms - log->origin_ms : 0;
+        /* Queued events are at most a frame late: insert from the end, after the committed ones */
+        int i = log->count;
+        while (i > log->committed && event_log_entry(log, i - 1)->timestamp_ms > t) {
+            *event_log_entry(log, i) = *event_log_entry(log, i - 1);
+            i--;
+        }
+        *event_log_entry(log, i) = (EventLogEntry){ ev.intended_ms, t, ev.type, ev.label };
+        log->count++;
+    }
+}
+
+void event_log_commit(EventLog *log, Uint64 now_ms) {
+    while (log->committed < log->count && event_log_entry(log, log->committed)->timestamp_ms + EVENT_COMMIT_DELAY_MS <= now_ms) log->committed++;
+    SDL_SetAtomicInt(&log->published, log->committed);
+}
+
 void free_event_log(EventLog *log) {
     if (log->entries) free(log->entries);
-    log->entries = NULL; log->count = 0; log->capacity = 0;
+    event_queue_destroy(log->queue);
+    if (log->lock) SDL_DestroyMutex(log->lock);
+    log->entries = NULL; log->count = 0; log->capacity = 0; log->queue = NULL; log->lock = NULL;
 }
 
 static void draw_fixation_cross(SDL_Renderer *renderer, int w, int h, SDL_Color color) {
@@ -44,6 +133,14 @@ static void draw_fixation_cross(SDL_Renderer *renderer, int w, int h, SDL_Color
     SDL_RenderLine(renderer, mx, my - CROSS_SIZE, mx, my + CROSS_SIZE);
 }
 
+/* Corner square seen by a photodiode taped to the screen */
+static SDL_FRect photodiode_rect(const Config *cfg) {
+    float side = (float)cfg->photodiode_size;
+    bool right = cfg->photodiode == PHOTODIODE_TOP_RIGHT || cfg->photodiode == PHOTODIODE_BOTTOM_RIGHT;
+    bool bottom = cfg->photodiode == PHOTODIODE_BOTTOM_LEFT || cfg->photodiode == PHOTODIODE_BOTTOM_RIGHT;
+    return (SDL_FRect){ right ? cfg->screen_w - side : 0.0f, bottom ? cfg->screen_h - side : 0.0f, side, side };
+}
+
 bool display_splash(SDL_Renderer *renderer, const char *file_path, int screen_w, int screen_h, float scale_factor, SDL_Color bg_color) {
     if (!file_path) return true;
     SDL_Texture *tex = IMG_LoadTexture(renderer, file_path);
@@ -64,19 +161,123 @@ bool display_splash(SDL_Renderer *renderer, const char *file_path, int screen_w,
     return !quit;
 }
 
+/* Draws one frame of the loading screen; false if the user quit */
+static bool show_progress(SDL_Renderer *renderer, float progress, int screen_w, int screen_h, SDL_Color bg_color, SDL_Color fg_color) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_EVENT_QUIT) return false;
+        if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_ESCAPE) return false;
+    }
+    float bar_w = screen_w / 3.0f, bar_h = 12.0f;
+    SDL_FRect frame = {(screen_w - bar_w) / 2.0f, (screen_h - bar_h) / 2.0f, bar_w, bar_h};
+    SDL_FRect fill = {frame.x, frame.y, bar_w * progress, bar_h};
+    char label[32]; snprintf(label, sizeof(label), "Loading... %d%%", (int)(progress * 100.0f));
+
+    SDL_SetRenderDrawColor(renderer, bg_color.r, bg_color.g, bg_color.b, bg_color.a);
+    SDL_RenderClear(renderer);
+    SDL_SetRenderDrawColor(renderer, fg_color.r, fg_color.g, fg_color.b, fg_color.a);
+    SDL_RenderRect(renderer, &frame);
+    SDL_RenderFillRect(renderer, &fill);
+    SDL_RenderDebugText(renderer, frame.x, frame.y - 16.0f, label);
+    SDL_RenderPresent(renderer);
+    SDL_Delay(15);
+    return true;
+}
+
+bool display_loading_progress(SDL_Renderer *renderer, ResourceLoader *loader, int screen_w, int screen_h, SDL_Color bg_color, SDL_Color fg_color) {
+    while (!resource_loader_done(loader)) {
+        if (!show_progress(renderer, resource_loader_progress(loader), screen_w, screen_h, bg_color, fg_color)) return false;
+    }
+    return true;
+}
+
+bool display_stream_prefill(SDL_Renderer *renderer, ScheduleStream *stream, TextEngine *te, int screen_w, int screen_h, SDL_Color bg_color, SDL_Color fg_color) {
+    while (stream_fill(stream) < 1.0f && !stream_finished(stream)) {
+        stream_upload(stream, renderer, te, STREAM_PREFILL_ROWS, 0);
+        if (!show_progress(renderer, stream_fill(stream), screen_w, screen_h, bg_color, fg_color)) return false;
+    }
+    return true;
+}
+
+/* Rows come from the loaded experiment or, when streaming, from the ring */
+static const Stimulus *row_stimulus(const Experiment *exp, const ScheduleStream *stream, int row) {
+    return stream ? stream_stimulus(stream, row) : &exp->stimuli[row];
+}
+
+static Resource *row_resource(Resource *resources, ScheduleStream *stream, int row) {
+    return stream ? stream_resource(stream, row) : &resources[row];
+}
+
+/* Onset trigger of a row: a pulse, or lines held until the offset (at_ticks 0: now) */
+static void send_onset_trigger(TriggerOutput *to, const Stimulus *s, Uint8 lines, Uint64 at_ticks, Uint64 intended_ms) {
+    if (!lines) return;
+    if (s->trigger_width_ms) trigger_pulse_at(to, lines, s->trigger_width_ms, at_ticks, intended_ms, s->content);
+    else trigger_set_at(to, lines, at_ticks, intended_ms, s->content);
+}
+
 bool run_experiment(Config *cfg, Experiment *exp, Resource *resources, 
                     SDL_Renderer *rend, AudioMixer *mx, EventLog *log, 
-                    dlp_io8g_t *dlp, SDL_AudioStream *ms, TTF_Font *fnt) {
-    (void)fnt;
+                    dlp_io8g_t *dlp, TriggerOutput *triggers, ControlSocket *control,
+                    SDL_AudioStream *ms, TextEngine *te, ScheduleStream *stream) {
     (void)ms;
     float rr = 60.0f;
     const SDL_DisplayMode *mode = SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(SDL_GetRenderWindow(rend)));
     if (mode && mode->refresh_rate > 0) rr = mode->refresh_rate;
+    if (exp && exp->frame_rate > 0.0f && SDL_fabsf(exp->frame_rate - rr) > 0.5f)
+        SDL_Log("Warning: the schedule was compiled for %.2f Hz but the display runs at %.2f Hz", exp->frame_rate, rr);
     Uint64 fd_ms = (Uint64)(1000.0f / rr);
+    Uint64 frame_ns = (Uint64)(1e9 / rr);
+
+    /* Event names are interned once; labels are the stimulus contents */
+    StringTable *strings = stream ? stream_strings(stream) : exp->strings;
+    log->strings = strings;
+    StrId ev_response = strtab_intern(strings, "RESPONSE");
+    StrId ev_sound_on = strtab_intern(strings, "SOUND_ONSET");
+    StrId ev_image_on = strtab_intern(strings, "IMAGE_ONSET"), ev_image_off = strtab_intern(strings, "IMAGE_OFFSET");
+    StrId ev_text_on = strtab_intern(strings, "TEXT_ONSET"), ev_text_off = strtab_intern(strings, "TEXT_OFFSET");
+    StrId ev_control = strtab_intern(strings, "CONTROL"), ev_mark = strtab_intern(strings, "MARK");
+    StrId control_abort = strtab_intern(strings, "abort"), control_pause = strtab_intern(strings, "pause");
+    StrId control_resume = strtab_intern(strings, "resume");
+    /* Key names too, by scancode: interning takes the table lock, which the frame loop must not wait on */
+    StrId key_names[SDL_SCANCODE_COUNT];
+    for (int sc = 0; sc < SDL_SCANCODE_COUNT; sc++)
+        key_names[sc] = strtab_intern(strings, SDL_GetKeyName(SDL_GetKeyFromScancode((SDL_Scancode)sc, SDL_KMOD_NONE, true)));
     Uint64 la_ms = fd_ms / 2;
 
     bool run = true; bool aborted = false; SDL_Event ev; Uint64 st_ticks = SDL_GetTicks();
+    log->origin_ms = st_ticks;
+    SDL_LockMutex(mx->mutex);
+    mx->events = log->queue;
+    mx->ev_mixed = strtab_intern(strings, "SOUND_MIXED");
+    SDL_UnlockMutex(mx->mutex);
+    /* Serial writes happen on the trigger thread: the loop below only queues them */
+    if (triggers) trigger_output_set_origin(triggers, st_ticks);
+    bool at_present = cfg->trigger_timing == TRIGGER_AT_PRESENT;
+    DlpInput *inputs = NULL;
+    Uint8 input_lines = 0;
+    if (dlp && cfg->dlp_inputs) {
+        /* Reading a line turns it into an input: keep the trigger lines out */
+        if (cfg->dlp_inputs & TRIGGER_OUTPUT_LINES) SDL_Log("Warning: DLP lines 1 to 3 send triggers and are not polled as inputs");
+        input_lines = cfg->dlp_inputs & (Uint8)~TRIGGER_OUTPUT_LINES;
+        if (input_lines) inputs = dlp_input_start(dlp, input_lines, log->queue, strings, st_ticks, triggers);
+    }
+    /* Trigger codes are precomputed per row; the lines polled as inputs are left out of them */
+    Uint8 output_lines = (Uint8)~input_lines;
+    Uint8 held = 0;                 /* Lines held by the visual stimulus on screen */
+    Uint8 release = 0;              /* With at_present: held lines to unset after the next present */
+    StrId release_label = STR_EMPTY;
+    /* Console output happens on the monitor thread; the loop only publishes */
+    ProgressMonitor *progress = progress_monitor_start(stream ? -1 : exp->count, cfg->status_file);
+    control_socket_set_progress(control, progress);
+    /* A pause holds the schedule clock: rows are due at their timestamp plus paused_ms */
+    bool pause_requested = false, paused = false;
+    Uint64 paused_at = 0, paused_ms = 0;
+    Uint64 last_present_ns = 0;
+    bool photodiode = cfg->photodiode != PHOTODIODE_OFF;
+    bool photodiode_hold = cfg->photodiode_pattern == PHOTODIODE_HOLD;
+    SDL_FRect photodiode_patch = photodiode_rect(cfg);
     int cs = 0, avi = -1; Uint64 vet = 0;
+    int sound_rows[MAX_ACTIVE_SOUNDS] = {0};   /* Row played by each mixer slot, to know what the stream may release */
 
     while (run) {
         Uint64 ct = SDL_GetTicks() - st_ticks;
@@ -84,56 +285,155 @@ bool run_experiment(Config *cfg, Experiment *exp, Resource *resources,
             if (ev.type == SDL_EVENT_QUIT) { run = false; aborted = true; }
             else if (ev.type == SDL_EVENT_KEY_DOWN) {
                 if (ev.key.key == SDLK_ESCAPE) { run = false; aborted = true; }
-                else log_event(log, ct, ct, "RESPONSE", SDL_GetKeyName(ev.key.key));
+                else log_event(log, ct, ct, ev_response, ev.key.scancode < SDL_SCANCODE_COUNT ? key_names[ev.key.scancode] : STR_EMPTY);
             }
         }
+        ControlCommand cmd;
+        while (control_poll(control, &cmd)) {
+            if (cmd.type == CONTROL_ABORT) {
+                log_event(log, ct, ct, ev_control, control_abort);
+                run = false; aborted = true;
+            } else if (cmd.type == CONTROL_PAUSE) pause_requested = !paused;
+            else if (cmd.type == CONTROL_RESUME) {
+                pause_requested = false;
+                if (paused) {
+                    log_event(log, ct, ct, ev_control, control_resume);
+                    paused_ms += ct - paused_at;
+                    paused = false;
+                    control_set_paused(control, false);
+                }
+            } else log_event(log, ct, ct, ev_mark, cmd.label);
+        }
+        Uint64 sched = ct - paused_ms;
 
+        int available = stream ? stream_ready(stream) : exp->count;
         bool trig = false; int tidx = -1;
-        if (cs < exp->count && (ct + la_ms) >= exp->stimuli[cs].timestamp_ms) {
-            Stimulus *s = &exp->stimuli[cs];
-            if ((s->type == STIM_IMAGE || s->type == STIM_TEXT) && resources[cs].texture) {
+        bool due = !paused && cs < available && (sched + la_ms) >= row_stimulus(exp, stream, cs)->timestamp_ms;
+        /* Trial boundary: the next row is due and no image or text is on screen */
+        if (due && pause_requested && avi == -1) {
+            log_event(log, ct, ct, ev_control, control_pause);
+            paused = true; pause_requested = false; paused_at = ct;
+            control_set_paused(control, true);
+            due = false;
+        }
+        if (due) {
+            const Stimulus *s = row_stimulus(exp, stream, cs);
+            Uint64 onset_ms = s->timestamp_ms + paused_ms;
+            Resource *r = row_resource(resources, stream, cs);
+            if ((s->type == STIM_IMAGE || s->type == STIM_TEXT) && (r->texture || r->text)) {
                 avi = cs; trig = true; tidx = cs;
                 vet = ct + s->duration_ms;
-                if (dlp) dlp_set(dlp, s->type == STIM_IMAGE ? "1" : "3");
-            } else if (s->type == STIM_SOUND && resources[cs].sound.data) {
+                /* A stimulus that replaces another one before its offset releases the lines it no longer holds */
+                Uint8 lines = s->trigger_lines & output_lines, hold = s->trigger_width_ms ? 0 : lines;
+                if (triggers && at_present && (held & ~hold)) { release |= held & (Uint8)~hold; release_label = s->content; }
+                else if (triggers && !at_present) {
+                    if (held & ~hold) trigger_unset(triggers, held & (Uint8)~hold, onset_ms, s->content);
+                    send_onset_trigger(triggers, s, lines, 0, onset_ms);
+                }
+                held = hold;
+            } else if (s->type == STIM_SOUND && r->sound.data) {
                 SDL_LockMutex(mx->mutex);
                 for (int j = 0; j < MAX_ACTIVE_SOUNDS; j++) {
                     if (!mx->slots[j].active) {
-                        mx->slots[j].resource = &resources[cs].sound; mx->slots[j].play_pos = 0; mx->slots[j].active = true;
-                        log_event(log, s->timestamp_ms, ct, "SOUND_ONSET", s->file_path);
-                        if (dlp) { dlp_set(dlp, "2"); SDL_Delay(5); dlp_unset(dlp, "2"); }
+                        mx->slots[j].resource = &r->sound; mx->slots[j].play_pos = 0; mx->slots[j].active = true;
+                        mx->slots[j].intended_ms = onset_ms; mx->slots[j].label = s->content;
+                        sound_rows[j] = cs;
+                        log_event(log, onset_ms, ct, ev_sound_on, s->content);
+                        progress_onset_error(progress, (Sint64)ct - (Sint64)onset_ms);
+                        if (triggers) send_onset_trigger(triggers, s, s->trigger_lines & output_lines, 0, onset_ms);
                         break;
                     }
                 }
                 SDL_UnlockMutex(mx->mutex);
             }
-            cs++; fprintf(stdout, "\rStimulus: %d/%d ", cs, exp->count); fflush(stdout);
+            cs++;
+            progress_set_rows(progress, cs);
         }
 
         if (avi != -1 && ct >= vet) {
-            Uint64 intended_off = exp->stimuli[avi].timestamp_ms + exp->stimuli[avi].duration_ms;
-            log_event(log, intended_off, ct, exp->stimuli[avi].type == STIM_IMAGE ? "IMAGE_OFFSET" : "TEXT_OFFSET", exp->stimuli[avi].file_path);
-            if (dlp) dlp_unset(dlp, exp->stimuli[avi].type == STIM_IMAGE ? "1" : "3");
+            const Stimulus *s = row_stimulus(exp, stream, avi);
+            Uint64 offset_ms = s->timestamp_ms + s->duration_ms + paused_ms;
+            log_event(log, offset_ms, ct, s->type == STIM_IMAGE ? ev_image_off : ev_text_off, s->content);
+            if (triggers && at_present && held) { release |= held; release_label = s->content; }
+            else if (triggers && held) trigger_unset(triggers, held, offset_ms, s->content);
+            held = 0;
             avi = -1;
         }
 
-        if (cs >= exp->count && avi == -1 && ct >= cfg->total_duration) run = false;
+        bool all_read = stream ? stream_finished(stream) && cs >= stream_ready(stream) : cs >= exp->count;
+        if (all_read && avi == -1 && sched >= cfg->total_duration) run = false;
 
         SDL_SetRenderDrawColor(rend, cfg->bg_color.r, cfg->bg_color.g, cfg->bg_color.b, cfg->bg_color.a); 
         SDL_RenderClear(rend);
         if (avi != -1) {
-            Resource *r = &resources[avi];
-            SDL_FRect dr = {(cfg->screen_w - (r->w * cfg->scale_factor)) / 2.0f, (cfg->screen_h - (r->h * cfg->scale_factor)) / 2.0f, r->w * cfg->scale_factor, r->h * cfg->scale_factor};
-            SDL_RenderTexture(rend, r->texture, NULL, &dr);
+            Resource *r = row_resource(resources, stream, avi);
+            float sf = r->prescaled ? 1.0f : cfg->scale_factor;
+            SDL_FRect dr = {(cfg->screen_w - (r->w * sf)) / 2.0f, (cfg->screen_h - (r->h * sf)) / 2.0f, r->w * sf, r->h * sf};
+            if (r->text) text_engine_draw(te, rend, r->text, dr.x, dr.y, sf, r->color);
+            else SDL_RenderTexture(rend, r->texture, NULL, &dr);
         } else if (cfg->use_fixation) draw_fixation_cross(rend, cfg->screen_w, cfg->screen_h, cfg->fixation_color);
+        /* Drawn last, over the stimulus, for every visual onset whatever its trigger code */
+        if (photodiode) {
+            bool lit = avi != -1 && (trig || photodiode_hold);
+            Uint8 v = lit ? 255 : 0;
+            SDL_SetRenderDrawColor(rend, v, v, v, 255);
+            SDL_RenderFillRect(rend, &photodiode_patch);
+        }
         SDL_RenderPresent(rend);
+        Uint64 ot = SDL_GetTicks() - st_ticks;
+        /* With VSYNC, a present that took more than a frame means frames were missed */
+        Uint64 present_ns = SDL_GetTicksNS();
+        if (cfg->vsync && last_present_ns) {
+            Uint64 missed = (present_ns - last_present_ns + frame_ns / 2) / frame_ns;
+            if (missed > 1) progress_dropped_frames(progress, (int)(missed - 1));
+        }
+        last_present_ns = present_ns;
+
+        /* The intended time of present-aligned triggers is the present plus the offset,
+           so the timing error of TRIGGER_WRITTEN is the present-to-write delay */
+        if (triggers && at_present && (trig || release)) {
+            Uint64 tt = ot + (Uint64)cfg->trigger_offset_ms;
+            if (release) trigger_unset_at(triggers, release, st_ticks + tt, tt, release_label);
+            if (trig) {
+                const Stimulus *s = row_stimulus(exp, stream, tidx);
+                send_onset_trigger(triggers, s, s->trigger_lines & output_lines, st_ticks + tt, tt);
+            }
+            release = 0;
+        }
 
         if (trig) {
-            Uint64 ot = SDL_GetTicks() - st_ticks;
-            log_event(log, exp->stimuli[tidx].timestamp_ms, ot, exp->stimuli[tidx].type == STIM_IMAGE ? "IMAGE_ONSET" : "TEXT_ONSET", exp->stimuli[tidx].file_path);
-            vet = ot + exp->stimuli[tidx].duration_ms;
+            const Stimulus *s = row_stimulus(exp, stream, tidx);
+            log_event(log, s->timestamp_ms + paused_ms, ot, s->type == STIM_IMAGE ? ev_image_on : ev_text_on, s->content);
+            progress_onset_error(progress, (Sint64)ot - (Sint64)(s->timestamp_ms + paused_ms));
+            vet = ot + s->duration_ms;
+        }
+
+        /* Right after the flip is when the frame has the most time to spare */
+        event_log_collect(log);
+        event_log_commit(log, SDL_GetTicks() - st_ticks);
+        if (stream) {
+            int first_needed = avi != -1 ? avi : cs;
+            SDL_LockMutex(mx->mutex);
+            for (int j = 0; j < MAX_ACTIVE_SOUNDS; j++) {
+                if (mx->slots[j].active && sound_rows[j] < first_needed) first_needed = sound_rows[j];
+            }
+            SDL_UnlockMutex(mx->mutex);
+            stream_release(stream, first_needed);
+            stream_upload(stream, rend, te, STREAM_UPLOADS_PER_FRAME, frame_ns / STREAM_UPLOAD_SHARE);
         }
         if (!cfg->vsync) SDL_Delay(1);
     }
+
+    SDL_LockMutex(mx->mutex);
+    mx->events = NULL;
+    SDL_UnlockMutex(mx->mutex);
+    control_socket_stop(control);
+    progress_monitor_stop(progress);
+    dlp_input_stop(inputs);
+    trigger_output_stop(triggers);
+    event_log_collect(log);
+    event_log_commit(log, SDL_MAX_UINT64);
+    if (log->queue && event_queue_dropped(log->queue) > 0)
+        SDL_Log("Warning: %d events were dropped because the event queue was full", event_queue_dropped(log->queue));
     return !aborted;
 }
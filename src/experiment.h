@@ -17,24 +17,72 @@
 #include "resources.h"
 #include "audio.h"
 #include "dlp.h"
+#include "trigger_output.h"
+#include "control_socket.h"
+#include "schedule_stream.h"
 
 typedef struct {
     Uint64 intended_ms;
     Uint64 timestamp_ms;
-    char   type[16];
-    char   label[256];
+    StrId  type;            /* Event name, e.g. IMAGE_ONSET */
+    StrId  label;           /* Stimulus content or key name */
 } EventLogEntry;
 
+/*
+ * The entries form a ring: entry i lives in entries[i % capacity] and its
+ * slot is reused once the results writer has copied it out, so capacity
+ * bounds the events not written yet rather than the length of the run.
+ */
 typedef struct {
     EventLogEntry *entries;
-    int            count;
+    int            count;       /* Events logged so far */
     int            capacity;
+    StringTable   *strings;     /* Table of the type and label ids (the experiment's) */
+    EventQueue    *queue;       /* Events pushed by other threads, merged by event_log_collect() */
+    Uint64         origin_ms;   /* SDL_GetTicks() at the start of the run */
+    int            committed;   /* Entries that are final: no queued event can be inserted before them */
+    SDL_AtomicInt  published;   /* committed, as seen by the results writer */
+    SDL_AtomicInt  written;     /* Entries copied out by the results writer, whose slots can be reused */
+    SDL_Mutex     *lock;        /* Held while entries is reallocated, and by readers of published entries */
 } EventLog;
 
 /**
- * @brief Logs an event with intended and actual timestamps.
+ * @brief Returns entry i (count > i >= written).
+ */
+static inline EventLogEntry *event_log_entry(const EventLog *log, int i) {
+    return &log->entries[i % log->capacity];
+}
+
+/**
+ * @brief Estimates how many events a run will log: two per stimulus, the trigger events with --dlp, plus the expected responses.
+ *
+ * exp may be NULL (streaming), in which case the ring is sized for the events not written yet.
  */
-bool log_event(EventLog *log, Uint64 intended_ms, Uint64 actual_ms, const char *type, const char *label);
+int event_log_estimate(const Experiment *exp, const Config *cfg);
+
+/**
+ * @brief Allocates the log and its queue up front, so that logging never allocates during the run.
+ */
+bool event_log_init(EventLog *log, int capacity);
+
+/**
+ * @brief Logs an event with intended and actual timestamps. Main thread only.
+ *
+ * Other threads push to log->queue instead.
+ */
+bool log_event(EventLog *log, Uint64 intended_ms, Uint64 actual_ms, StrId type, StrId label);
+
+/**
+ * @brief Moves the queued events into the log, keeping it sorted by actual time. Main thread only.
+ */
+void event_log_collect(EventLog *log);
+
+/**
+ * @brief Publishes the entries older than now_ms minus a safety delay to the results writer.
+ *
+ * Pass SDL_MAX_UINT64 after the run to publish everything.
+ */
+void event_log_commit(EventLog *log, Uint64 now_ms);
 
 /**
  * @brief Frees the event log memory.
@@ -43,14 +91,35 @@ void free_event_log(EventLog *log);
 
 /**
  * @brief Core experiment loop.
+ *
+ * With a stream, rows are taken from it as they become ready and exp and
+ * resources are not used (they may be NULL). triggers, started on dlp by
+ * the caller, is stopped by the run; both are NULL without a device. So is
+ * control, the control socket started by the caller, or NULL.
  */
 bool run_experiment(Config *cfg, Experiment *exp, Resource *resources, 
                     SDL_Renderer *rend, AudioMixer *mx, EventLog *log, 
-                    dlp_io8g_t *dlp, SDL_AudioStream *ms, TTF_Font *fnt);
+                    dlp_io8g_t *dlp, TriggerOutput *triggers, ControlSocket *control,
+                    SDL_AudioStream *ms, TextEngine *te, ScheduleStream *stream);
 
 /**
  * @brief Displays a splash screen and waits for a keypress.
  */
 bool display_splash(SDL_Renderer *renderer, const char *file_path, int screen_w, int screen_h, float scale_factor, SDL_Color bg_color);
 
+/**
+ * @brief Shows a progress bar until the background loader is done.
+ *
+ * Returns immediately if loading has already finished.
+ * @return false if the user quit (window closed or ESC) while waiting.
+ */
+bool display_loading_progress(SDL_Renderer *renderer, ResourceLoader *loader, int screen_w, int screen_h, SDL_Color bg_color, SDL_Color fg_color);
+
+/**
+ * @brief Shows a progress bar until the stream's look-ahead ring is full.
+ *
+ * @return false if the user quit while waiting.
+ */
+bool display_stream_prefill(SDL_Renderer *renderer, ScheduleStream *stream, TextEngine *te, int screen_w, int screen_h, SDL_Color bg_color, SDL_Color fg_color);
+
 #endif // EXPERIMENT_H
@@ -12,23 +12,74 @@
 #include <SDL3_ttf/SDL_ttf.h>
 #include <string.h>
 
+#define NUM_FIELDS 3
+#define NUM_RES    6
+
+/* A rendered string, re-rendered only when its text changes */
+typedef struct {
+    SDL_Texture *texture;
+    float w, h;
+    char text[1024];
+} GuiLabel;
+
+static void set_label(GuiLabel *l, SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Color color) {
+    if (l->texture && strcmp(l->text, text) == 0) return;
+    if (l->texture) SDL_DestroyTexture(l->texture);
+    l->texture = NULL;
+    l->w = l->h = 0;
+    strncpy(l->text, text, sizeof(l->text) - 1);
+    if (!text[0]) return;
+    SDL_Surface *s = TTF_RenderText_Blended(font, text, 0, color);
+    if (!s) return;
+    l->texture = SDL_CreateTextureFromSurface(renderer, s);
+    l->w = (float)s->w; l->h = (float)s->h;
+    SDL_DestroySurface(s);
+}
+
+static void draw_label(SDL_Renderer *renderer, const GuiLabel *l, float x, float y) {
+    if (!l->texture) return;
+    SDL_FRect r = {x, y, l->w, l->h};
+    SDL_RenderTexture(renderer, l->texture, NULL, &r);
+}
+
+static void draw_checkbox(SDL_Renderer *renderer, float x, float y, bool checked) {
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_FRect check = {x, y, 20, 20}; SDL_RenderFillRect(renderer, &check);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); SDL_RenderRect(renderer, &check);
+    if (checked) {
+        SDL_FRect mark = {x + 4, y + 4, 12, 12};
+        SDL_SetRenderDrawColor(renderer, 0, 150, 0, 255); SDL_RenderFillRect(renderer, &mark);
+    }
+}
+
+/* Dialogs answer asynchronously: wake up the event loop so it redraws */
 static void SDLCALL file_dialog_callback(void *userdata, const char * const *filelist, int filter) {
     (void)filter;
     char *target = (char *)userdata;
     if (filelist && filelist[0]) strncpy(target, filelist[0], 1023);
+    SDL_Event wake = { .type = SDL_EVENT_USER };
+    SDL_PushEvent(&wake);
+}
+
+static char *field_text(Config *cfg, int i) {
+    return (i == 0) ? cfg->csv_file : (i == 1 ? cfg->stimuli_dir : cfg->output_file);
 }
 
 bool run_gui_setup(Config *cfg) {
     SDL_Window *window = SDL_CreateWindow("expe3000 Setup", 800, 750, 0);
     SDL_Renderer *renderer = SDL_CreateRenderer(window, NULL);
     TTF_Font *gui_font = TTF_OpenFont(get_default_font_path(), 18);
-    if (!gui_font) return false;
+    if (!gui_font) {
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        return false;
+    }
 
-    bool setup_done = false;
+    bool setup_done = false, quit = false;
     SDL_Event e;
     int focus_box = -1; // 0: csv, 1: stimuli_dir, 2: output
     
-    struct { int w, h; const char *label; } res_options[] = {
+    struct { int w, h; const char *label; } res_options[NUM_RES] = {
         {800, 600, "800x600 (SVGA)"},
         {1024, 768, "1024x768 (XGA)"},
         {1366, 1024, "1366x1024 (SXGA-)"},
@@ -39,23 +90,80 @@ bool run_gui_setup(Config *cfg) {
     int selected_res = 3; // Default to 1080p
     
     /* Pre-select resolution based on cfg */
-    for (int i = 0; i < 6; i++) {
+    for (int i = 0; i < NUM_RES; i++) {
         if (cfg->screen_w == res_options[i].w && cfg->screen_h == res_options[i].h) {
             selected_res = i;
             break;
         }
     }
 
+    /* Fixed captions are rendered once; the field values when they change */
+    SDL_Color black = {0, 0, 0, 255}, white = {255, 255, 255, 255};
+    const char *captions[NUM_FIELDS] = {"Experiment CSV:", "Stimuli Directory:", "Output Results CSV:"};
+    GuiLabel caption_labels[NUM_FIELDS] = {0}, field_labels[NUM_FIELDS] = {0}, res_labels[NUM_RES] = {0};
+    GuiLabel browse_label = {0}, fix_label = {0}, full_label = {0}, start_label = {0};
+    for (int i = 0; i < NUM_FIELDS; i++) set_label(&caption_labels[i], renderer, gui_font, captions[i], black);
+    for (int i = 0; i < NUM_RES; i++) set_label(&res_labels[i], renderer, gui_font, res_options[i].label, black);
+    set_label(&browse_label, renderer, gui_font, "...", black);
+    set_label(&fix_label, renderer, gui_font, "Show fixation cross", black);
+    set_label(&full_label, renderer, gui_font, "Fullscreen mode", black);
+    set_label(&start_label, renderer, gui_font, "START", white);
+
     SDL_StartTextInput(window);
 
-    while (!setup_done) {
-        while (SDL_PollEvent(&e)) {
-            if (e.type == SDL_EVENT_QUIT) {
-                SDL_StopTextInput(window);
-                return false;
+    /* Nothing is drawn unless an event changed something */
+    bool dirty = true;
+    while (!setup_done && !quit) {
+        if (dirty) {
+            SDL_SetRenderDrawColor(renderer, 240, 240, 240, 255);
+            SDL_RenderClear(renderer);
+
+            for (int i = 0; i < NUM_FIELDS; i++) {
+                draw_label(renderer, &caption_labels[i], 50, 20 + (float)i * 70);
+
+                SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+                SDL_FRect box = {50, 50 + (float)i * 70, 650, 30}; SDL_RenderFillRect(renderer, &box);
+                SDL_SetRenderDrawColor(renderer, (focus_box == i) ? 0 : 180, (focus_box == i) ? 120 : 180, 255, 255);
+                SDL_RenderRect(renderer, &box);
+                set_label(&field_labels[i], renderer, gui_font, field_text(cfg, i), black);
+                draw_label(renderer, &field_labels[i], 55, 55 + (float)i * 70);
+
+                SDL_SetRenderDrawColor(renderer, 200, 200, 200, 255);
+                SDL_FRect btn = {710, 50 + (float)i * 70, 70, 30}; SDL_RenderFillRect(renderer, &btn);
+                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+                SDL_RenderRect(renderer, &btn);
+                draw_label(renderer, &browse_label, 735, 55 + (float)i * 70);
+            }
+
+            for (int i = 0; i < NUM_RES; i++) {
+                draw_checkbox(renderer, 50, 260 + (float)i * 40, selected_res == i);
+                draw_label(renderer, &res_labels[i], 80, 260 + (float)i * 40);
+            }
+
+            draw_checkbox(renderer, 50, 520, cfg->use_fixation);
+            draw_label(renderer, &fix_label, 80, 520);
+            draw_checkbox(renderer, 50, 570, cfg->fullscreen);
+            draw_label(renderer, &full_label, 80, 570);
+
+            // Start button
+            SDL_SetRenderDrawColor(renderer, 0, 150, 0, 255);
+            SDL_FRect start_btn = {350, 650, 100, 40}; SDL_RenderFillRect(renderer, &start_btn);
+            draw_label(renderer, &start_label, 375, 660);
+
+            SDL_RenderPresent(renderer);
+            dirty = false;
+        }
+
+        if (!SDL_WaitEvent(&e)) break;
+        do {
+            if (e.type == SDL_EVENT_QUIT) quit = true;
+            else if (e.type == SDL_EVENT_USER || e.type == SDL_EVENT_WINDOW_EXPOSED || e.type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED ||
+                     e.type == SDL_EVENT_WINDOW_RESTORED || e.type == SDL_EVENT_RENDER_TARGETS_RESET || e.type == SDL_EVENT_RENDER_DEVICE_RESET) {
+                dirty = true;
             }
             if (e.type == SDL_EVENT_MOUSE_BUTTON_DOWN) {
                 float mx = e.button.x, my = e.button.y;
+                dirty = true;
                 if (mx >= 50 && mx <= 700 && my >= 50 && my <= 80) focus_box = 0;
                 else if (mx >= 50 && mx <= 700 && my >= 120 && my <= 150) focus_box = 1;
                 else if (mx >= 50 && mx <= 700 && my >= 190 && my <= 220) focus_box = 2;
@@ -63,7 +171,7 @@ bool run_gui_setup(Config *cfg) {
 
                 if (mx >= 710 && mx <= 780) {
                     if (my >= 50 && my <= 80) {
-                        SDL_DialogFileFilter filters[] = {{"CSV Files", "csv"}};
+                        SDL_DialogFileFilter filters[] = {{"Experiments", "csv;e3s;e3b"}};
                         SDL_ShowOpenFileDialog(file_dialog_callback, cfg->csv_file, window, filters, 1, NULL, false);
                     } else if (my >= 120 && my <= 150) {
                         SDL_ShowOpenFolderDialog(file_dialog_callback, cfg->stimuli_dir, window, NULL, false);
@@ -71,7 +179,7 @@ bool run_gui_setup(Config *cfg) {
                         SDL_ShowSaveFileDialog(file_dialog_callback, cfg->output_file, window, NULL, 0, "results.csv");
                     }
                 }
-                for (int i = 0; i < 6; i++) {
+                for (int i = 0; i < NUM_RES; i++) {
                     if (mx >= 50 && mx <= 300 && my >= 260 + (float)i * 40 && my <= 290 + (float)i * 40) selected_res = i;
                 }
                 if (mx >= 50 && mx <= 300 && my >= 520 && my <= 550) cfg->use_fixation = !cfg->use_fixation;
@@ -87,135 +195,31 @@ bool run_gui_setup(Config *cfg) {
                 }
             }
             if (e.type == SDL_EVENT_TEXT_INPUT && focus_box != -1) {
-                char *target = (focus_box == 0) ? cfg->csv_file : (focus_box == 1 ? cfg->stimuli_dir : cfg->output_file);
+                char *target = field_text(cfg, focus_box);
                 strncat(target, e.text.text, 1023 - strlen(target));
+                dirty = true;
             }
             if (e.type == SDL_EVENT_KEY_DOWN && focus_box != -1) {
                 if (e.key.key == SDLK_BACKSPACE) {
-                    char *target = (focus_box == 0) ? cfg->csv_file : (focus_box == 1 ? cfg->stimuli_dir : cfg->output_file);
+                    char *target = field_text(cfg, focus_box);
                     size_t len = strlen(target);
                     if (len > 0) target[len - 1] = '\0';
+                    dirty = true;
                 }
             }
-        }
-
-        SDL_SetRenderDrawColor(renderer, 240, 240, 240, 255);
-        SDL_RenderClear(renderer);
-        SDL_Color black = {0, 0, 0, 255};
-
-        const char *labels[] = {"Experiment CSV:", "Stimuli Directory:", "Output Results CSV:"};
-        float label_y[] = {20, 90, 160};
-        for (int i = 0; i < 3; i++) {
-            SDL_Surface *s = TTF_RenderText_Blended(gui_font, labels[i], 0, black);
-            if (s) {
-                SDL_Texture *t = SDL_CreateTextureFromSurface(renderer, s);
-                SDL_FRect r = {50, label_y[i], (float)s->w, (float)s->h};
-                SDL_RenderTexture(renderer, t, NULL, &r);
-                SDL_DestroySurface(s); SDL_DestroyTexture(t);
-            }
-        }
-
-        for (int i = 0; i < 3; i++) {
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-            SDL_FRect box = {50, 50 + (float)i * 70, 650, 30}; SDL_RenderFillRect(renderer, &box);
-            SDL_SetRenderDrawColor(renderer, (focus_box == i) ? 0 : 180, (focus_box == i) ? 120 : 180, 255, 255);
-            SDL_RenderRect(renderer, &box);
-
-            char *text = (i == 0) ? cfg->csv_file : (i == 1 ? cfg->stimuli_dir : cfg->output_file);
-            if (text[0]) {
-                SDL_Surface *s = TTF_RenderText_Blended(gui_font, text, 0, black);
-                if (s) {
-                    SDL_Texture *t = SDL_CreateTextureFromSurface(renderer, s);
-                    SDL_FRect r = {55, 55 + (float)i * 70, (float)s->w, (float)s->h};
-                    SDL_RenderTexture(renderer, t, NULL, &r);
-                    SDL_DestroySurface(s); SDL_DestroyTexture(t);
-                }
-            }
-
-            SDL_SetRenderDrawColor(renderer, 200, 200, 200, 255);
-            SDL_FRect btn = {710, 50 + (float)i * 70, 70, 30}; SDL_RenderFillRect(renderer, &btn);
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-            SDL_RenderRect(renderer, &btn);
-            SDL_Surface *sb = TTF_RenderText_Blended(gui_font, "...", 0, black);
-            if (sb) {
-                SDL_Texture *tb = SDL_CreateTextureFromSurface(renderer, sb);
-                SDL_FRect rb = {735, 55 + (float)i * 70, (float)sb->w, (float)sb->h};
-                SDL_RenderTexture(renderer, tb, NULL, &rb);
-                SDL_DestroySurface(sb); SDL_DestroyTexture(tb);
-            }
-        }
-
-        for (int i = 0; i < 6; i++) {
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-            SDL_FRect check = {50, 260 + (float)i * 40, 20, 20};
-            SDL_RenderFillRect(renderer, &check);
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-            SDL_RenderRect(renderer, &check);
-            if (selected_res == i) {
-                SDL_FRect mark = {54, 264 + (float)i * 40, 12, 12};
-                SDL_SetRenderDrawColor(renderer, 0, 150, 0, 255);
-                SDL_RenderFillRect(renderer, &mark);
-            }
-            SDL_Surface *s = TTF_RenderText_Blended(gui_font, res_options[i].label, 0, black);
-            if (s) {
-                SDL_Texture *t = SDL_CreateTextureFromSurface(renderer, s);
-                SDL_FRect r = {80, 260 + (float)i * 40, (float)s->w, (float)s->h};
-                SDL_RenderTexture(renderer, t, NULL, &r);
-                SDL_DestroySurface(s); SDL_DestroyTexture(t);
-            }
-        }
-
-        // Fixation checkbox
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-        SDL_FRect fix_check = {50, 520, 20, 20}; SDL_RenderFillRect(renderer, &fix_check);
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); SDL_RenderRect(renderer, &fix_check);
-        if (cfg->use_fixation) {
-            SDL_FRect mark = {54, 524, 12, 12};
-            SDL_SetRenderDrawColor(renderer, 0, 150, 0, 255); SDL_RenderFillRect(renderer, &mark);
-        }
-        SDL_Surface *s_fix = TTF_RenderText_Blended(gui_font, "Show fixation cross", 0, black);
-        if (s_fix) {
-            SDL_Texture *t_fix = SDL_CreateTextureFromSurface(renderer, s_fix);
-            SDL_FRect r_fix = {80, 520, (float)s_fix->w, (float)s_fix->h};
-            SDL_RenderTexture(renderer, t_fix, NULL, &r_fix);
-            SDL_DestroySurface(s_fix); SDL_DestroyTexture(t_fix);
-        }
-
-        // Fullscreen checkbox
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-        SDL_FRect full_check = {50, 570, 20, 20}; SDL_RenderFillRect(renderer, &full_check);
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); SDL_RenderRect(renderer, &full_check);
-        if (cfg->fullscreen) {
-            SDL_FRect mark = {54, 574, 12, 12};
-            SDL_SetRenderDrawColor(renderer, 0, 150, 0, 255); SDL_RenderFillRect(renderer, &mark);
-        }
-        SDL_Surface *s_full = TTF_RenderText_Blended(gui_font, "Fullscreen mode", 0, black);
-        if (s_full) {
-            SDL_Texture *t_full = SDL_CreateTextureFromSurface(renderer, s_full);
-            SDL_FRect r_full = {80, 570, (float)s_full->w, (float)s_full->h};
-            SDL_RenderTexture(renderer, t_full, NULL, &r_full);
-            SDL_DestroySurface(s_full); SDL_DestroyTexture(t_full);
-        }
-
-        // Start button
-        SDL_SetRenderDrawColor(renderer, 0, 150, 0, 255);
-        SDL_FRect start_btn = {350, 650, 100, 40}; SDL_RenderFillRect(renderer, &start_btn);
-        SDL_Color white = {255, 255, 255, 255};
-        SDL_Surface *s_st = TTF_RenderText_Blended(gui_font, "START", 0, white);
-        if (s_st) {
-            SDL_Texture *t_st = SDL_CreateTextureFromSurface(renderer, s_st);
-            SDL_FRect r_st = {375, 660, (float)s_st->w, (float)s_st->h};
-            SDL_RenderTexture(renderer, t_st, NULL, &r_st);
-            SDL_DestroySurface(s_st); SDL_DestroyTexture(t_st);
-        }
-
-        SDL_RenderPresent(renderer);
-        SDL_Delay(10);
+        } while (!setup_done && !quit && SDL_PollEvent(&e));
     }
 
     SDL_StopTextInput(window);
+    GuiLabel *all[] = { &browse_label, &fix_label, &full_label, &start_label };
+    for (size_t i = 0; i < SDL_arraysize(all); i++) if (all[i]->texture) SDL_DestroyTexture(all[i]->texture);
+    for (int i = 0; i < NUM_FIELDS; i++) {
+        if (caption_labels[i].texture) SDL_DestroyTexture(caption_labels[i].texture);
+        if (field_labels[i].texture) SDL_DestroyTexture(field_labels[i].texture);
+    }
+    for (int i = 0; i < NUM_RES; i++) if (res_labels[i].texture) SDL_DestroyTexture(res_labels[i].texture);
     TTF_CloseFont(gui_font);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
-    return true;
+    return setup_done;
 }
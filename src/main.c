@@ -24,6 +24,14 @@
 #include "experiment.h"
 #include "csv_parser.h"
 #include "dlp.h"
+#include "memstats.h"
+#include "bundle.h"
+#include "compiled_schedule.h"
+#include "schedule_check.h"
+#include "schedule_stream.h"
+#include "results_writer.h"
+#include "binary_log.h"
+#include "timing_report.h"
 #include "version.h"
 
 #if defined(__clang__)
@@ -50,12 +58,19 @@ int main(int argc, const char *argv[]) {
     SDL_Log("GitHub: https://github.com/chrplr/expe3000");
 
     /* ─── 1. Configuration ─── */
+    if (argc > 1 && strcmp(argv[1], "pack") == 0) return bundle_pack_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "compile") == 0) return compile_schedule_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "decompile") == 0) return decompile_schedule_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "export") == 0) return export_log_main(argc - 1, argv + 1);
+
+    int exit_code = 0;
     Config cfg;
     EventLog log = {0};
     if (!parse_args(argc, argv, &cfg)) {
         printf("Usage: expe3000 <stimuli_csv_file> [options]\n");
         return 0;
     }
+    if (cfg.check) return check_schedule(&cfg);
 
     /* ─── 2. Systems Initialization (Safe check) ─── */
     if (!(SDL_WasInit(SDL_INIT_VIDEO | SDL_INIT_AUDIO) & (SDL_INIT_VIDEO | SDL_INIT_AUDIO))) {
@@ -113,9 +128,7 @@ int main(int argc, const char *argv[]) {
     }
     SDL_Log("Logical Resolution: %dx%d (Letterbox)", cfg.screen_w, cfg.screen_h);
 
-    /* ─── 4. Font & CSV ─── */
-    display_splash(renderer, cfg.start_splash, cfg.screen_w, cfg.screen_h, cfg.scale_factor, cfg.bg_color);
-
+    /* ─── 4. Font ─── */
     TTF_Font *font = NULL;
     const char *font_path = cfg.font_file ? cfg.font_file : get_default_font_path();
     if (font_path) {
@@ -123,12 +136,8 @@ int main(int argc, const char *argv[]) {
         if (font) SDL_Log("Loaded font: %s", font_path);
         else SDL_Log("Failed to load font '%s': %s", font_path, SDL_GetError());
     }
-
-    Experiment *exp = parse_csv(cfg.csv_file);
-    if (!exp) {
-        fprintf(stderr, "Error: Failed to parse experiment CSV file: %s\n", cfg.csv_file);
-        return 1;
-    }
+    float wrap_width = cfg.wrap_width > 0 ? (float)cfg.wrap_width : 0.9f * cfg.screen_w / cfg.scale_factor;
+    TextEngine *te = text_engine_create(font, wrap_width);
 
     /* ─── 5. Path resolution ─── */
     char base_path[1024] = "";
@@ -144,11 +153,51 @@ int main(int argc, const char *argv[]) {
         }
     }
 
-    /* ─── 6. Audio Mixer & DLP ─── */
+    /* Everything cleanup releases, so that any step below can bail out to it */
+    Experiment *exp = NULL;
+    CacheEntry *cache = NULL;
+    Resource *resources = NULL;
     AudioMixer mx;
     audio_mixer_init(&mx);
+    SDL_AudioStream *master_stream = NULL;
+    dlp_io8g_t *dlp = NULL;
+    TriggerOutput *triggers = NULL;
+    ControlSocket *control = NULL;
+
+    /* The CSV is parsed and the stimuli decoded in the background from now on,
+       while the audio device opens and the participant reads the start splash. */
+    SDL_Log("Loading resources...");
+    PrescaleOptions prescale = { 0.0f, 1.0f, cfg.scale_filter };
+    if (cfg.prescale) {
+        /* Final size = scale factor x letterbox factor of the logical presentation */
+        int out_w = cfg.screen_w, out_h = cfg.screen_h;
+        SDL_SyncWindow(window);
+        SDL_GetRenderOutputSize(renderer, &out_w, &out_h);
+        float letterbox = SDL_min((float)out_w / cfg.screen_w, (float)out_h / cfg.screen_h);
+        prescale.scale = cfg.scale_factor * letterbox;
+        prescale.pixel_size = 1.0f / letterbox;
+        SDL_Log("Prescaling images by %.3f (%s filter)", prescale.scale, resample_filter_name(cfg.scale_filter));
+    }
+    ResourceLoader *loader = NULL;
+    ScheduleStream *stream = NULL;
+    if (cfg.stream) {
+        stream = stream_open(cfg.csv_file, base_path, cfg.text_color, &prescale, cfg.stream_ahead);
+        if (!stream) {
+            exit_code = 1;
+            goto cleanup;
+        }
+    } else {
+        loader = resource_loader_start(cfg.csv_file, te, cfg.text_color, base_path, &prescale);
+        if (!loader) {
+            exit_code = 1;
+            goto cleanup;
+        }
+    }
+
+    /* ─── 6. Audio Mixer & DLP ─── */
     SDL_AudioSpec target_spec = { SDL_AUDIO_S16, 2, 44100 };
-    SDL_AudioStream *master_stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &target_spec, audio_callback, &mx);
+    mx.bytes_per_second = SDL_AUDIO_FRAMESIZE(target_spec) * target_spec.freq;
+    master_stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &target_spec, audio_callback, &mx);
     
     if (master_stream) {
         SDL_Log("Audio stream created successfully (S16, 2 channels, 44100Hz)");
@@ -157,41 +206,57 @@ int main(int argc, const char *argv[]) {
         SDL_Log("CRITICAL: Failed to create audio stream: %s", SDL_GetError());
     }
 
-    dlp_io8g_t *dlp = cfg.dlp_device ? dlp_new(cfg.dlp_device, 9600) : NULL;
+    dlp = cfg.dlp_device ? dlp_new(cfg.dlp_device, 9600) : NULL;
     if (dlp) {
         SDL_Log("DLP device opened: %s", cfg.dlp_device);
         dlp_unset(dlp, "12345678");
+    } else if (cfg.dlp_device) {
+        fprintf(stderr, "Error: cannot open the DLP device %s: the run would have no triggers\n", cfg.dlp_device);
+        exit_code = 1;
+        goto cleanup;
     }
 
     /* ─── 7. Load Resources ─── */
-    SDL_Log("Loading resources...");
-    CacheEntry *cache = NULL;
-    Resource *resources = load_resources(renderer, exp, font, cfg.text_color, base_path, &cache);
-    
+    /* A schedule error is reported now, not after the participant has read the splash;
+       the stimuli go on decoding behind it */
+    if (loader && !resource_loader_wait_parsed(loader)) {
+        fprintf(stderr, "Error: Failed to parse experiment CSV file: %s\n", cfg.csv_file);
+        resource_loader_cancel(loader);
+        exit_code = 1;
+        goto cleanup;
+    }
+    bool go_on = display_splash(renderer, cfg.start_splash, cfg.screen_w, cfg.screen_h, cfg.scale_factor, cfg.bg_color);
+    if (go_on) {
+        if (stream) go_on = display_stream_prefill(renderer, stream, te, cfg.screen_w, cfg.screen_h, cfg.bg_color, cfg.text_color);
+        else go_on = display_loading_progress(renderer, loader, cfg.screen_w, cfg.screen_h, cfg.bg_color, cfg.text_color);
+    }
+    if (!go_on) {
+        SDL_Log("Quit while loading resources.");
+        if (loader) resource_loader_cancel(loader);
+        goto cleanup;
+    }
+
     /* Stats */
-    int ic = 0, sc = 0, tc = 0; size_t tm = 0;
-    int missing_count = 0;
-    for (CacheEntry *curr = cache; curr; curr = curr->next) {
-        if (curr->type == STIM_IMAGE || curr->type == STIM_TEXT) {
-            if (curr->texture) {
-                if (curr->type == STIM_IMAGE) ic++; else tc++;
-                float tw, th; SDL_GetTextureSize(curr->texture, &tw, &th);
-                tm += (size_t)(tw * th * 4);
-            } else {
-                missing_count++;
-            }
-        } else if (curr->type == STIM_SOUND) {
-            if (curr->sound.data) {
-                sc++;
-                tm += curr->sound.len;
-            } else {
-                missing_count++;
-            }
+    MemoryTotals mem = {0};
+    if (stream) {
+        /* Rows are decoded just in time: the look-ahead filled by the prefill is what
+           the run holds at any time, and the checks below apply to it (later rows are
+           only reported in the log if they fail to load) */
+        for (int row = 0; row < stream_ready(stream); row++) memory_totals_add(&mem, stream_entry(stream, row));
+        memory_totals_finish(&mem, te);
+    } else {
+        resources = resource_loader_finish(loader, renderer, &exp, &cache);
+        if (!exp) {
+            fprintf(stderr, "Error: Failed to parse experiment CSV file: %s\n", cfg.csv_file);
+            exit_code = 1;
+            goto cleanup;
         }
+        compute_memory_totals(cache, te, &mem);
+        if (cfg.memory_report) write_memory_report(cfg.memory_report, exp, resources, te);
     }
 
-    if (missing_count > 0) {
-        SDL_Log("WARNING: %d resources failed to load.", missing_count);
+    if (mem.missing > 0) {
+        SDL_Log("WARNING: %d resources failed to load.", mem.missing);
         const SDL_MessageBoxButtonData buttons[] = {
             { SDL_MESSAGEBOX_BUTTON_RETURNKEY_DEFAULT, 0, "Quit" },
             { 0, 1, "Continue" },
@@ -213,66 +278,176 @@ int main(int argc, const char *argv[]) {
         SDL_Log("User chose to continue despite missing resources.");
     }
 
-    SDL_Log("Resources loaded: %d images, %d sounds, %d text textures. Total: %.2f MB", ic, sc, tc, (double)tm / 1048576.0);
+    if (stream) {
+        SDL_Log("Streaming %s with %d rows of look-ahead. Look-ahead: %d images, %d sounds, %d text strings, GPU: %.2f MB (estimated), RAM: %.2f MB, text atlas: %.2f MB, process RSS: %.2f MB",
+                cfg.csv_file, cfg.stream_ahead, mem.images, mem.sounds, mem.texts, (double)mem.gpu_bytes / 1048576.0,
+                (double)mem.ram_bytes / 1048576.0, (double)mem.atlas_bytes / 1048576.0, (double)mem.rss_bytes / 1048576.0);
+    } else {
+        SDL_Log("Resources loaded: %d images, %d sounds, %d text strings. GPU: %.2f MB (estimated), RAM: %.2f MB, text atlas: %.2f MB, largest decode: %.2f MB, process RSS: %.2f MB (peak %.2f MB)",
+                mem.images, mem.sounds, mem.texts, (double)mem.gpu_bytes / 1048576.0, (double)mem.ram_bytes / 1048576.0, (double)mem.atlas_bytes / 1048576.0,
+                (double)mem.decode_peak / 1048576.0, (double)mem.rss_bytes / 1048576.0, (double)mem.peak_rss_bytes / 1048576.0);
+        int num_strings; size_t string_bytes;
+        strtab_get_stats(exp->strings, &num_strings, &string_bytes);
+        SDL_Log("String table: %d distinct strings, %.2f MB", num_strings, (double)string_bytes / 1048576.0);
+    }
 
-    /* ─── 8. Run Experiment ─── */
+    size_t total_bytes = mem.gpu_bytes + mem.ram_bytes + mem.atlas_bytes;
+    if (cfg.memory_budget_mb > 0 && total_bytes > (size_t)cfg.memory_budget_mb * 1048576) {
+        fprintf(stderr, "Error: %s need %.2f MB, over the memory budget of %d MB.%s\n", stream ? "The look-ahead rows" : "Resources",
+                (double)total_bytes / 1048576.0, cfg.memory_budget_mb, cache ? " Largest resources:" : " Lower --stream-ahead.");
+        log_largest_resources(cache, 10);
+        exit_code = 1;
+        goto cleanup;
+    }
+
+    /* ─── 8. Results File ─── */
+    if (!event_log_init(&log, event_log_estimate(exp, &cfg))) {
+        fprintf(stderr, "Error: Out of memory allocating the event log\n");
+        exit_code = 1;
+        goto cleanup;
+    }
+    if (dlp) {
+        triggers = trigger_output_start(dlp, log.queue, stream ? stream_strings(stream) : exp->strings, cfg.trigger_drain);
+        if (!triggers) {
+            fprintf(stderr, "Error: cannot start the trigger output on %s: the run would have no triggers\n", cfg.dlp_device);
+            exit_code = 1;
+            goto cleanup;
+        }
+    }
+    if (cfg.control_socket) {
+        control = control_socket_start(cfg.control_socket, stream ? stream_strings(stream) : exp->strings, &mx);
+        if (!control) {
+            fprintf(stderr, "Error: cannot serve the control socket %s: the run could not be steered\n", cfg.control_socket);
+            exit_code = 1;
+            goto cleanup;
+        }
+    }
+    /* The header is written now and the events while the run goes on, so a crash keeps them */
     time_t start_time = time(NULL);
-    bool completed = run_experiment(&cfg, exp, resources, renderer, &mx, &log, dlp, master_stream, font);
-    time_t end_time = time(NULL);
-    printf("\n");
+    FILE *rf = fopen(cfg.output_file, cfg.binary_log ? "wb" : "w");
+    if (rf && cfg.binary_log && !binary_log_begin(rf)) { fclose(rf); rf = NULL; }
+    if (!rf) {
+        fprintf(stderr, "Error: Could not open results file for writing: %s\n", cfg.output_file);
+        exit_code = 1;
+        goto cleanup;
+    }
+    fprintf(rf, "# expe3000 version: %s (compiled: %s %s)\n", EXPE3000_VERSION, __DATE__, __TIME__);
+    fprintf(rf, "# Author: Christophe Pallier (christophe@pallier.org)\n");
+    fprintf(rf, "# GitHub: https://github.com/chrplr/expe3000\n");
+    fprintf(rf, "# Compiler: %s %s\n", COMPILER_NAME, __VERSION__);
+    int sdl_v = SDL_GetVersion();
+    fprintf(rf, "# SDL Version: %d.%d.%d\n", SDL_VERSIONNUM_MAJOR(sdl_v), SDL_VERSIONNUM_MINOR(sdl_v), SDL_VERSIONNUM_MICRO(sdl_v));
+    fprintf(rf, "# Platform: %s\n", SDL_GetPlatform());
 
-    /* ─── 9. Save Results ─── */
-    FILE *rf = fopen(cfg.output_file, "w");
-    if (rf) {
-        fprintf(rf, "# expe3000 version: %s (compiled: %s %s)\n", EXPE3000_VERSION, __DATE__, __TIME__);
-        fprintf(rf, "# Author: Christophe Pallier (christophe@pallier.org)\n");
-        fprintf(rf, "# GitHub: https://github.com/chrplr/expe3000\n");
-        fprintf(rf, "# Compiler: %s %s\n", COMPILER_NAME, __VERSION__);
-        int sdl_v = SDL_GetVersion();
-        fprintf(rf, "# SDL Version: %d.%d.%d\n", SDL_VERSIONNUM_MAJOR(sdl_v), SDL_VERSIONNUM_MINOR(sdl_v), SDL_VERSIONNUM_MICRO(sdl_v));
-        fprintf(rf, "# Platform: %s\n", SDL_GetPlatform());
-        
-        char hostname[256] = "unknown";
+    char hostname[256] = "unknown";
 #ifdef _WIN32
-        if (getenv("COMPUTERNAME")) strncpy(hostname, getenv("COMPUTERNAME"), 255);
+    if (getenv("COMPUTERNAME")) strncpy(hostname, getenv("COMPUTERNAME"), 255);
 #else
-        if (gethostname(hostname, 255) != 0) {
-            if (getenv("HOSTNAME")) strncpy(hostname, getenv("HOSTNAME"), 255);
-            else if (getenv("HOST")) strncpy(hostname, getenv("HOST"), 255);
-        }
+    if (gethostname(hostname, 255) != 0) {
+        if (getenv("HOSTNAME")) strncpy(hostname, getenv("HOSTNAME"), 255);
+        else if (getenv("HOST")) strncpy(hostname, getenv("HOST"), 255);
+    }
 #endif
-        fprintf(rf, "# Hostname: %s\n", hostname);
+    fprintf(rf, "# Hostname: %s\n", hostname);
 
 #ifdef _WIN32
-        fprintf(rf, "# Username: %s\n", getenv("USERNAME") ? getenv("USERNAME") : "unknown");
+    fprintf(rf, "# Username: %s\n", getenv("USERNAME") ? getenv("USERNAME") : "unknown");
 #else
-        fprintf(rf, "# Username: %s\n", getenv("USER") ? getenv("USER") : (getenv("LOGNAME") ? getenv("LOGNAME") : "unknown"));
+    fprintf(rf, "# Username: %s\n", getenv("USER") ? getenv("USER") : (getenv("LOGNAME") ? getenv("LOGNAME") : "unknown"));
 #endif
-        fprintf(rf, "# Video Driver: %s\n", SDL_GetCurrentVideoDriver());
-        fprintf(rf, "# Audio Driver: %s\n", SDL_GetCurrentAudioDriver());
-        fprintf(rf, "# Renderer: %s\n", SDL_GetRendererName(renderer));
-        const SDL_DisplayMode *dm = SDL_GetCurrentDisplayMode(target_display);
-        if (dm) {
-            fprintf(rf, "# Display Mode: %dx%d @ %.2fHz (Physical)\n", dm->w, dm->h, dm->refresh_rate);
-        }
-        fprintf(rf, "# Logical Resolution: %dx%d\n", cfg.screen_w, cfg.screen_h);
-        fprintf(rf, "# Font: %s\n", font_path ? font_path : "none");
-        fprintf(rf, "# Font Size: %d\n", cfg.font_size);
-        fprintf(rf, "# Background Color: %d,%d,%d\n", cfg.bg_color.r, cfg.bg_color.g, cfg.bg_color.b);
-        fprintf(rf, "# Text Color: %d,%d,%d\n", cfg.text_color.r, cfg.text_color.g, cfg.text_color.b);
-        fprintf(rf, "# Fixation Color: %d,%d,%d\n", cfg.fixation_color.r, cfg.fixation_color.g, cfg.fixation_color.b);
-        fprintf(rf, "# Start Date: %s", ctime(&start_time));
-        fprintf(rf, "# End Date: %s", ctime(&end_time));
-        fprintf(rf, "# Completion Status: %s\n", completed ? "Completed Normally" : "Aborted (ESC or Quit)");
-        fprintf(rf, "# Command Line: %s\n", cmd_line);
-        fprintf(rf, "intended_ms,timestamp_ms,event_type,label\n");
-        for (int i = 0; i < log.count; i++) {
-            fprintf(rf, "%" PRIu64 ",%" PRIu64 ",%s,%s\n", log.entries[i].intended_ms, log.entries[i].timestamp_ms, log.entries[i].type, log.entries[i].label);
+    fprintf(rf, "# Video Driver: %s\n", SDL_GetCurrentVideoDriver());
+    fprintf(rf, "# Audio Driver: %s\n", SDL_GetCurrentAudioDriver());
+    fprintf(rf, "# Renderer: %s\n", SDL_GetRendererName(renderer));
+    const SDL_DisplayMode *dm = SDL_GetCurrentDisplayMode(target_display);
+    if (dm) {
+        fprintf(rf, "# Display Mode: %dx%d @ %.2fHz (Physical)\n", dm->w, dm->h, dm->refresh_rate);
+    }
+    fprintf(rf, "# Logical Resolution: %dx%d\n", cfg.screen_w, cfg.screen_h);
+    fprintf(rf, "# Image Scaling: x%.3f, %s filter, %s\n", cfg.scale_factor, resample_filter_name(cfg.scale_filter),
+            cfg.prescale ? "prescaled at load time" : "scaled by the GPU");
+    fprintf(rf, "# Font: %s\n", font_path ? font_path : "none");
+    fprintf(rf, "# Font Size: %d\n", cfg.font_size);
+    if (stream) fprintf(rf, "# Resource Memory: streamed, %d rows ahead\n", cfg.stream_ahead);
+    else fprintf(rf, "# Resource Memory: GPU %.2f MB (estimated), RAM %.2f MB, text atlas %.2f MB, largest decode %.2f MB\n",
+                 (double)mem.gpu_bytes / 1048576.0, (double)mem.ram_bytes / 1048576.0, (double)mem.atlas_bytes / 1048576.0, (double)mem.decode_peak / 1048576.0);
+    if (dlp) {
+        if (cfg.trigger_timing == TRIGGER_AT_PRESENT) fprintf(rf, "# Triggers: %s, visual at present + %d ms", cfg.dlp_device, cfg.trigger_offset_ms);
+        else fprintf(rf, "# Triggers: %s, visual at render", cfg.dlp_device);
+        fprintf(rf, ", low-latency serial %s%s\n", dlp->low_latency ? "on" : "off", cfg.trigger_drain ? ", drain timing" : "");
+        if (cfg.dlp_inputs) {
+            char lines[9];
+            int n = 0;
+            for (int i = 0; i < 8; i++) if (cfg.dlp_inputs & (1u << i)) lines[n++] = (char)('1' + i);
+            lines[n] = '\0';
+            fprintf(rf, "# DLP Inputs: %s\n", lines);
         }
+    }
+    if (cfg.photodiode != PHOTODIODE_OFF) {
+        static const char *const corners[] = { "", "top-left", "top-right", "bottom-left", "bottom-right" };
+        fprintf(rf, "# Photodiode: %s, %d px, %s\n", corners[cfg.photodiode], cfg.photodiode_size,
+                cfg.photodiode_pattern == PHOTODIODE_FLASH ? "onset frame" : "while shown");
+    }
+    fprintf(rf, "# Background Color: %d,%d,%d\n", cfg.bg_color.r, cfg.bg_color.g, cfg.bg_color.b);
+    fprintf(rf, "# Text Color: %d,%d,%d\n", cfg.text_color.r, cfg.text_color.g, cfg.text_color.b);
+    fprintf(rf, "# Fixation Color: %d,%d,%d\n", cfg.fixation_color.r, cfg.fixation_color.g, cfg.fixation_color.b);
+    fprintf(rf, "# Start Date: %s", ctime(&start_time));
+    fprintf(rf, "# Command Line: %s\n", cmd_line);
+    if (!cfg.binary_log) fprintf(rf, "intended_ms,timestamp_ms,event_type,label\n");
+    /* Accumulated by the writer as the events go to disk */
+    TimingReport timing;
+    bool have_timing = timing_report_init(&timing, stream ? stream_strings(stream) : exp->strings, cfg.timing_tolerance_ms);
+    ResultsWriter *writer = results_writer_start(rf, &log, cfg.binary_log, have_timing ? &timing : NULL);
+    if (!writer) {
         fclose(rf);
-        SDL_Log("Results saved to: %s", cfg.output_file);
-    } else {
-        fprintf(stderr, "Error: Could not open results file for writing: %s\n", cfg.output_file);
+        timing_report_free(&timing);
+        fprintf(stderr, "Error: Out of memory starting the results writer\n");
+        exit_code = 1;
+        goto cleanup;
+    }
+
+    /* ─── 9. Run Experiment ─── */
+    bool completed = run_experiment(&cfg, exp, resources, renderer, &mx, &log, dlp, triggers, control, master_stream, te, stream);
+    triggers = NULL;    /* Stopped by the run */
+    control = NULL;
+    time_t end_time = time(NULL);
+    printf("\n");
+    if (stream && stream_failed(stream)) {
+        fprintf(stderr, "Error: the schedule stopped at an invalid row of %s\n", cfg.csv_file);
+        exit_code = 1;
+    }
+
+    /* Trailer: written after the last event, so its presence marks a complete file */
+    char trailer[4096];
+    int tn = snprintf(trailer, sizeof(trailer), "# End Date: %s# Completion Status: %s\n", ctime(&end_time),
+                      completed ? "Completed Normally" : "Aborted (ESC or Quit)");
+    size_t tlen = tn > 0 && (size_t)tn < sizeof(trailer) ? (size_t)tn : 0;
+    size_t rss_end, peak_rss_end;
+    if (get_process_memory(&rss_end, &peak_rss_end)) {
+        tn = snprintf(trailer + tlen, sizeof(trailer) - tlen, "# Process Memory: RSS %.2f MB at start, %.2f MB at end, peak %.2f MB\n",
+                      (double)mem.rss_bytes / 1048576.0, (double)rss_end / 1048576.0, (double)peak_rss_end / 1048576.0);
+        if (tn > 0 && (size_t)tn < sizeof(trailer) - tlen) tlen += (size_t)tn;
+    }
+
+    /* Timing quality, so that a bad session shows up before the participant leaves */
+    results_writer_drain(writer);
+    if (have_timing) {
+        timing_report_finish(&timing);
+        size_t start = tlen;
+        tlen += timing_report_format(&timing, log.strings, trailer + tlen, sizeof(trailer) - tlen);
+        SDL_Log("%.*s", (int)(tlen - start), trailer + start);
+        char json_path[1024];
+        strncpy(json_path, cfg.output_file, sizeof(json_path) - 13); json_path[sizeof(json_path) - 13] = '\0';
+        char *dot = strrchr(json_path, '.');
+        if (dot && !strpbrk(dot, "/\\")) *dot = '\0';
+        strcat(json_path, ".timing.json");
+        if (timing_report_write_json(&timing, log.strings, json_path, completed)) SDL_Log("Timing report saved to: %s", json_path);
+        else fprintf(stderr, "Error: Could not write the timing report %s\n", json_path);
+        timing_report_free(&timing);
+    }
+    if (results_writer_finish(writer, trailer)) SDL_Log("Results saved to: %s", cfg.output_file);
+    else {
+        fprintf(stderr, "Error: Could not write all results to %s\n", cfg.output_file);
+        exit_code = 1;
     }
 
     /* ─── 10. Cleanup ─── */
@@ -280,11 +455,15 @@ int main(int argc, const char *argv[]) {
 
 cleanup:
     if (font) TTF_CloseFont(font);
+    trigger_output_stop(triggers);
+    control_socket_stop(control);
     if (dlp) dlp_close(dlp);
     if (master_stream) SDL_DestroyAudioStream(master_stream);
     
     free_event_log(&log);
     free_resources(resources, cache);
+    stream_close(stream);
+    text_engine_destroy(te);
     audio_mixer_destroy(&mx);
     free_experiment(exp);
     
@@ -293,5 +472,5 @@ cleanup:
     TTF_Quit();
     SDL_Quit();
 
-    return 0;
+    return exit_code;
 }
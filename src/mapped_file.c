@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#define _FILE_OFFSET_BITS 64      /* 64-bit off_t for ftello() on 32-bit systems */
+#include "mapped_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile *map_file(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror(path);
+        close(fd);
+        return NULL;
+    }
+    MappedFile *mf = calloc(1, sizeof(MappedFile));
+    if (!mf) { close(fd); return NULL; }
+    mf->size = (size_t)st.st_size;
+    if (mf->size > 0) {
+        void *p = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
+            free(mf);
+            return NULL;
+        }
+        /* Start reading ahead now: cold starts from network shares are dominated by latency */
+        posix_madvise(p, mf->size, POSIX_MADV_WILLNEED);
+        mf->data = (const Uint8 *)p;
+    }
+    close(fd);
+    return mf;
+}
+
+void unmap_file(MappedFile *mf) {
+    if (!mf) return;
+    if (mf->data) munmap((void *)mf->data, mf->size);
+    free(mf);
+}
+
+#else
+#include <windows.h>
+
+MappedFile *map_file(const char *path) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "%s: cannot open file\n", path);
+        return NULL;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return NULL;
+    }
+    MappedFile *mf = calloc(1, sizeof(MappedFile));
+    if (!mf) { CloseHandle(file); return NULL; }
+    mf->file = file;
+    mf->size = (size_t)size.QuadPart;
+    if (mf->size > 0) {
+        mf->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mf->mapping) mf->data = (const Uint8 *)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!mf->data) {
+            fprintf(stderr, "%s: cannot map file\n", path);
+            unmap_file(mf);
+            return NULL;
+        }
+    }
+    return mf;
+}
+
+void unmap_file(MappedFile *mf) {
+    if (!mf) return;
+    if (mf->data) UnmapViewOfFile(mf->data);
+    if (mf->mapping) CloseHandle(mf->mapping);
+    if (mf->file) CloseHandle(mf->file);
+    free(mf);
+}
+
+#endif
+
+Sint64 file_tell(FILE *f) {
+#ifdef _WIN32
+    return (Sint64)_ftelli64(f);
+#else
+    return (Sint64)ftello(f);
+#endif
+}
+
+bool file_seek(FILE *f, Sint64 offset) {
+#ifdef _WIN32
+    return _fseeki64(f, offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
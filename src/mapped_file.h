@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <SDL3/SDL.h>
+#include <stdio.h>
+
+typedef struct MappedFile {
+    const Uint8 *data;      /* Read-only view of the whole file (NULL if empty) */
+    size_t       size;
+#ifdef _WIN32
+    void        *file;
+    void        *mapping;
+#endif
+} MappedFile;
+
+/**
+ * @brief Maps a whole file read-only into memory.
+ *
+ * @return The mapping, or NULL on error (the reason is printed to stderr).
+ */
+MappedFile *map_file(const char *path);
+
+/**
+ * @brief Unmaps a file mapped with map_file().
+ */
+void unmap_file(MappedFile *mf);
+
+/**
+ * @brief ftell() with a 64-bit offset, also on Windows where long is 32 bits. Returns -1 on error.
+ */
+Sint64 file_tell(FILE *f);
+
+/**
+ * @brief fseek(f, offset, SEEK_SET) with a 64-bit offset.
+ */
+bool file_seek(FILE *f, Sint64 offset);
+
+#endif // MAPPED_FILE_H
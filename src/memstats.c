@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "memstats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/resource.h>
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+static const char *const type_names[] = { "IMAGE", "SOUND", "TEXT", "END" };
+
+size_t texture_footprint(SDL_Texture *tex, SDL_PixelFormat *format, int *pitch) {
+    if (!tex) return 0;
+    SDL_PropertiesID props = SDL_GetTextureProperties(tex);
+    SDL_PixelFormat fmt = (SDL_PixelFormat)SDL_GetNumberProperty(props, SDL_PROP_TEXTURE_FORMAT_NUMBER, SDL_PIXELFORMAT_UNKNOWN);
+    int w = (int)SDL_GetNumberProperty(props, SDL_PROP_TEXTURE_WIDTH_NUMBER, 0);
+    int h = (int)SDL_GetNumberProperty(props, SDL_PROP_TEXTURE_HEIGHT_NUMBER, 0);
+
+    size_t bytes;
+    int p;
+    if (SDL_ISPIXELFORMAT_FOURCC(fmt)) {
+        /* Planar YUV: full-resolution luma plus two quarter-resolution chroma planes */
+        p = w;
+        bytes = (size_t)w * h + 2 * (size_t)((w + 1) / 2) * ((h + 1) / 2);
+    } else {
+        int bpp = SDL_BYTESPERPIXEL(fmt);
+        if (bpp == 0) bpp = 4;
+        p = (w * bpp + 3) & ~3;     /* Assumes rows padded to 4 bytes */
+        bytes = (size_t)p * h;
+    }
+    if (format) *format = fmt;
+    if (pitch) *pitch = p;
+    return bytes;
+}
+
+bool get_process_memory(size_t *rss, size_t *peak_rss) {
+    *rss = 0; *peak_rss = 0;
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return false;
+    *rss = pmc.WorkingSetSize;
+    *peak_rss = pmc.PeakWorkingSetSize;
+    return true;
+#elif defined(__APPLE__)
+    struct mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return false;
+    *rss = info.resident_size;
+    *peak_rss = info.resident_size_max;
+    return true;
+#else
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        unsigned long size, resident;
+        if (fscanf(f, "%lu %lu", &size, &resident) == 2) *rss = (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+        fclose(f);
+    }
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) *peak_rss = (size_t)ru.ru_maxrss * 1024;  /* kilobytes on Linux */
+    return *rss > 0;
+#endif
+}
+
+void memory_totals_add(MemoryTotals *t, const CacheEntry *e) {
+    bool loaded = (e->type == STIM_IMAGE && e->texture) || (e->type == STIM_SOUND && e->sound.data) || (e->type == STIM_TEXT && e->text);
+    if (!loaded) { if (e->type != STIM_END) t->missing++; return; }
+    if (e->type == STIM_IMAGE) t->images++;
+    else if (e->type == STIM_SOUND) t->sounds++;
+    else if (e->type == STIM_TEXT) t->texts++;
+    t->gpu_bytes += e->mem.gpu_bytes;
+    t->ram_bytes += e->mem.ram_bytes;
+    if (e->mem.decode_peak > t->decode_peak) t->decode_peak = e->mem.decode_peak;
+}
+
+void memory_totals_finish(MemoryTotals *t, const TextEngine *te) {
+    /* The atlas pages are shared by every TEXT row, which only own their layouts */
+    TextEngineStats ts; text_engine_get_stats(te, &ts);
+    t->atlas_bytes = ts.atlas_bytes;
+    get_process_memory(&t->rss_bytes, &t->peak_rss_bytes);
+}
+
+void compute_memory_totals(const CacheEntry *cache, const TextEngine *te, MemoryTotals *t) {
+    memset(t, 0, sizeof(*t));
+    for (const CacheEntry *e = cache; e; e = e->next) memory_totals_add(t, e);
+    memory_totals_finish(t, te);
+}
+
+bool write_memory_report(const char *path, const Experiment *exp, const Resource *resources, const TextEngine *te) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Error: Could not open memory report for writing: %s\n", path);
+        return false;
+    }
+    fprintf(f, "row,type,content,loaded,gpu_bytes,ram_bytes,decode_peak_bytes,pixel_format,width,height,estimated_pitch,shared_with_row\n");
+    for (int i = 0; i < exp->count; i++) {
+        const Stimulus *s = &exp->stimuli[i];
+        const CacheEntry *e = resources[i].entry;
+        if (!e) continue;
+        bool shared = e->first_row != i;
+        bool loaded = e->texture || e->text || e->sound.data;
+        /* Shared rows cost nothing more: the memory is only counted on the first one */
+        fprintf(f, "%d,%s,%s,%d,%zu,%zu,%zu,%s,%d,%d,%d,%d\n",
+                i + 1, type_names[s->type], stimulus_content(exp, s), loaded ? 1 : 0,
+                shared ? 0 : e->mem.gpu_bytes, shared ? 0 : e->mem.ram_bytes, shared ? 0 : e->mem.decode_peak,
+                e->texture ? SDL_GetPixelFormatName(e->mem.format) : "",
+                (int)e->w, (int)e->h, e->mem.pitch, shared ? e->first_row + 1 : 0);
+    }
+    TextEngineStats ts; text_engine_get_stats(te, &ts);
+    if (ts.pages > 0) {
+        fprintf(f, "0,ATLAS,text glyph atlas,1,%zu,0,0,SDL_PIXELFORMAT_RGBA32,0,0,0,0\n", ts.atlas_bytes);
+    }
+    fclose(f);
+    SDL_Log("Memory report saved to: %s", path);
+    return true;
+}
+
+static int compare_footprint_desc(const void *a, const void *b) {
+    const CacheEntry *ea = *(const CacheEntry *const *)a, *eb = *(const CacheEntry *const *)b;
+    size_t sa = ea->mem.gpu_bytes + ea->mem.ram_bytes, sb = eb->mem.gpu_bytes + eb->mem.ram_bytes;
+    return (sa < sb) - (sa > sb);
+}
+
+void log_largest_resources(const CacheEntry *cache, int n) {
+    int count = 0;
+    for (const CacheEntry *e = cache; e; e = e->next) count++;
+    if (count == 0) return;
+    const CacheEntry **sorted = malloc(count * sizeof(*sorted));
+    if (!sorted) return;
+    int i = 0;
+    for (const CacheEntry *e = cache; e; e = e->next) sorted[i++] = e;
+    qsort(sorted, count, sizeof(*sorted), compare_footprint_desc);
+    for (i = 0; i < n && i < count; i++) {
+        const CacheEntry *e = sorted[i];
+        SDL_Log("  %8.2f MB  %s %s (row %d, used %d time%s)",
+                (double)(e->mem.gpu_bytes + e->mem.ram_bytes) / 1048576.0, type_names[e->type], e->file_path,
+                e->first_row + 1, e->uses, e->uses > 1 ? "s" : "");
+    }
+    free(sorted);
+}
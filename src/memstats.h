@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#include <SDL3/SDL.h>
+#include "stimuli.h"
+#include "resources.h"
+
+typedef struct {
+    int    images, sounds, texts, missing;
+    size_t gpu_bytes;       /* Image textures (estimated, see texture_footprint()) */
+    size_t ram_bytes;       /* PCM data and text layouts */
+    size_t atlas_bytes;     /* Text glyph atlas, counted once for its pages and their CPU copies */
+    size_t decode_peak;     /* Largest transient decode buffer */
+    size_t rss_bytes;       /* Current process resident set size */
+    size_t peak_rss_bytes;  /* Peak process resident set size */
+} MemoryTotals;
+
+/**
+ * @brief Estimates the memory used by a texture from its real format and size.
+ *
+ * SDL does not expose the pitch of a static texture: it is estimated as the
+ * row size padded to 4 bytes, and drivers may pad or tile further.
+ */
+size_t texture_footprint(SDL_Texture *tex, SDL_PixelFormat *format, int *pitch);
+
+/**
+ * @brief Queries the current and peak resident set size of the process.
+ *
+ * @return false if the platform does not report it (values are then 0).
+ */
+bool get_process_memory(size_t *rss, size_t *peak_rss);
+
+/**
+ * @brief Adds one resource to the totals (counted as missing if it failed to load).
+ */
+void memory_totals_add(MemoryTotals *totals, const CacheEntry *entry);
+
+/**
+ * @brief Adds the text atlas and the process footprint, once every resource is added.
+ */
+void memory_totals_finish(MemoryTotals *totals, const TextEngine *te);
+
+/**
+ * @brief Sums the footprint of all cached resources and of the text engine.
+ */
+void compute_memory_totals(const CacheEntry *cache, const TextEngine *te, MemoryTotals *totals);
+
+/**
+ * @brief Writes the per-stimulus memory footprint as CSV.
+ */
+bool write_memory_report(const char *path, const Experiment *exp, const Resource *resources, const TextEngine *te);
+
+/**
+ * @brief Logs the largest resources, to point at the assets to blame.
+ */
+void log_largest_resources(const CacheEntry *cache, int n);
+
+#endif // MEMSTATS_H
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "progress_monitor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define PROGRESS_PERIOD_MS 250
+
+/* Each value is written by the frame loop only: plain loads and stores of
+   atomics are enough, and the monitor may see them from different frames. */
+struct ProgressMonitor {
+    int total_rows;
+    char *status_file;
+    char *status_tmp;               /* Written, then renamed over status_file */
+    Uint64 start_ticks;
+    SDL_AtomicInt rows;
+    SDL_AtomicInt last_error_ms;
+    SDL_AtomicInt max_error_ms;     /* Largest absolute error */
+    SDL_AtomicInt dropped_frames;
+    SDL_AtomicInt quit;
+    SDL_Semaphore *wake;
+    SDL_Thread *thread;
+};
+
+ProgressState progress_snapshot(ProgressMonitor *pm, int *total_rows) {
+    if (total_rows) *total_rows = pm ? pm->total_rows : -1;
+    if (!pm) return (ProgressState){ 0, 0, 0, 0 };
+    return (ProgressState){ SDL_GetAtomicInt(&pm->rows), SDL_GetAtomicInt(&pm->last_error_ms),
+                            SDL_GetAtomicInt(&pm->max_error_ms), SDL_GetAtomicInt(&pm->dropped_frames) };
+}
+
+static void show(ProgressMonitor *pm, const ProgressState *st) {
+    if (pm->total_rows >= 0) fprintf(stdout, "\rStimulus: %d/%d", st->rows, pm->total_rows);
+    else fprintf(stdout, "\rStimulus: %d", st->rows);
+    fprintf(stdout, ", last onset %+d ms, max %d ms, %d dropped frames ", st->last_error_ms, st->max_error_ms, st->dropped_frames);
+    fflush(stdout);
+
+    if (!pm->status_file) return;
+    /* A reader sees either the previous file or the new one, never a partial write */
+    FILE *f = fopen(pm->status_tmp, "w");
+    bool ok = f != NULL;
+    if (f) {
+        fprintf(f, "rows,total_rows,elapsed_ms,last_onset_error_ms,max_onset_error_ms,dropped_frames\n");
+        fprintf(f, "%d,%d,%" PRIu64 ",%d,%d,%d\n", st->rows, pm->total_rows, SDL_GetTicks() - pm->start_ticks,
+                st->last_error_ms, st->max_error_ms, st->dropped_frames);
+        ok = !ferror(f);
+        if (fclose(f) != 0) ok = false;
+    }
+#ifdef _WIN32
+    if (ok) ok = MoveFileExA(pm->status_tmp, pm->status_file, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    if (ok) ok = rename(pm->status_tmp, pm->status_file) == 0;
+#endif
+    if (!ok) {
+        SDL_Log("Warning: cannot write the status file '%s', no more updates", pm->status_file);
+        if (f) remove(pm->status_tmp);
+        SDL_free(pm->status_file);
+        pm->status_file = NULL;
+    }
+}
+
+static int SDLCALL monitor_thread(void *data) {
+    ProgressMonitor *pm = (ProgressMonitor *)data;
+    SDL_SetCurrentThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    ProgressState shown = { -1, 0, 0, 0 };
+    for (;;) {
+        bool quit = SDL_GetAtomicInt(&pm->quit) != 0;
+        ProgressState st = progress_snapshot(pm, NULL);
+        /* Only what changed is written: an idle run does no I/O */
+        if (quit || memcmp(&st, &shown, sizeof(st)) != 0) {
+            show(pm, &st);
+            shown = st;
+        }
+        if (quit) break;
+        SDL_WaitSemaphoreTimeout(pm->wake, PROGRESS_PERIOD_MS);
+    }
+    return 0;
+}
+
+ProgressMonitor *progress_monitor_start(int total_rows, const char *status_file) {
+    ProgressMonitor *pm = calloc(1, sizeof(ProgressMonitor));
+    if (!pm) return NULL;
+    pm->total_rows = total_rows;
+    if (status_file && SDL_asprintf(&pm->status_tmp, "%s.tmp", status_file) >= 0) pm->status_file = SDL_strdup(status_file);
+    pm->start_ticks = SDL_GetTicks();
+    pm->wake = SDL_CreateSemaphore(0);
+    if (pm->wake) pm->thread = SDL_CreateThread(monitor_thread, "expe3000-progress", pm);
+    if (!pm->thread) {
+        SDL_Log("Warning: cannot start the progress monitor, no progress will be shown: %s", SDL_GetError());
+        if (pm->wake) SDL_DestroySemaphore(pm->wake);
+        SDL_free(pm->status_file);
+        SDL_free(pm->status_tmp);
+        free(pm);
+        return NULL;
+    }
+    return pm;
+}
+
+void progress_monitor_stop(ProgressMonitor *pm) {
+    if (!pm) return;
+    SDL_SetAtomicInt(&pm->quit, 1);
+    SDL_SignalSemaphore(pm->wake);
+    SDL_WaitThread(pm->thread, NULL);
+    SDL_DestroySemaphore(pm->wake);
+    SDL_free(pm->status_file);
+    SDL_free(pm->status_tmp);
+    free(pm);
+}
+
+void progress_set_rows(ProgressMonitor *pm, int rows) {
+    if (pm) SDL_SetAtomicInt(&pm->rows, rows);
+}
+
+void progress_onset_error(ProgressMonitor *pm, Sint64 error_ms) {
+    if (!pm) return;
+    int e = (int)SDL_clamp(error_ms, -1000000, 1000000);
+    SDL_SetAtomicInt(&pm->last_error_ms, e);
+    if (SDL_abs(e) > SDL_GetAtomicInt(&pm->max_error_ms)) SDL_SetAtomicInt(&pm->max_error_ms, SDL_abs(e));
+}
+
+void progress_dropped_frames(ProgressMonitor *pm, int frames) {
+    if (pm) SDL_AddAtomicInt(&pm->dropped_frames, frames);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef PROGRESS_MONITOR_H
+#define PROGRESS_MONITOR_H
+
+#include <SDL3/SDL.h>
+
+/*
+ * Progress monitor.
+ *
+ * The frame loop publishes its progress (rows started, onset errors,
+ * dropped frames) in atomics, without any I/O. A low-priority thread shows
+ * them on the console a few times per second, and rewrites a status file
+ * if one was given, so a slow terminal never stalls a frame.
+ */
+
+typedef struct ProgressMonitor ProgressMonitor;
+
+typedef struct {
+    int rows, last_error_ms, max_error_ms, dropped_frames;
+} ProgressState;
+
+/**
+ * @brief Starts the monitor thread. total_rows < 0 means unknown (streamed schedule).
+ *
+ * @param status_file Path of a CSV file rewritten at each update, or NULL.
+ */
+ProgressMonitor *progress_monitor_start(int total_rows, const char *status_file);
+
+/**
+ * @brief Shows the final state and stops the thread.
+ */
+void progress_monitor_stop(ProgressMonitor *pm);
+
+/**
+ * @brief Publishing, lock-free, to be called from a single thread (the frame loop). pm may be NULL.
+ */
+void progress_set_rows(ProgressMonitor *pm, int rows);
+void progress_onset_error(ProgressMonitor *pm, Sint64 error_ms);
+void progress_dropped_frames(ProgressMonitor *pm, int frames);
+
+/**
+ * @brief Reads the published values, from any thread. total_rows is -1 when unknown.
+ */
+ProgressState progress_snapshot(ProgressMonitor *pm, int *total_rows);
+
+#endif // PROGRESS_MONITOR_H
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "resample.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LANCZOS_LOBES 3
+#define RESAMPLE_ALPHA_EPSILON 1e-3f   /* Alpha (0-255) under which a pixel has no colour to recover */
+
+static const char *const filter_names[] = { "nearest", "linear", "lanczos" };
+
+bool parse_resample_filter(const char *name, ResampleFilter *filter) {
+    for (int i = 0; i < (int)SDL_arraysize(filter_names); i++) {
+        if (SDL_strcasecmp(name, filter_names[i]) == 0) { *filter = (ResampleFilter)i; return true; }
+    }
+    return false;
+}
+
+const char *resample_filter_name(ResampleFilter filter) {
+    return filter_names[filter];
+}
+
+static float kernel(ResampleFilter filter, float x) {
+    x = SDL_fabsf(x);
+    if (filter == RESAMPLE_LINEAR) return x < 1.0f ? 1.0f - x : 0.0f;
+    if (x < 1e-6f) return 1.0f;
+    if (x >= LANCZOS_LOBES) return 0.0f;
+    float px = SDL_PI_F * x;
+    return LANCZOS_LOBES * SDL_sinf(px) * SDL_sinf(px / LANCZOS_LOBES) / (px * px);
+}
+
+/* Weights of the source pixels contributing to each output pixel: taps per output, clamped to the edges. */
+static float *compute_weights(int src_n, int dst_n, ResampleFilter filter, int **first_out, int *taps_out) {
+    float scale = (float)dst_n / (float)src_n;
+    float fscale = scale < 1.0f ? scale : 1.0f;
+    float support = (filter == RESAMPLE_LINEAR ? 1.0f : (float)LANCZOS_LOBES) / fscale;
+    int taps = (int)SDL_ceilf(support) * 2 + 1;
+
+    float *weights = malloc((size_t)dst_n * taps * sizeof(float));
+    int *first = malloc((size_t)dst_n * sizeof(int));
+    if (!weights || !first) { free(weights); free(first); return NULL; }
+
+    for (int i = 0; i < dst_n; i++) {
+        float center = (i + 0.5f) / scale - 0.5f;
+        int left = (int)SDL_ceilf(center - support);
+        float *w = &weights[(size_t)i * taps];
+        float sum = 0.0f;
+        for (int t = 0; t < taps; t++) {
+            w[t] = kernel(filter, (left + t - center) * fscale);
+            sum += w[t];
+        }
+        if (sum != 0.0f) for (int t = 0; t < taps; t++) w[t] /= sum;
+        first[i] = left;
+    }
+    *first_out = first;
+    *taps_out = taps;
+    return weights;
+}
+
+static int clamp_index(int i, int n) {
+    return i < 0 ? 0 : (i >= n ? n - 1 : i);
+}
+
+static Uint8 to_byte(float v) {
+    if (v <= 0.0f) return 0;
+    if (v >= 255.0f) return 255;
+    return (Uint8)(v + 0.5f);
+}
+
+SDL_Surface *resample_surface(SDL_Surface *src, int dst_w, int dst_h, ResampleFilter filter) {
+    if (!src || dst_w <= 0 || dst_h <= 0) return NULL;
+    if (filter == RESAMPLE_NEAREST) {
+        SDL_Surface *scaled = SDL_ScaleSurface(src, dst_w, dst_h, SDL_SCALEMODE_NEAREST);
+        if (!scaled || scaled->format == SDL_PIXELFORMAT_RGBA32) return scaled;
+        SDL_Surface *rgba = SDL_ConvertSurface(scaled, SDL_PIXELFORMAT_RGBA32);
+        SDL_DestroySurface(scaled);
+        return rgba;
+    }
+
+    SDL_Surface *in = (src->format == SDL_PIXELFORMAT_RGBA32) ? src : SDL_ConvertSurface(src, SDL_PIXELFORMAT_RGBA32);
+    SDL_Surface *out = SDL_CreateSurface(dst_w, dst_h, SDL_PIXELFORMAT_RGBA32);
+    int *xfirst = NULL, *yfirst = NULL, xtaps = 0, ytaps = 0;
+    float *xw = in ? compute_weights(in->w, dst_w, filter, &xfirst, &xtaps) : NULL;
+    float *yw = in ? compute_weights(in->h, dst_h, filter, &yfirst, &ytaps) : NULL;
+    /* Horizontal pass result: dst_w x src_h premultiplied RGBA */
+    float *tmp = in ? malloc((size_t)dst_w * in->h * 4 * sizeof(float)) : NULL;
+
+    if (!in || !out || !xw || !yw || !tmp) {
+        if (out) SDL_DestroySurface(out);
+        out = NULL;
+        goto done;
+    }
+
+    for (int y = 0; y < in->h; y++) {
+        const Uint8 *row = (const Uint8 *)in->pixels + (size_t)y * in->pitch;
+        float *trow = &tmp[(size_t)y * dst_w * 4];
+        for (int x = 0; x < dst_w; x++) {
+            const float *w = &xw[(size_t)x * xtaps];
+            float r = 0, g = 0, b = 0, a = 0;
+            for (int t = 0; t < xtaps; t++) {
+                if (w[t] == 0.0f) continue;
+                const Uint8 *p = &row[clamp_index(xfirst[x] + t, in->w) * 4];
+                float pa = p[3] * w[t];
+                r += p[0] * pa; g += p[1] * pa; b += p[2] * pa; a += pa;
+            }
+            trow[x * 4 + 0] = r / 255.0f; trow[x * 4 + 1] = g / 255.0f; trow[x * 4 + 2] = b / 255.0f; trow[x * 4 + 3] = a;
+        }
+    }
+
+    for (int y = 0; y < dst_h; y++) {
+        const float *w = &yw[(size_t)y * ytaps];
+        Uint8 *orow = (Uint8 *)out->pixels + (size_t)y * out->pitch;
+        for (int x = 0; x < dst_w; x++) {
+            float r = 0, g = 0, b = 0, a = 0;
+            for (int t = 0; t < ytaps; t++) {
+                if (w[t] == 0.0f) continue;
+                const float *p = &tmp[((size_t)clamp_index(yfirst[y] + t, in->h) * dst_w + x) * 4];
+                r += p[0] * w[t]; g += p[1] * w[t]; b += p[2] * w[t]; a += p[3] * w[t];
+            }
+            /* Back from premultiplied alpha; the epsilon only guards the division, so that
+               faint edge pixels keep their colour instead of being darkened */
+            float inv = a > RESAMPLE_ALPHA_EPSILON ? 255.0f / a : 0.0f;
+            orow[x * 4 + 0] = to_byte(r * inv); orow[x * 4 + 1] = to_byte(g * inv); orow[x * 4 + 2] = to_byte(b * inv);
+            orow[x * 4 + 3] = to_byte(a);
+        }
+    }
+
+done:
+    if (in && in != src) SDL_DestroySurface(in);
+    free(xw); free(yw); free(xfirst); free(yfirst); free(tmp);
+    return out;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <SDL3/SDL.h>
+
+typedef enum {
+    RESAMPLE_NEAREST,
+    RESAMPLE_LINEAR,
+    RESAMPLE_LANCZOS
+} ResampleFilter;
+
+/**
+ * @brief Parses a filter name ("nearest", "linear" or "lanczos").
+ */
+bool parse_resample_filter(const char *name, ResampleFilter *filter);
+
+/**
+ * @brief Returns the name of a filter.
+ */
+const char *resample_filter_name(ResampleFilter filter);
+
+/**
+ * @brief Resizes a surface with a separable filter, into a new RGBA32 surface.
+ *
+ * When shrinking, the kernel is widened by the reduction factor so that every
+ * source pixel contributes (no aliasing). Colours are filtered with
+ * premultiplied alpha. Thread-safe: it only touches the surfaces it is given.
+ */
+SDL_Surface *resample_surface(SDL_Surface *src, int dst_w, int dst_h, ResampleFilter filter);
+
+#endif // RESAMPLE_H
@@ -8,94 +8,362 @@
  */
 
 #include "resources.h"
+#include "memstats.h"
+#include "csv_parser.h"
+#include "bundle.h"
+#include "compiled_schedule.h"
+#include "mapped_file.h"
 #include <SDL3_image/SDL_image.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static CacheEntry* find_in_cache(CacheEntry *head, StimType type, const char *path) {
-    CacheEntry *curr = head;
-    while (curr) {
-        if (curr->type == type && strcmp(curr->file_path, path) == 0) return curr;
-        curr = curr->next;
+#define MAX_LOADER_THREADS 4
+
+struct ResourceLoader {
+    char          csv_file[1024];
+    char          base_path[1024];
+    TextEngine   *te;
+    SDL_Color     text_color;
+    PrescaleOptions prescale;
+    SDL_Thread   *thread;
+    SDL_Semaphore *parsed;      /* Signaled once the schedule is read (or failed to) */
+    Experiment   *exp;
+    Resource     *res;
+    CacheEntry   *cache;
+    CacheEntry  **entries;
+    SDL_AtomicInt num_entries;
+    SDL_AtomicInt next_entry;
+    SDL_AtomicInt done_entries;
+    SDL_AtomicInt finished;
+    SDL_AtomicInt cancel;
+};
+
+/* Open-addressing set of cache entries keyed by (type, interned content). */
+typedef struct {
+    CacheEntry **slots;
+    size_t       mask;
+} EntryIndex;
+
+static size_t entry_slot(const EntryIndex *idx, StimType type, StrId content, const Experiment *exp) {
+    size_t i = ((size_t)content * 2654435761u + (size_t)type) & idx->mask;
+    while (idx->slots[i]) {
+        const CacheEntry *e = idx->slots[i];
+        if (e->type == type && exp->stimuli[e->first_row].content == content) break;
+        i = (i + 1) & idx->mask;
     }
-    return NULL;
+    return i;
 }
 
-Resource *load_resources(SDL_Renderer *renderer, const Experiment *exp, TTF_Font *font, SDL_Color text_color, const char *base_path, CacheEntry **cache_out) {
-    *cache_out = NULL;
-    Resource *res = calloc(exp->count, sizeof(Resource));
-    if (!res) return NULL;
+Experiment *load_experiment(const char *path) {
+    if (is_bundle_file(path)) return bundle_load_experiment(path);
+    if (is_compiled_schedule(path)) return load_compiled_schedule(path);
+    return parse_csv(path);
+}
 
-    SDL_AudioSpec target_spec = { SDL_AUDIO_S16, 2, 44100 };
+Resource *prepare_resources(const Experiment *exp, SDL_Color text_color, CacheEntry **cache_out, CacheEntry ***entries_out, int *num_entries) {
+    *cache_out = NULL; *entries_out = NULL; *num_entries = 0;
+    Resource *res = calloc(exp->count, sizeof(Resource));
+    CacheEntry **entries = calloc(exp->count > 0 ? exp->count : 1, sizeof(CacheEntry *));
+    /* Entries by the asset id resolved at compile time (compiled schedules and bundles) */
+    CacheEntry **by_asset = calloc(exp->count > 0 ? exp->count : 1, sizeof(CacheEntry *));
+    EntryIndex idx = { NULL, 1 };
+    while (idx.mask + 1 < (size_t)exp->count * 2) idx.mask = idx.mask * 2 + 1;
+    idx.slots = calloc(idx.mask + 1, sizeof(CacheEntry *));
+    if (!res || !entries || !by_asset || !idx.slots) { free(res); free(entries); free(by_asset); free(idx.slots); return NULL; }
 
+    int n = 0;
     for (int i = 0; i < exp->count; i++) {
         const Stimulus *s = &exp->stimuli[i];
-        CacheEntry *entry = find_in_cache(*cache_out, s->type, s->file_path);
-
+        bool resolved = s->asset >= 0 && s->asset < exp->count;
+        size_t slot = 0;
+        CacheEntry *entry;
+        if (resolved) entry = by_asset[s->asset];
+        else entry = idx.slots[slot = entry_slot(&idx, s->type, s->content, exp)];
+        res[i].color = s->color.a ? s->color : text_color;
         if (entry) {
-            res[i].texture = entry->texture; res[i].w = entry->w; res[i].h = entry->h; res[i].sound = entry->sound;
+            res[i].entry = entry; entry->uses++;
             continue;
         }
-
         entry = calloc(1, sizeof(CacheEntry));
-        entry->type = s->type; strncpy(entry->file_path, s->file_path, 255);
-
-        char full_path[1024]; snprintf(full_path, 1024, "%s%s", base_path, s->file_path);
-
-        if (s->type == STIM_IMAGE) {
-            entry->texture = IMG_LoadTexture(renderer, full_path);
-            if (entry->texture) SDL_GetTextureSize(entry->texture, &entry->w, &entry->h);
-            else SDL_Log("Failed to load image: %s", full_path);
-        } else if (s->type == STIM_SOUND) {
-            SDL_AudioSpec src_spec;
-            Uint8 *src_data;
-            Uint32 src_len;
-            if (SDL_LoadWAV(full_path, &src_spec, &src_data, &src_len)) {
-                if (src_spec.format == target_spec.format && src_spec.channels == target_spec.channels && src_spec.freq == target_spec.freq) {
-                    entry->sound.spec = src_spec;
-                    entry->sound.data = src_data;
-                    entry->sound.len = src_len;
-                } else {
-                    /* Convert to target format */
-                    Uint8 *dst_data;
-                    int dst_len;
-                    if (SDL_ConvertAudioSamples(&src_spec, src_data, src_len, &target_spec, &dst_data, &dst_len)) {
-                        entry->sound.spec = target_spec;
-                        entry->sound.data = dst_data;
-                        entry->sound.len = (Uint32)dst_len;
-                        SDL_free(src_data);
-                    } else {
-                        SDL_Log("Failed to convert sound %s: %s", full_path, SDL_GetError());
-                        entry->sound.data = src_data; /* Fallback to original */
-                        entry->sound.spec = src_spec;
-                        entry->sound.len = src_len;
-                    }
-                }
-            } else {
-                SDL_Log("Failed to load sound: %s", full_path);
-            }
-        } else if (s->type == STIM_TEXT && font) {
-            SDL_Surface *surf = TTF_RenderText_Blended(font, s->file_path, 0, text_color);
-            if (surf) {
-                entry->texture = SDL_CreateTextureFromSurface(renderer, surf);
-                entry->w = (float)surf->w; entry->h = (float)surf->h;
-                SDL_DestroySurface(surf);
-            }
+        if (!entry) continue;
+        entry->type = s->type; entry->file_path = stimulus_content(exp, s);
+        entry->id = n; entry->first_row = i; entry->uses = 1;
+        res[i].entry = entry;
+        entry->next = *cache_out; *cache_out = entry;
+        entries[n++] = entry;
+        if (resolved) by_asset[s->asset] = entry;
+        else idx.slots[slot] = entry;
+    }
+    free(by_asset);
+    free(idx.slots);
+    *entries_out = entries; *num_entries = n;
+    return res;
+}
+
+bool decode_sound(const char *full_path, SoundResource *sound, size_t *decode_peak) {
+    SDL_AudioSpec target_spec = { SDL_AUDIO_S16, 2, 44100 };
+    SDL_AudioSpec src_spec;
+    Uint8 *src_data;
+    Uint32 src_len;
+    if (!SDL_LoadWAV(full_path, &src_spec, &src_data, &src_len)) {
+        SDL_Log("Failed to load sound: %s", full_path);
+        return false;
+    }
+    *decode_peak = src_len;
+    if (src_spec.format == target_spec.format && src_spec.channels == target_spec.channels && src_spec.freq == target_spec.freq) {
+        sound->spec = src_spec;
+        sound->data = src_data;
+        sound->len = src_len;
+    } else {
+        /* Convert to target format */
+        Uint8 *dst_data;
+        int dst_len;
+        if (SDL_ConvertAudioSamples(&src_spec, src_data, src_len, &target_spec, &dst_data, &dst_len)) {
+            sound->spec = target_spec;
+            sound->data = dst_data;
+            sound->len = (Uint32)dst_len;
+            *decode_peak = (size_t)src_len + (size_t)dst_len;
+            SDL_free(src_data);
+        } else {
+            SDL_Log("Failed to convert sound %s: %s", full_path, SDL_GetError());
+            sound->data = src_data; /* Fallback to original */
+            sound->spec = src_spec;
+            sound->len = src_len;
         }
+    }
+    return true;
+}
 
-        res[i].texture = entry->texture; res[i].w = entry->w; res[i].h = entry->h; res[i].sound = entry->sound;
-        entry->next = *cache_out; *cache_out = entry;
+static void prescale_entry(CacheEntry *entry, const PrescaleOptions *prescale) {
+    int dw = (int)SDL_roundf(entry->w * prescale->scale), dh = (int)SDL_roundf(entry->h * prescale->scale);
+    if (dw < 1) dw = 1;
+    if (dh < 1) dh = 1;
+    SDL_Surface *scaled = resample_surface(entry->surface, dw, dh, prescale->filter);
+    if (!scaled) {
+        SDL_Log("Failed to resample image %s, it will be scaled by the GPU", entry->file_path);
+        return;
+    }
+    entry->mem.decode_peak += (size_t)scaled->pitch * scaled->h;
+    SDL_DestroySurface(entry->surface);
+    entry->surface = scaled;
+    entry->w = dw * prescale->pixel_size; entry->h = dh * prescale->pixel_size;
+    entry->prescaled = true;
+}
+
+void decode_resource(CacheEntry *entry, const char *base_path, const PrescaleOptions *prescale, const MappedFile *bundle) {
+    if (bundle) {
+        if (!bundle_get_asset(bundle, entry)) SDL_Log("Missing asset in bundle: %s", entry->file_path);
+    } else {
+        char full_path[1024]; snprintf(full_path, 1024, "%s%s", base_path, entry->file_path);
+        if (entry->type == STIM_IMAGE) {
+            entry->surface = IMG_Load(full_path);
+            if (entry->surface) {
+                entry->mem.decode_peak = (size_t)entry->surface->pitch * entry->surface->h;
+                entry->w = (float)entry->surface->w; entry->h = (float)entry->surface->h;
+            } else SDL_Log("Failed to load image: %s", full_path);
+        } else if (entry->type == STIM_SOUND) {
+            if (decode_sound(full_path, &entry->sound, &entry->mem.decode_peak)) entry->mem.ram_bytes = entry->sound.len;
+        }
+    }
+    if (entry->surface && prescale && prescale->scale > 0.0f) prescale_entry(entry, prescale);
+}
+
+/* Lays out a TEXT entry. The font is not thread-safe: one thread at a time. */
+static void layout_entry(CacheEntry *entry, TextEngine *te) {
+    if (entry->type != STIM_TEXT || !te) return;
+    entry->text = text_engine_layout(te, entry->file_path);
+    if (entry->text) {
+        entry->w = entry->text->w; entry->h = entry->text->h;
+        entry->mem.ram_bytes = text_engine_layout_bytes(entry->text);
+    }
+}
+
+static void log_text_stats(const TextEngine *te, Uint64 text_ns) {
+    TextEngineStats ts; text_engine_get_stats(te, &ts);
+    if (ts.strings > 0) {
+        SDL_Log("Text engine: %d strings, %d glyphs on %d atlas page(s), %.2f MB (%.2f MB as one texture per string), laid out in %.1f ms",
+                ts.strings, ts.glyphs, ts.pages, (double)ts.atlas_bytes / 1048576.0, (double)ts.naive_bytes / 1048576.0, (double)text_ns / 1e6);
+        /* Estimate: per-string textures rasterize every glyph of every string, at the measured cost per glyph */
+        if (ts.glyphs > 0 && ts.glyph_uses > ts.glyphs) {
+            double saved_ms = (double)ts.raster_ns / ts.glyphs * (ts.glyph_uses - ts.glyphs) / 1e6;
+            SDL_Log("Text engine: %d glyphs rasterized instead of %d, about %.1f ms of startup saved", ts.glyphs, ts.glyph_uses, saved_ms);
+        }
+    }
+}
+
+/* Creates the textures of decoded entries and copies every entry into its rows. Render thread only. */
+static void upload_resources(SDL_Renderer *renderer, Resource *res, int count, CacheEntry *cache, TextEngine *te, ResampleFilter filter) {
+    for (CacheEntry *entry = cache; entry; entry = entry->next) {
+        if (!entry->surface) continue;
+        entry->texture = SDL_CreateTextureFromSurface(renderer, entry->surface);
+        if (entry->texture) {
+            entry->mem.gpu_bytes = texture_footprint(entry->texture, &entry->mem.format, &entry->mem.pitch);
+            /* A prescaled texture is blitted 1:1, so sampling must not blend neighbours */
+            if (entry->prescaled || filter == RESAMPLE_NEAREST) SDL_SetTextureScaleMode(entry->texture, SDL_SCALEMODE_NEAREST);
+        } else SDL_Log("Failed to create texture for %s: %s", entry->file_path, SDL_GetError());
+        SDL_DestroySurface(entry->surface);
+        entry->surface = NULL;
+    }
+    if (te) text_engine_upload(te, renderer);
+
+    for (int i = 0; i < count; i++) {
+        CacheEntry *entry = res[i].entry;
+        if (!entry) continue;
+        res[i].texture = entry->texture; res[i].text = entry->text; res[i].w = entry->w; res[i].h = entry->h; res[i].sound = entry->sound;
+        res[i].prescaled = entry->prescaled;
     }
+}
+
+Resource *load_resources(SDL_Renderer *renderer, const Experiment *exp, TextEngine *te, SDL_Color text_color, const char *base_path, CacheEntry **cache_out) {
+    CacheEntry **entries;
+    int n;
+    Resource *res = prepare_resources(exp, text_color, cache_out, &entries, &n);
+    if (!res) return NULL;
+
+    Uint64 text_ns = 0;
+    for (int i = 0; i < n; i++) {
+        if (entries[i]->type == STIM_TEXT) {
+            Uint64 t0 = SDL_GetTicksNS();
+            layout_entry(entries[i], te);
+            text_ns += SDL_GetTicksNS() - t0;
+        } else {
+            decode_resource(entries[i], base_path, NULL, exp->bundle);
+        }
+    }
+    free(entries);
+    log_text_stats(te, text_ns);
+    upload_resources(renderer, res, exp->count, *cache_out, te, RESAMPLE_LINEAR);
     return res;
 }
 
+/* ─── Background loader ─── */
+
+static void run_decode_queue(ResourceLoader *ld) {
+    int n = SDL_GetAtomicInt(&ld->num_entries);
+    while (!SDL_GetAtomicInt(&ld->cancel)) {
+        int i = SDL_AddAtomicInt(&ld->next_entry, 1);
+        if (i >= n) break;
+        if (ld->entries[i]->type == STIM_TEXT) continue;
+        decode_resource(ld->entries[i], ld->base_path, &ld->prescale, ld->exp->bundle);
+        SDL_AddAtomicInt(&ld->done_entries, 1);
+    }
+}
+
+static int SDLCALL decode_worker(void *data) {
+    run_decode_queue((ResourceLoader *)data);
+    return 0;
+}
+
+static int SDLCALL loader_thread(void *data) {
+    ResourceLoader *ld = (ResourceLoader *)data;
+    ld->exp = load_experiment(ld->csv_file);
+    SDL_SignalSemaphore(ld->parsed);
+    if (!ld->exp) {
+        SDL_SetAtomicInt(&ld->finished, 1);
+        return 1;
+    }
+
+    int n;
+    ld->res = prepare_resources(ld->exp, ld->text_color, &ld->cache, &ld->entries, &n);
+    SDL_SetAtomicInt(&ld->num_entries, n);
+
+    /* Images and sounds are decoded in parallel; this thread lays out the text meanwhile */
+    SDL_Thread *workers[MAX_LOADER_THREADS];
+    int num_workers = SDL_GetNumLogicalCPUCores() - 1;
+    if (num_workers > MAX_LOADER_THREADS) num_workers = MAX_LOADER_THREADS;
+    int started = 0;
+    for (int w = 0; w < num_workers; w++) {
+        workers[started] = SDL_CreateThread(decode_worker, "expe3000-decode", ld);
+        if (workers[started]) started++;
+    }
+
+    Uint64 text_ns = 0;
+    for (int i = 0; i < n && !SDL_GetAtomicInt(&ld->cancel); i++) {
+        if (ld->entries[i]->type != STIM_TEXT) continue;
+        Uint64 t0 = SDL_GetTicksNS();
+        layout_entry(ld->entries[i], ld->te);
+        text_ns += SDL_GetTicksNS() - t0;
+        SDL_AddAtomicInt(&ld->done_entries, 1);
+    }
+    log_text_stats(ld->te, text_ns);
+
+    run_decode_queue(ld);
+    for (int w = 0; w < started; w++) SDL_WaitThread(workers[w], NULL);
+
+    SDL_SetAtomicInt(&ld->finished, 1);
+    return 0;
+}
+
+ResourceLoader *resource_loader_start(const char *csv_file, TextEngine *te, SDL_Color text_color, const char *base_path, const PrescaleOptions *prescale) {
+    ResourceLoader *ld = calloc(1, sizeof(ResourceLoader));
+    if (!ld) return NULL;
+    strncpy(ld->csv_file, csv_file, sizeof(ld->csv_file) - 1);
+    strncpy(ld->base_path, base_path, sizeof(ld->base_path) - 1);
+    ld->te = te;
+    ld->text_color = text_color;
+    if (prescale) ld->prescale = *prescale;
+    else ld->prescale.filter = RESAMPLE_LINEAR;
+    ld->parsed = SDL_CreateSemaphore(0);
+    if (!ld->parsed) {
+        SDL_Log("Error: cannot start the resource loader: %s", SDL_GetError());
+        free(ld);
+        return NULL;
+    }
+    ld->thread = SDL_CreateThread(loader_thread, "expe3000-loader", ld);
+    if (!ld->thread) {
+        /* No threads: load synchronously so that finish() still works */
+        loader_thread(ld);
+    }
+    return ld;
+}
+
+bool resource_loader_wait_parsed(ResourceLoader *ld) {
+    SDL_WaitSemaphore(ld->parsed);
+    SDL_SignalSemaphore(ld->parsed);    /* Later calls return at once */
+    return ld->exp != NULL;
+}
+
+float resource_loader_progress(ResourceLoader *ld) {
+    if (SDL_GetAtomicInt(&ld->finished)) return 1.0f;
+    int n = SDL_GetAtomicInt(&ld->num_entries);
+    if (n == 0) return 0.0f;
+    return (float)SDL_GetAtomicInt(&ld->done_entries) / (float)n;
+}
+
+bool resource_loader_done(ResourceLoader *ld) {
+    return SDL_GetAtomicInt(&ld->finished) != 0;
+}
+
+Resource *resource_loader_finish(ResourceLoader *ld, SDL_Renderer *renderer, Experiment **exp_out, CacheEntry **cache_out) {
+    if (ld->thread) SDL_WaitThread(ld->thread, NULL);
+    Resource *res = ld->res;
+    *exp_out = ld->exp;
+    *cache_out = ld->cache;
+    if (ld->exp && res) upload_resources(renderer, res, ld->exp->count, ld->cache, ld->te, ld->prescale.filter);
+    SDL_DestroySemaphore(ld->parsed);
+    free(ld->entries);
+    free(ld);
+    return res;
+}
+
+void resource_loader_cancel(ResourceLoader *ld) {
+    SDL_SetAtomicInt(&ld->cancel, 1);
+    if (ld->thread) SDL_WaitThread(ld->thread, NULL);
+    free_resources(ld->res, ld->cache);
+    free_experiment(ld->exp);
+    SDL_DestroySemaphore(ld->parsed);
+    free(ld->entries);
+    free(ld);
+}
+
 void free_resources(Resource *resources, CacheEntry *cache) {
     CacheEntry *curr = cache;
     while (curr) {
         CacheEntry *next = curr->next;
         if (curr->texture) SDL_DestroyTexture(curr->texture);
-        if (curr->sound.data) SDL_free(curr->sound.data);
+        if (curr->surface) SDL_DestroySurface(curr->surface);
+        if (curr->sound.data && !curr->sound.borrowed) SDL_free(curr->sound.data);
         free(curr); curr = next;
     }
     free(resources);
@@ -14,26 +14,124 @@
 #include <SDL3_ttf/SDL_ttf.h>
 #include "stimuli.h"
 #include "audio.h"
+#include "text_engine.h"
+#include "resample.h"
 
 typedef struct {
     SDL_Texture  *texture;
+    const TextLayout *text;
+    SDL_Color     color;
     float         w, h;
     SoundResource sound;
+    bool          prescaled;    /* Texture already has its on-screen size: draw 1:1 */
+    struct CacheEntry *entry;   /* Shared cache entry this row resolved to */
 } Resource;
 
+typedef struct {
+    float          scale;       /* Output pixels per source pixel (scale factor x letterbox), 0: off */
+    float          pixel_size;  /* Logical units per output pixel (1 / letterbox) */
+    ResampleFilter filter;
+} PrescaleOptions;
+
+typedef struct {
+    size_t gpu_bytes;       /* Texture memory, from the real format and an estimated pitch */
+    size_t ram_bytes;       /* Resident CPU memory (PCM data, text layout) */
+    size_t decode_peak;     /* Transient CPU memory needed while decoding */
+    SDL_PixelFormat format;
+    int    pitch;           /* Estimated */
+} ResourceFootprint;
+
 typedef struct CacheEntry {
     StimType type;
-    char     file_path[256];
+    const char *file_path;      /* Interned in the experiment string table */
     SDL_Texture *texture;
+    SDL_Surface *surface;       /* Decoded pixels waiting to be uploaded */
+    const TextLayout *text;
     float w, h;
     SoundResource sound;
+    bool     prescaled;
+    ResourceFootprint mem;
+    int      id;                /* Asset id, in order of first appearance */
+    int      first_row;         /* First schedule row using this entry */
+    int      uses;              /* Number of rows sharing it */
     struct CacheEntry *next;
 } CacheEntry;
 
+/**
+ * @brief Reads a schedule: a CSV file, a compiled schedule or a bundle.
+ */
+Experiment *load_experiment(const char *path);
+
+/**
+ * @brief Maps every row to a shared cache entry, without loading anything.
+ *
+ * @param entries_out Receives the distinct entries, indexed by their id (free() it).
+ */
+Resource *prepare_resources(const Experiment *exp, SDL_Color text_color, CacheEntry **cache_out, CacheEntry ***entries_out, int *num_entries);
+
+/**
+ * @brief Loads a WAV file and converts it to the mixer format (S16, stereo, 44.1 kHz).
+ */
+bool decode_sound(const char *full_path, SoundResource *sound, size_t *decode_peak);
+
+/**
+ * @brief Decodes an image or a sound entry into CPU memory. Thread-safe.
+ *
+ * With a bundle, pixels and samples are read in place from the mapping.
+ * prescale may be NULL.
+ */
+void decode_resource(CacheEntry *entry, const char *base_path, const PrescaleOptions *prescale, const struct MappedFile *bundle);
+
 /**
  * @brief Loads all resources defined in an experiment.
+ *
+ * TEXT stimuli are laid out with the text engine (if any) instead of being
+ * rendered to individual textures.
+ */
+Resource *load_resources(SDL_Renderer *renderer, const Experiment *exp, TextEngine *te, SDL_Color text_color, const char *base_path, CacheEntry **cache_out);
+
+typedef struct ResourceLoader ResourceLoader;
+
+/**
+ * @brief Parses the CSV file (or opens the bundle) and decodes its resources on background threads.
+ *
+ * Images and sounds are decoded by a small pool of worker threads while the
+ * loader thread lays out the text. If prescale is given (and its scale is
+ * not 0), images are also resampled to their final on-screen size by the
+ * workers. Nothing touches the renderer until resource_loader_finish().
+ * Returns NULL if the loader cannot be created.
+ */
+ResourceLoader *resource_loader_start(const char *csv_file, TextEngine *te, SDL_Color text_color, const char *base_path, const PrescaleOptions *prescale);
+
+/**
+ * @brief Waits until the schedule has been read, not for its resources.
+ *
+ * @return false if it could not be parsed (the errors are already reported).
+ */
+bool resource_loader_wait_parsed(ResourceLoader *ld);
+
+/**
+ * @brief Returns the fraction of resources decoded so far (0 to 1).
+ */
+float resource_loader_progress(ResourceLoader *ld);
+
+/**
+ * @brief Returns true once parsing and decoding are complete.
+ */
+bool resource_loader_done(ResourceLoader *ld);
+
+/**
+ * @brief Waits for the loader, uploads the textures and frees the loader.
+ *
+ * Must be called on the render thread. Returns NULL (and *exp_out == NULL)
+ * if the CSV file could not be parsed.
+ */
+Resource *resource_loader_finish(ResourceLoader *ld, SDL_Renderer *renderer, Experiment **exp_out, CacheEntry **cache_out);
+
+/**
+ * @brief Stops the loader and frees everything it loaded.
  */
-Resource *load_resources(SDL_Renderer *renderer, const Experiment *exp, TTF_Font *font, SDL_Color text_color, const char *base_path, CacheEntry **cache_out);
+void resource_loader_cancel(ResourceLoader *ld);
 
 /**
  * @brief Frees all allocated resources and the cache.
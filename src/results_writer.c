@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "results_writer.h"
+#include "binary_log.h"
+#include "mapped_file.h"
+#include "timing_report.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define WRITER_BATCH       256
+#define WRITER_PERIOD_MS   100
+#define WRITER_SYNC_MS     1000
+
+struct ResultsWriter {
+    FILE *file;
+    EventLog *log;
+    TimingReport *timing;   /* Fed with every event written, or NULL */
+    SDL_Thread *thread;
+    SDL_AtomicInt quit;
+    int written;            /* Entries already written */
+    bool binary;
+    Uint64 records_offset;  /* Binary log: offset of the first record */
+    BinaryLogStrings strings;   /* Binary log: strings already written */
+    bool failed;
+    EventLogEntry batch[WRITER_BATCH];
+};
+
+static void sync_file(ResultsWriter *rw) {
+    if (fflush(rw->file) != 0) rw->failed = true;
+#ifdef _WIN32
+    _commit(_fileno(rw->file));
+#else
+    fsync(fileno(rw->file));
+#endif
+}
+
+static void write_published(ResultsWriter *rw) {
+    EventLog *log = rw->log;
+    int end = SDL_GetAtomicInt(&log->published);
+    while (rw->written < end) {
+        int n = end - rw->written;
+        if (n > WRITER_BATCH) n = WRITER_BATCH;
+        /* The entries may be reallocated if the log overflows: copy them under the lock */
+        SDL_LockMutex(log->lock);
+        for (int i = 0; i < n; i++) rw->batch[i] = *event_log_entry(log, rw->written + i);
+        SDL_UnlockMutex(log->lock);
+        /* Their slots can now take new events */
+        SDL_SetAtomicInt(&log->written, rw->written + n);
+        if (rw->timing) timing_report_add(rw->timing, rw->batch, n);
+        if (rw->binary) {
+            if (!binary_log_write(rw->file, &rw->strings, log->strings, rw->batch, n)) rw->failed = true;
+        } else for (int i = 0; i < n; i++) {
+            const EventLogEntry *e = &rw->batch[i];
+            if (fprintf(rw->file, "%" PRIu64 ",%" PRIu64 ",%s,%s\n", e->intended_ms, e->timestamp_ms,
+                        strtab_get(log->strings, e->type), strtab_get(log->strings, e->label)) < 0) rw->failed = true;
+        }
+        rw->written += n;
+    }
+}
+
+static int SDLCALL writer_thread(void *data) {
+    ResultsWriter *rw = (ResultsWriter *)data;
+    SDL_SetCurrentThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    Uint64 last_sync = SDL_GetTicks();
+    while (!SDL_GetAtomicInt(&rw->quit)) {
+        SDL_Delay(WRITER_PERIOD_MS);
+        int before = rw->written;
+        write_published(rw);
+        if (rw->written != before && SDL_GetTicks() - last_sync >= WRITER_SYNC_MS) {
+            sync_file(rw);
+            last_sync = SDL_GetTicks();
+        }
+    }
+    return 0;
+}
+
+ResultsWriter *results_writer_start(FILE *file, EventLog *log, bool binary, TimingReport *timing) {
+    ResultsWriter *rw = calloc(1, sizeof(ResultsWriter));
+    if (!rw) return NULL;
+    rw->file = file;
+    rw->log = log;
+    rw->timing = timing;
+    rw->binary = binary;
+    if (binary) {
+        Sint64 pos;
+        if (!binary_log_end_header(file) || (pos = file_tell(file)) < 0) rw->failed = true;
+        else rw->records_offset = (Uint64)pos;
+    }
+    sync_file(rw);      /* The header is on disk before the run starts */
+    rw->thread = SDL_CreateThread(writer_thread, "expe3000-results", rw);
+    if (!rw->thread) SDL_Log("Cannot start the results writer thread (%s): results will be written at the end", SDL_GetError());
+    return rw;
+}
+
+void results_writer_drain(ResultsWriter *rw) {
+    SDL_SetAtomicInt(&rw->quit, 1);
+    if (rw->thread) SDL_WaitThread(rw->thread, NULL);
+    rw->thread = NULL;
+    write_published(rw);
+}
+
+bool results_writer_finish(ResultsWriter *rw, const char *trailer) {
+    results_writer_drain(rw);
+    if (rw->binary) {
+        if (!binary_log_finish(rw->file, rw->records_offset, &rw->strings, (Uint64)rw->written, trailer)) rw->failed = true;
+    } else if (trailer && fputs(trailer, rw->file) < 0) rw->failed = true;
+    sync_file(rw);
+    if (fclose(rw->file) != 0) rw->failed = true;
+    bool ok = !rw->failed;
+    free(rw);
+    return ok;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef RESULTS_WRITER_H
+#define RESULTS_WRITER_H
+
+#include <stdio.h>
+#include "experiment.h"
+#include "timing_report.h"
+
+/*
+ * Background writer of the results file.
+ *
+ * The header is written before the run; a low-priority thread then appends
+ * the published events of the log in batches, and flushes and syncs the
+ * file to disk every second, so that a crash loses at most the last couple
+ * of seconds. The run loop itself never touches the file. Once copied
+ * out, the events are added to the timing report and their slots in the
+ * log are given back.
+ */
+
+typedef struct ResultsWriter ResultsWriter;
+
+/**
+ * @brief Starts appending the events of log to an open file (now owned by the writer).
+ *
+ * With binary, the file must have been started with binary_log_begin() and
+ * the events are written as binary log records. timing, started with
+ * timing_report_init(), may be NULL.
+ */
+ResultsWriter *results_writer_start(FILE *file, EventLog *log, bool binary, TimingReport *timing);
+
+/**
+ * @brief Stops the thread and writes the remaining events, completing the timing report.
+ *
+ * Call after the run, once everything has been committed to the log.
+ */
+void results_writer_drain(ResultsWriter *rw);
+
+/**
+ * @brief Writes the remaining events and the trailer, syncs and closes the file.
+ *
+ * Drains the writer first if results_writer_drain() was not called.
+ * @return false if a write failed.
+ */
+bool results_writer_finish(ResultsWriter *rw, const char *trailer);
+
+#endif // RESULTS_WRITER_H
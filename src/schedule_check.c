@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "schedule_check.h"
+#include "resources.h"
+#include "csv_parser.h"
+#include "audio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define MAX_REPORTED_OVERLAPS 20
+
+/* Per-asset facts gathered by decoding each distinct stimulus once */
+typedef struct {
+    bool   loaded;
+    double sound_ms;
+    size_t gpu_bytes;
+    size_t ram_bytes;
+    size_t decode_peak;
+} AssetProbe;
+
+/*
+ * Frame model of run_experiment(): a stimulus is presented on the first
+ * frame whose start, plus half a frame of look-ahead, reaches its
+ * timestamp, and removed on the first frame at or after onset + duration.
+ */
+static Uint64 onset_frame(Uint64 ts, double frame_ms) {
+    double lookahead = (double)((Uint64)frame_ms / 2);
+    if ((double)ts <= lookahead) return 0;
+    return (Uint64)SDL_ceil(((double)ts - lookahead) / frame_ms - 1e-9);
+}
+
+static Uint64 frames_for(Uint64 duration, double frame_ms) {
+    Uint64 n = (Uint64)SDL_ceil((double)duration / frame_ms - 1e-9);
+    return n > 0 ? n : 1;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Maximum number of [start, end) intervals alive at the same time. */
+static int peak_overlap(double *starts, double *ends, int n) {
+    qsort(starts, (size_t)n, sizeof(double), compare_double);
+    qsort(ends, (size_t)n, sizeof(double), compare_double);
+    int active = 0, peak = 0, j = 0;
+    for (int i = 0; i < n; i++) {
+        while (j < n && ends[j] <= starts[i]) { j++; active--; }
+        if (++active > peak) peak = active;
+    }
+    return peak;
+}
+
+int check_schedule(const Config *cfg) {
+    Experiment *exp = load_experiment(cfg->csv_file);
+    if (!exp) return 1;
+
+    char base_path[1024] = "";
+    if (cfg->stimuli_dir[0]) {
+        size_t len = strlen(cfg->stimuli_dir);
+        bool has_sep = cfg->stimuli_dir[len-1] == '/' || cfg->stimuli_dir[len-1] == '\\';
+        snprintf(base_path, sizeof(base_path), "%s%s", cfg->stimuli_dir, has_sep ? "" : "/");
+    }
+
+    CacheEntry *cache, **entries;
+    int n;
+    Resource *res = prepare_resources(exp, cfg->text_color, &cache, &entries, &n);
+    AssetProbe *probes = calloc(n > 0 ? n : 1, sizeof(AssetProbe));
+    double *starts = malloc((exp->count > 0 ? exp->count : 1) * sizeof(double));
+    double *ends = malloc((exp->count > 0 ? exp->count : 1) * sizeof(double));
+    if (!res || !probes || !starts || !ends) {
+        free(starts); free(ends); free(probes); free(entries);
+        free_resources(res, cache);
+        free_experiment(exp);
+        return 1;
+    }
+
+    /* Probe each distinct image and sound, keeping only its size */
+    int missing = 0, texts = 0;
+    size_t peak_decode = 0;
+    for (int i = 0; i < n; i++) {
+        CacheEntry *e = entries[i];
+        AssetProbe *p = &probes[e->id];
+        if (e->type == STIM_TEXT) { p->loaded = true; texts++; continue; }
+        if (e->type != STIM_IMAGE && e->type != STIM_SOUND) continue;
+        decode_resource(e, base_path, NULL, exp->bundle);
+        if (e->surface) {
+            p->loaded = true;
+            p->gpu_bytes = (size_t)e->surface->w * e->surface->h * 4;
+            SDL_DestroySurface(e->surface); e->surface = NULL;
+        } else if (e->sound.data) {
+            p->loaded = true;
+            int frame_size = SDL_AUDIO_FRAMESIZE(e->sound.spec);
+            if (frame_size > 0 && e->sound.spec.freq > 0)
+                p->sound_ms = 1000.0 * e->sound.len / ((double)frame_size * e->sound.spec.freq);
+            p->ram_bytes = e->sound.len;
+            if (!e->sound.borrowed) SDL_free(e->sound.data);
+            e->sound.data = NULL;
+        } else {
+            fprintf(stderr, "Missing stimulus: %s%s\n", base_path, e->file_path);
+            missing++;
+        }
+        p->decode_peak = e->mem.decode_peak;
+        if (p->decode_peak > peak_decode) peak_decode = p->decode_peak;
+    }
+
+    /* Frame table */
+    double frame_ms = 1000.0 / cfg->refresh_rate;
+    double worst_onset = 0.0, worst_duration = 0.0;
+    int worst_onset_row = -1, worst_duration_row = -1;
+    int overlaps = 0, num_sounds = 0;
+    int last_visual = -1;
+
+    printf("row,timestamp_ms,duration_ms,type,onset_frame,offset_frame,onset_error_ms,duration_error_ms,content\n");
+    for (int i = 0; i < exp->count; i++) {
+        const Stimulus *s = &exp->stimuli[i];
+        const AssetProbe *p = res[i].entry ? &probes[res[i].entry->id] : NULL;
+        Uint64 on = onset_frame(s->timestamp_ms, frame_ms);
+        double onset_error = on * frame_ms - (double)s->timestamp_ms;
+        if (SDL_fabs(onset_error) > SDL_fabs(worst_onset)) { worst_onset = onset_error; worst_onset_row = i; }
+
+        if (s->type == STIM_IMAGE || s->type == STIM_TEXT) {
+            Uint64 off = on + frames_for(s->duration_ms, frame_ms);
+            double duration_error = (off - on) * frame_ms - (double)s->duration_ms;
+            if (SDL_fabs(duration_error) > SDL_fabs(worst_duration)) { worst_duration = duration_error; worst_duration_row = i; }
+            printf("%d,%" PRIu64 ",%" PRIu64 ",%s,%" PRIu64 ",%" PRIu64 ",%.2f,%.2f,%s\n", i + 1, s->timestamp_ms, s->duration_ms,
+                   s->type == STIM_IMAGE ? "IMAGE" : "TEXT", on, off, onset_error, duration_error, stimulus_content(exp, s));
+
+            if (last_visual >= 0) {
+                const Stimulus *prev = &exp->stimuli[last_visual];
+                if (prev->timestamp_ms + prev->duration_ms > s->timestamp_ms) {
+                    if (++overlaps <= MAX_REPORTED_OVERLAPS)
+                        fprintf(stderr, "Overlap: row %d (%s, until %" PRIu64 " ms) is still visible when row %d (%s) starts at %" PRIu64 " ms\n",
+                                last_visual + 1, stimulus_content(exp, prev), prev->timestamp_ms + prev->duration_ms, i + 1, stimulus_content(exp, s), s->timestamp_ms);
+                }
+            }
+            last_visual = i;
+        } else if (s->type == STIM_SOUND) {
+            printf("%d,%" PRIu64 ",%" PRIu64 ",SOUND,%" PRIu64 ",,%.2f,,%s\n", i + 1, s->timestamp_ms, s->duration_ms, on, onset_error, stimulus_content(exp, s));
+            if (p && p->loaded) {
+                starts[num_sounds] = (double)s->timestamp_ms;
+                ends[num_sounds] = (double)s->timestamp_ms + p->sound_ms;
+                num_sounds++;
+            }
+        }
+    }
+    int peak_sounds = peak_overlap(starts, ends, num_sounds);
+
+    size_t gpu_bytes = 0, ram_bytes = 0;
+    for (int i = 0; i < n; i++) { gpu_bytes += probes[i].gpu_bytes; ram_bytes += probes[i].ram_bytes; }
+    double total_mb = (gpu_bytes + ram_bytes) / (1024.0 * 1024.0);
+
+    bool frame_error_exceeded = cfg->max_frame_error_ms > 0.0f &&
+        (SDL_fabs(worst_onset) > cfg->max_frame_error_ms || SDL_fabs(worst_duration) > cfg->max_frame_error_ms);
+    bool budget_exceeded = cfg->memory_budget_mb > 0 && total_mb > cfg->memory_budget_mb;
+    bool overlaps_exceeded = cfg->max_overlaps >= 0 && overlaps > cfg->max_overlaps;
+
+    printf("# Refresh rate: %.2f Hz (%.3f ms per frame)\n", cfg->refresh_rate, frame_ms);
+    printf("# Worst onset error: %+.2f ms (row %d)\n", worst_onset, worst_onset_row + 1);
+    printf("# Worst duration error: %+.2f ms (row %d)\n", worst_duration, worst_duration_row + 1);
+    printf("# Visual overlaps: %d\n", overlaps);
+    printf("# Peak concurrent sounds: %d (mixer limit: %d)\n", peak_sounds, MAX_ACTIVE_SOUNDS);
+    printf("# Stimuli: %d events, %d distinct (%d texts), %d missing\n", exp->count, n, texts, missing);
+    printf("# Estimated memory: %.1f MB (textures %.1f MB, sounds %.1f MB), peak decode %.1f MB\n", total_mb,
+           gpu_bytes / (1024.0 * 1024.0), ram_bytes / (1024.0 * 1024.0), peak_decode / (1024.0 * 1024.0));
+
+    bool ok = missing == 0 && !overlaps_exceeded && peak_sounds <= MAX_ACTIVE_SOUNDS && !frame_error_exceeded && !budget_exceeded;
+    if (overlaps > MAX_REPORTED_OVERLAPS) fprintf(stderr, "... %d more overlaps\n", overlaps - MAX_REPORTED_OVERLAPS);
+    if (peak_sounds > MAX_ACTIVE_SOUNDS) fprintf(stderr, "Too many concurrent sounds: %d, the mixer plays at most %d\n", peak_sounds, MAX_ACTIVE_SOUNDS);
+    if (frame_error_exceeded) fprintf(stderr, "Frame quantization error exceeds %.2f ms\n", cfg->max_frame_error_ms);
+    if (budget_exceeded) fprintf(stderr, "Estimated memory exceeds the budget of %d MB\n", cfg->memory_budget_mb);
+    if (overlaps_exceeded) fprintf(stderr, "More than %d visual overlap(s)\n", cfg->max_overlaps);
+    printf("# Result: %s\n", ok ? "OK" : "FAILED");
+
+    free(starts); free(ends); free(probes); free(entries);
+    free_resources(res, cache);
+    free_experiment(exp);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef SCHEDULE_CHECK_H
+#define SCHEDULE_CHECK_H
+
+#include "config.h"
+
+/**
+ * @brief Analyzes the schedule offline (--check), without opening a window.
+ *
+ * Prints the predicted onset and offset frame of every row at
+ * cfg->refresh_rate, then a summary: worst frame quantization error, visual
+ * overlaps, peak number of concurrent sounds and estimated memory.
+ *
+ * @return The process exit code: 1 if the schedule cannot be loaded or a
+ *         threshold is exceeded, 0 otherwise.
+ */
+int check_schedule(const Config *cfg);
+
+#endif // SCHEDULE_CHECK_H
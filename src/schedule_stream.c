@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "schedule_stream.h"
+#include "csv_parser.h"
+#include "bundle.h"
+#include "compiled_schedule.h"
+#include "memstats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define STREAM_CHUNK_SIZE 65536
+
+typedef struct {
+    Stimulus   stim;
+    CacheEntry entry;       /* Decoded pixels or samples, then the texture */
+    Resource   res;
+} StreamRow;
+
+struct ScheduleStream {
+    char csv_file[1024];
+    char base_path[1024];
+    FILE *file;
+    SDL_Color text_color;
+    PrescaleOptions prescale;
+    StringTable *strings;
+    StreamRow *rows;            /* Ring: row i lives in rows[i % capacity] */
+    int capacity;
+    SDL_Thread *thread;
+    SDL_AtomicInt decoded;      /* Rows parsed and decoded by the reader */
+    SDL_AtomicInt released;     /* Rows given back by the render thread */
+    SDL_AtomicInt done;         /* Reader stopped (end of file or error) */
+    SDL_AtomicInt failed;
+    SDL_AtomicInt quit;
+    int uploaded;               /* Render thread only */
+    TextEngine *te;             /* Holds the layouts of the uploaded rows */
+};
+
+static void free_row(ScheduleStream *ss, StreamRow *r) {
+    if (r->entry.texture) SDL_DestroyTexture(r->entry.texture);
+    if (r->entry.text) text_engine_release(ss->te, r->entry.text);
+    if (r->entry.surface) SDL_DestroySurface(r->entry.surface);
+    if (r->entry.sound.data && !r->entry.sound.borrowed) SDL_free(r->entry.sound.data);
+    memset(r, 0, sizeof(*r));
+}
+
+/* Blocks until the slot of a row has been released; false if the stream is closing */
+static bool wait_for_slot(ScheduleStream *ss, int row) {
+    while (row - SDL_GetAtomicInt(&ss->released) >= ss->capacity) {
+        if (SDL_GetAtomicInt(&ss->quit)) return false;
+        SDL_Delay(1);
+    }
+    return !SDL_GetAtomicInt(&ss->quit);
+}
+
+static void decode_row(ScheduleStream *ss, StreamRow *r) {
+    r->entry.type = r->stim.type;
+    r->entry.file_path = strtab_get(ss->strings, r->stim.content);
+    r->entry.id = -1;
+    r->res.color = r->stim.color.a ? r->stim.color : ss->text_color;
+    if (r->stim.type == STIM_IMAGE || r->stim.type == STIM_SOUND) decode_resource(&r->entry, ss->base_path, &ss->prescale, NULL);
+}
+
+/* Reads the file in chunks; a line split across two chunks is moved to the
+   front of the buffer before the next read, and the buffer only grows for
+   a line longer than itself. */
+static int SDLCALL reader_thread(void *data) {
+    ScheduleStream *ss = (ScheduleStream *)data;
+    size_t cap = STREAM_CHUNK_SIZE, len = 0, pos = 0;
+    char *buf = malloc(cap);
+    bool eof = false, ok = buf != NULL;
+    int line_no = 0, row = 0;
+    Uint64 last_timestamp = 0;
+
+    while (ok && !SDL_GetAtomicInt(&ss->quit)) {
+        char *nl = memchr(buf + pos, '\n', len - pos);
+        if (!nl && !eof) {
+            memmove(buf, buf + pos, len - pos);
+            len -= pos; pos = 0;
+            if (len == cap) {
+                char *bigger = realloc(buf, cap * 2);
+                if (!bigger) { ok = false; break; }
+                buf = bigger; cap *= 2;
+            }
+            size_t n = fread(buf + len, 1, cap - len, ss->file);
+            if (n == 0) {
+                if (ferror(ss->file)) { fprintf(stderr, "Error reading '%s'\n", ss->csv_file); ok = false; }
+                eof = true;
+            }
+            len += n;
+            continue;
+        }
+        if (!nl && pos == len) break;
+
+        const char *line = buf + pos;
+        size_t line_len = nl ? (size_t)(nl - line) : len - pos;
+        pos += line_len + (nl ? 1 : 0);
+        line_no++;
+
+        if (!wait_for_slot(ss, row)) break;
+        StreamRow *r = &ss->rows[row % ss->capacity];
+        const char *error = NULL;
+        CsvLine kind = parse_csv_line(line, line_len, ss->strings, &r->stim, &error);
+        if (kind == CSV_SKIP) continue;
+        if (kind == CSV_ERROR) {
+            fprintf(stderr, "Error: %s line %d: %s.\n", ss->csv_file, line_no, error ? error : "out of memory");
+            ok = false;
+            break;
+        }
+        if (error) fprintf(stderr, "Warning: %s line %d: %s, using the default.\n", ss->csv_file, line_no, error);
+        if (row > 0 && r->stim.timestamp_ms < last_timestamp) {
+            fprintf(stderr, "Error: %s line %d has a timestamp (%" PRIu64 ") smaller than the previous one (%" PRIu64 "). The CSV file must be sorted by the first column.\n",
+                    ss->csv_file, line_no, r->stim.timestamp_ms, last_timestamp);
+            ok = false;
+            break;
+        }
+        last_timestamp = r->stim.timestamp_ms;
+        decode_row(ss, r);
+        SDL_SetAtomicInt(&ss->decoded, ++row);
+    }
+
+    free(buf);
+    if (!ok) SDL_SetAtomicInt(&ss->failed, 1);
+    SDL_SetAtomicInt(&ss->done, 1);
+    return ok ? 0 : 1;
+}
+
+ScheduleStream *stream_open(const char *csv_file, const char *base_path, SDL_Color text_color,
+                            const PrescaleOptions *prescale, int ahead) {
+    if (is_bundle_file(csv_file) || is_compiled_schedule(csv_file)) {
+        fprintf(stderr, "Error: --stream reads CSV schedules only, '%s' is a bundle or a compiled schedule\n", csv_file);
+        return NULL;
+    }
+    ScheduleStream *ss = calloc(1, sizeof(ScheduleStream));
+    if (!ss) return NULL;
+    strncpy(ss->csv_file, csv_file, sizeof(ss->csv_file) - 1);
+    strncpy(ss->base_path, base_path, sizeof(ss->base_path) - 1);
+    ss->text_color = text_color;
+    if (prescale) ss->prescale = *prescale;
+    else ss->prescale.filter = RESAMPLE_LINEAR;
+    ss->capacity = ahead > 1 ? ahead : 2;
+    ss->rows = calloc(ss->capacity, sizeof(StreamRow));
+    ss->strings = strtab_create();
+    ss->file = fopen(csv_file, "rb");
+    if (!ss->file) fprintf(stderr, "Error opening CSV file '%s'\n", csv_file);
+    if (!ss->rows || !ss->strings || !ss->file) {
+        stream_close(ss);
+        return NULL;
+    }
+    ss->thread = SDL_CreateThread(reader_thread, "expe3000-stream", ss);
+    if (!ss->thread) {
+        fprintf(stderr, "Error: cannot start the schedule reader: %s\n", SDL_GetError());
+        stream_close(ss);
+        return NULL;
+    }
+    return ss;
+}
+
+void stream_close(ScheduleStream *ss) {
+    if (!ss) return;
+    SDL_SetAtomicInt(&ss->quit, 1);
+    if (ss->thread) SDL_WaitThread(ss->thread, NULL);
+    if (ss->rows) {
+        int end = SDL_GetAtomicInt(&ss->decoded);
+        for (int row = SDL_GetAtomicInt(&ss->released); row < end; row++) free_row(ss, &ss->rows[row % ss->capacity]);
+        free(ss->rows);
+    }
+    if (ss->file) fclose(ss->file);
+    strtab_destroy(ss->strings);
+    free(ss);
+}
+
+int stream_upload(ScheduleStream *ss, SDL_Renderer *renderer, TextEngine *te, int max_rows, Uint64 budget_ns) {
+    int decoded = SDL_GetAtomicInt(&ss->decoded);
+    bool new_text = false;
+    Uint64 t0 = SDL_GetTicksNS();
+    for (int n = 0; n < max_rows && ss->uploaded < decoded; n++, ss->uploaded++) {
+        if (n > 0 && budget_ns && SDL_GetTicksNS() - t0 >= budget_ns) break;
+        StreamRow *r = &ss->rows[ss->uploaded % ss->capacity];
+        CacheEntry *e = &r->entry;
+        if (e->surface) {
+            e->texture = SDL_CreateTextureFromSurface(renderer, e->surface);
+            if (e->texture) {
+                if (e->prescaled || ss->prescale.filter == RESAMPLE_NEAREST) SDL_SetTextureScaleMode(e->texture, SDL_SCALEMODE_NEAREST);
+                e->mem.gpu_bytes = texture_footprint(e->texture, &e->mem.format, &e->mem.pitch);
+            } else SDL_Log("Failed to create texture for %s: %s", e->file_path, SDL_GetError());
+            SDL_DestroySurface(e->surface);
+            e->surface = NULL;
+        } else if (e->type == STIM_TEXT && te) {
+            /* A text shown by several rows of the ring shares its layout, released with the last of them */
+            e->text = text_engine_layout(te, e->file_path);
+            ss->te = te;
+            if (e->text) { e->w = e->text->w; e->h = e->text->h; e->mem.ram_bytes = text_engine_layout_bytes(e->text); new_text = true; }
+        }
+        r->res.texture = e->texture; r->res.text = e->text; r->res.w = e->w; r->res.h = e->h;
+        r->res.sound = e->sound; r->res.prescaled = e->prescaled;
+    }
+    if (new_text) text_engine_upload(te, renderer);
+    return ss->uploaded;
+}
+
+int stream_ready(const ScheduleStream *ss) {
+    return ss->uploaded;
+}
+
+bool stream_finished(ScheduleStream *ss) {
+    return SDL_GetAtomicInt(&ss->done) && ss->uploaded == SDL_GetAtomicInt(&ss->decoded);
+}
+
+bool stream_failed(ScheduleStream *ss) {
+    return SDL_GetAtomicInt(&ss->failed) != 0;
+}
+
+float stream_fill(ScheduleStream *ss) {
+    return (float)(ss->uploaded - SDL_GetAtomicInt(&ss->released)) / (float)ss->capacity;
+}
+
+const Stimulus *stream_stimulus(const ScheduleStream *ss, int row) {
+    return &ss->rows[row % ss->capacity].stim;
+}
+
+Resource *stream_resource(ScheduleStream *ss, int row) {
+    return &ss->rows[row % ss->capacity].res;
+}
+
+const CacheEntry *stream_entry(const ScheduleStream *ss, int row) {
+    return &ss->rows[row % ss->capacity].entry;
+}
+
+void stream_release(ScheduleStream *ss, int first_needed) {
+    int released = SDL_GetAtomicInt(&ss->released);
+    if (first_needed > ss->uploaded) first_needed = ss->uploaded;
+    if (first_needed <= released) return;
+    for (int row = released; row < first_needed; row++) free_row(ss, &ss->rows[row % ss->capacity]);
+    SDL_SetAtomicInt(&ss->released, first_needed);
+}
+
+StringTable *stream_strings(const ScheduleStream *ss) {
+    return ss->strings;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef SCHEDULE_STREAM_H
+#define SCHEDULE_STREAM_H
+
+#include <SDL3/SDL.h>
+#include "stimuli.h"
+#include "resources.h"
+#include "text_engine.h"
+
+/*
+ * Streaming execution of a CSV schedule.
+ *
+ * A reader thread parses the file in fixed-size chunks and decodes the
+ * stimuli of each row into a ring of a few rows ahead of the playhead. The
+ * render thread uploads the decoded rows as they arrive and releases the
+ * ones it has finished with, so memory stays constant whatever the length
+ * of the schedule. Rows are addressed by their absolute index; a row is
+ * usable once it is below stream_ready().
+ */
+
+typedef struct ScheduleStream ScheduleStream;
+
+/**
+ * @brief Opens a CSV schedule and starts reading ahead on a background thread.
+ *
+ * @param ahead Number of rows decoded ahead of the playhead (ring size).
+ * @param prescale May be NULL.
+ */
+ScheduleStream *stream_open(const char *csv_file, const char *base_path, SDL_Color text_color,
+                            const PrescaleOptions *prescale, int ahead);
+
+/**
+ * @brief Stops the reader and frees every row still in the ring.
+ *
+ * Call before destroying the text engine passed to stream_upload().
+ */
+void stream_close(ScheduleStream *ss);
+
+/**
+ * @brief Creates the textures and text layouts of newly decoded rows. Render thread only.
+ *
+ * At most max_rows rows are uploaded per call, and no new row is started
+ * once budget_ns has elapsed (0: no limit), to bound the time it takes. At
+ * least one row is uploaded so the stream always moves on.
+ * @return The number of rows ready to be presented (see stream_ready()).
+ */
+int stream_upload(ScheduleStream *ss, SDL_Renderer *renderer, TextEngine *te, int max_rows, Uint64 budget_ns);
+
+/**
+ * @brief Returns the number of rows uploaded so far: rows below it can be used.
+ */
+int stream_ready(const ScheduleStream *ss);
+
+/**
+ * @brief Returns true when the reader reached the end of the file, or failed.
+ */
+bool stream_finished(ScheduleStream *ss);
+
+/**
+ * @brief Returns true if the schedule had a malformed or unsorted row.
+ */
+bool stream_failed(ScheduleStream *ss);
+
+/**
+ * @brief Returns the fraction of the ring filled (0 to 1), for the loading screen.
+ */
+float stream_fill(ScheduleStream *ss);
+
+/**
+ * @brief Returns the stimulus and the resource of a ready row.
+ */
+const Stimulus *stream_stimulus(const ScheduleStream *ss, int row);
+Resource *stream_resource(ScheduleStream *ss, int row);
+
+/**
+ * @brief Returns the decoded resource of a ready row, with its memory footprint.
+ */
+const CacheEntry *stream_entry(const ScheduleStream *ss, int row);
+
+/**
+ * @brief Frees the rows below first_needed so the reader can reuse their slots. Render thread only.
+ *
+ * The caller must not use these rows anymore, including sounds still in the mixer.
+ */
+void stream_release(ScheduleStream *ss, int first_needed);
+
+/**
+ * @brief Returns the string table of the contents (also used for event names).
+ */
+StringTable *stream_strings(const ScheduleStream *ss);
+
+#endif // SCHEDULE_STREAM_H
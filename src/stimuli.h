@@ -2,6 +2,7 @@
 #define STIMULI_H
 
 #include <SDL3/SDL.h>
+#include "strtab.h"
 
 typedef enum {
     STIM_IMAGE,
@@ -14,12 +15,38 @@ typedef struct {
     Uint64 timestamp_ms;
     Uint64 duration_ms;
     StimType type;
-    char file_path[256];
+    StrId content;          /* File path or text, in the experiment string table */
+    SDL_Color color;        /* Optional per-row text colour (a == 0: use default) */
+    int asset;              /* Asset id resolved by "compile" or "pack", -1 if unresolved */
+    Uint8 trigger_lines;    /* DLP lines raised at onset (bit i is line i+1), 0: no trigger */
+    Uint16 trigger_width_ms;/* Pulse width, 0: held until the offset (images and texts) */
 } Stimulus;
 
+#define DEFAULT_SOUND_TRIGGER_MS 5
+
+/** @brief Sets the trigger of a row without a trigger code: line 1 for images, 2 for sounds, 3 for texts. */
+static inline void stimulus_default_trigger(Stimulus *s) {
+    switch (s->type) {
+        case STIM_IMAGE: s->trigger_lines = 0x01; s->trigger_width_ms = 0; break;
+        case STIM_SOUND: s->trigger_lines = 0x02; s->trigger_width_ms = DEFAULT_SOUND_TRIGGER_MS; break;
+        case STIM_TEXT:  s->trigger_lines = 0x04; s->trigger_width_ms = 0; break;
+        default:         s->trigger_lines = 0;    s->trigger_width_ms = 0; break;
+    }
+}
+
+struct MappedFile;
+
 typedef struct {
     Stimulus *stimuli;
     int count;
+    StringTable *strings;               /* Contents, labels and event names */
+    struct MappedFile *bundle;          /* Set when the experiment runs from a bundle file */
+    float frame_rate;                   /* Refresh rate a compiled schedule was built for (0: none) */
 } Experiment;
 
+/** @brief Returns the file path or text of a row. */
+static inline const char *stimulus_content(const Experiment *exp, const Stimulus *s) {
+    return strtab_get(exp->strings, s->content);
+}
+
 #endif
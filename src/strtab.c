@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "strtab.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* An id is (block << BLOCK_BITS) | offset. Strings longer than a block get
+   a block of their own, at offset 0. */
+#define BLOCK_BITS  20
+#define BLOCK_SIZE  ((size_t)1 << BLOCK_BITS)
+#define MAX_BLOCKS  ((size_t)1 << (32 - BLOCK_BITS))
+#define EMPTY_SLOT  0xFFFFFFFFu
+
+struct StringTable {
+    SDL_Mutex *lock;        /* Serializes strtab_intern_len() */
+    char  **blocks;         /* MAX_BLOCKS pointers, never reallocated */
+    int     num_blocks;
+    size_t  used;           /* Bytes used in the last block */
+    size_t  last_size;      /* Size of the last block */
+    StrId  *slots;          /* Open-addressing hash set of ids */
+    Uint32 *hashes;
+    size_t  capacity;       /* Power of two */
+    int     count;
+    size_t  bytes;
+};
+
+static Uint32 hash_string(const char *str, size_t len) {
+    Uint32 h = 2166136261u;     /* FNV-1a */
+    for (size_t i = 0; i < len; i++) { h ^= (Uint8)str[i]; h *= 16777619u; }
+    return h;
+}
+
+static bool add_block(StringTable *st, size_t size) {
+    if ((size_t)st->num_blocks >= MAX_BLOCKS) return false;
+    if (!(st->blocks[st->num_blocks] = malloc(size))) return false;
+    st->num_blocks++;
+    st->used = 0;
+    st->last_size = size;
+    st->bytes += size;
+    return true;
+}
+
+static bool grow_slots(StringTable *st) {
+    size_t cap = st->capacity ? st->capacity * 2 : 1024;
+    StrId *slots = malloc(cap * sizeof(StrId));
+    Uint32 *hashes = malloc(cap * sizeof(Uint32));
+    if (!slots || !hashes) { free(slots); free(hashes); return false; }
+    memset(slots, 0xFF, cap * sizeof(StrId));
+    for (size_t i = 0; i < st->capacity; i++) {
+        if (st->slots[i] == EMPTY_SLOT) continue;
+        size_t j = st->hashes[i] & (cap - 1);
+        while (slots[j] != EMPTY_SLOT) j = (j + 1) & (cap - 1);
+        slots[j] = st->slots[i];
+        hashes[j] = st->hashes[i];
+    }
+    st->bytes += (cap - st->capacity) * (sizeof(StrId) + sizeof(Uint32));
+    free(st->slots); free(st->hashes);
+    st->slots = slots; st->hashes = hashes;
+    st->capacity = cap;
+    return true;
+}
+
+StringTable *strtab_create(void) {
+    StringTable *st = calloc(1, sizeof(StringTable));
+    if (!st) return NULL;
+    st->bytes = sizeof(StringTable) + MAX_BLOCKS * sizeof(char *);
+    st->lock = SDL_CreateMutex();
+    st->blocks = calloc(MAX_BLOCKS, sizeof(char *));
+    if (!st->lock || !st->blocks || !add_block(st, BLOCK_SIZE) || !grow_slots(st)) {
+        strtab_destroy(st);
+        return NULL;
+    }
+    st->blocks[0][0] = '\0';    /* STR_EMPTY */
+    st->used = 1;
+    return st;
+}
+
+void strtab_destroy(StringTable *st) {
+    if (!st) return;
+    for (int i = 0; i < st->num_blocks; i++) free(st->blocks[i]);
+    free(st->blocks);
+    free(st->slots);
+    free(st->hashes);
+    if (st->lock) SDL_DestroyMutex(st->lock);
+    free(st);
+}
+
+StrId strtab_intern_len(StringTable *st, const char *str, size_t len) {
+    if (len == 0) return STR_EMPTY;
+    Uint32 h = hash_string(str, len);
+    SDL_LockMutex(st->lock);
+    size_t i = h & (st->capacity - 1);
+    for (; st->slots[i] != EMPTY_SLOT; i = (i + 1) & (st->capacity - 1)) {
+        if (st->hashes[i] != h) continue;
+        const char *s = strtab_get(st, st->slots[i]);
+        if (memcmp(s, str, len) == 0 && s[len] == '\0') {
+            StrId id = st->slots[i];
+            SDL_UnlockMutex(st->lock);
+            return id;
+        }
+    }
+
+    /* Grown before the insert: a table that cannot grow must not fill up */
+    if ((size_t)(st->count + 1) * 2 > st->capacity) {
+        if (!grow_slots(st)) {
+            SDL_UnlockMutex(st->lock);
+            return STR_EMPTY;
+        }
+        i = h & (st->capacity - 1);
+        while (st->slots[i] != EMPTY_SLOT) i = (i + 1) & (st->capacity - 1);
+    }
+    if (st->used + len + 1 > st->last_size && !add_block(st, len + 1 > BLOCK_SIZE ? len + 1 : BLOCK_SIZE)) {
+        SDL_UnlockMutex(st->lock);
+        return STR_EMPTY;
+    }
+    StrId id = ((StrId)(st->num_blocks - 1) << BLOCK_BITS) | (StrId)st->used;
+    char *dst = st->blocks[st->num_blocks - 1] + st->used;
+    memcpy(dst, str, len);
+    dst[len] = '\0';
+    st->used += len + 1;
+
+    st->slots[i] = id;
+    st->hashes[i] = h;
+    st->count++;
+    SDL_UnlockMutex(st->lock);
+    return id;
+}
+
+StrId strtab_intern(StringTable *st, const char *str) {
+    return strtab_intern_len(st, str, strlen(str));
+}
+
+const char *strtab_get(const StringTable *st, StrId id) {
+    return st->blocks[id >> BLOCK_BITS] + (id & (BLOCK_SIZE - 1));
+}
+
+void strtab_get_stats(const StringTable *st, int *strings, size_t *bytes) {
+    if (strings) *strings = st->count;
+    if (bytes) *bytes = st->bytes;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef STRTAB_H
+#define STRTAB_H
+
+#include <SDL3/SDL.h>
+
+/*
+ * Interned string table.
+ *
+ * Every distinct string is stored once in an arena of large blocks and
+ * named by a 32-bit id. Strings never move, so the pointer returned by
+ * strtab_get() stays valid until the table is destroyed. Id 0 is always
+ * the empty string.
+ *
+ * Interning is serialized by a mutex. strtab_get() takes no lock: the
+ * block list is allocated once, so an id handed over to another thread
+ * can be read there while new strings are being added.
+ */
+
+typedef Uint32 StrId;
+
+#define STR_EMPTY ((StrId)0)
+
+typedef struct StringTable StringTable;
+
+StringTable *strtab_create(void);
+void strtab_destroy(StringTable *st);
+
+/**
+ * @brief Returns the id of a string of len bytes, adding it if needed.
+ *
+ * @return The id, or STR_EMPTY if the table is out of memory (or len is 0).
+ */
+StrId strtab_intern_len(StringTable *st, const char *str, size_t len);
+
+/**
+ * @brief Same as strtab_intern_len() for a NUL-terminated string.
+ */
+StrId strtab_intern(StringTable *st, const char *str);
+
+/**
+ * @brief Returns the NUL-terminated string of an id.
+ */
+const char *strtab_get(const StringTable *st, StrId id);
+
+/**
+ * @brief Returns the number of distinct strings and the memory used.
+ */
+void strtab_get_stats(const StringTable *st, int *strings, size_t *bytes);
+
+#endif // STRTAB_H
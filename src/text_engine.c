@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "text_engine.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ATLAS_SIZE      1024
+#define ATLAS_PAD       1
+#define MAX_ATLAS_PAGES 16
+
+typedef struct {
+    Uint32   cp;
+    int      page;      /* -1 for glyphs without pixels (spaces) */
+    SDL_Rect src;
+    int      xoff;
+    int      advance;
+} Glyph;
+
+typedef struct {
+    float x, y, w, h;
+    float u0, v0, u1, v1;
+    int   page;
+} TextQuad;
+
+/* A layout and its glyph quads, allocated together */
+typedef struct {
+    TextLayout  layout;
+    const char *text;       /* The key of its slot */
+    TextQuad    quads[];
+} LayoutBlock;
+
+typedef struct {
+    char        *text;
+    LayoutBlock *layout;
+    int          refs;      /* text_engine_layout() calls not matched by text_engine_release() */
+} LayoutSlot;
+
+typedef struct {
+    SDL_Surface *surf;
+    SDL_Texture *tex;
+    int          shelf_x, shelf_y, shelf_h;
+    bool         dirty;
+    int          dirty_y0, dirty_y1;    /* Rows written since the last upload */
+} AtlasPage;
+
+struct TextEngine {
+    TTF_Font  *font;
+    float      wrap_width;
+    int        line_skip, font_h;
+
+    AtlasPage  pages[MAX_ATLAS_PAGES];
+    int        num_pages;
+
+    Glyph     *glyphs;          /* Open addressing, keyed by code point */
+    int        glyph_cap, glyph_count;
+
+    LayoutSlot *layouts;        /* Open addressing, keyed by string */
+    int         layout_cap, layout_count;
+    size_t      naive_bytes;
+
+    int        max_quads;       /* Largest layout, sizes the draw buffers */
+
+    SDL_Vertex *verts;
+    int        *indices;
+
+    Uint32     *cps;            /* Scratch buffers used during layout */
+    int        *adv;
+    int        *line_start, *line_end, *line_w;
+    int         scratch_cap;
+
+    int         glyph_uses;     /* Visible glyphs over all layouts */
+    Uint64      raster_ns;      /* Time spent rasterizing glyphs into the atlas */
+};
+
+static Uint32 hash_string(const char *s) {
+    Uint32 h = 2166136261u;
+    while (*s) { h ^= (Uint8)*s++; h *= 16777619u; }
+    return h;
+}
+
+static Uint32 hash_cp(Uint32 cp) {
+    cp ^= cp >> 16; cp *= 0x7feb352du; cp ^= cp >> 15;
+    return cp;
+}
+
+TextEngine *text_engine_create(TTF_Font *font, float wrap_width) {
+    if (!font) return NULL;
+    TextEngine *te = calloc(1, sizeof(TextEngine));
+    if (!te) return NULL;
+    te->font = font;
+    te->wrap_width = wrap_width;
+    te->line_skip = TTF_GetFontLineSkip(font);
+    te->font_h = TTF_GetFontHeight(font);
+    te->glyph_cap = 256;
+    te->glyphs = calloc(te->glyph_cap, sizeof(Glyph));
+    te->layout_cap = 256;
+    te->layouts = calloc(te->layout_cap, sizeof(LayoutSlot));
+    if (!te->glyphs || !te->layouts) { text_engine_destroy(te); return NULL; }
+    return te;
+}
+
+void text_engine_destroy(TextEngine *te) {
+    if (!te) return;
+    for (int i = 0; i < te->num_pages; i++) {
+        if (te->pages[i].tex) SDL_DestroyTexture(te->pages[i].tex);
+        if (te->pages[i].surf) SDL_DestroySurface(te->pages[i].surf);
+    }
+    if (te->layouts) {
+        for (int i = 0; i < te->layout_cap; i++) {
+            free(te->layouts[i].text);
+            free(te->layouts[i].layout);
+        }
+    }
+    free(te->layouts); free(te->glyphs);
+    free(te->verts); free(te->indices); free(te->cps); free(te->adv);
+    free(te->line_start); free(te->line_end); free(te->line_w);
+    free(te);
+}
+
+/* ─── Atlas ─── */
+
+static bool atlas_alloc(TextEngine *te, int w, int h, int *page, SDL_Rect *out) {
+    if (w + 2 * ATLAS_PAD > ATLAS_SIZE || h + 2 * ATLAS_PAD > ATLAS_SIZE) return false;
+    for (int pass = 0; pass < 2; pass++) {
+        if (te->num_pages > 0) {
+            AtlasPage *p = &te->pages[te->num_pages - 1];
+            if (p->shelf_x + w + 2 * ATLAS_PAD > ATLAS_SIZE) {
+                p->shelf_y += p->shelf_h; p->shelf_x = 0; p->shelf_h = 0;
+            }
+            if (p->shelf_y + h + 2 * ATLAS_PAD <= ATLAS_SIZE) {
+                *out = (SDL_Rect){p->shelf_x + ATLAS_PAD, p->shelf_y + ATLAS_PAD, w, h};
+                *page = te->num_pages - 1;
+                p->shelf_x += w + 2 * ATLAS_PAD;
+                if (h + 2 * ATLAS_PAD > p->shelf_h) p->shelf_h = h + 2 * ATLAS_PAD;
+                if (!p->dirty || p->shelf_y < p->dirty_y0) p->dirty_y0 = p->shelf_y;
+                if (!p->dirty || p->shelf_y + p->shelf_h > p->dirty_y1) p->dirty_y1 = p->shelf_y + p->shelf_h;
+                p->dirty = true;
+                return true;
+            }
+        }
+        if (te->num_pages == MAX_ATLAS_PAGES) break;
+        AtlasPage *np = &te->pages[te->num_pages];
+        memset(np, 0, sizeof(*np));
+        np->surf = SDL_CreateSurface(ATLAS_SIZE, ATLAS_SIZE, SDL_PIXELFORMAT_RGBA32);
+        if (!np->surf) return false;
+        SDL_FillSurfaceRect(np->surf, NULL, 0);
+        te->num_pages++;
+    }
+    SDL_Log("text_engine: atlas is full (%d pages)", MAX_ATLAS_PAGES);
+    return false;
+}
+
+static bool glyph_table_grow(TextEngine *te) {
+    int ncap = te->glyph_cap * 2;
+    Glyph *ng = calloc(ncap, sizeof(Glyph));
+    if (!ng) return false;
+    for (int i = 0; i < te->glyph_cap; i++) {
+        Glyph *g = &te->glyphs[i];
+        if (!g->cp) continue;
+        Uint32 j = hash_cp(g->cp) & (ncap - 1);
+        while (ng[j].cp) j = (j + 1) & (ncap - 1);
+        ng[j] = *g;
+    }
+    free(te->glyphs);
+    te->glyphs = ng; te->glyph_cap = ncap;
+    return true;
+}
+
+static const Glyph *get_glyph(TextEngine *te, Uint32 cp) {
+    Uint32 i = hash_cp(cp) & (te->glyph_cap - 1);
+    while (te->glyphs[i].cp) {
+        if (te->glyphs[i].cp == cp) return &te->glyphs[i];
+        i = (i + 1) & (te->glyph_cap - 1);
+    }
+
+    if ((te->glyph_count + 1) * 2 > te->glyph_cap) {
+        if (!glyph_table_grow(te)) return NULL;
+        return get_glyph(te, cp);
+    }
+
+    Glyph g = { cp, -1, {0, 0, 0, 0}, 0, 0 };
+    int minx = 0, maxx = 0, miny = 0, maxy = 0;
+    if (!TTF_GetGlyphMetrics(te->font, cp, &minx, &maxx, &miny, &maxy, &g.advance)) g.advance = 0;
+    g.xoff = minx < 0 ? minx : 0;
+
+    if (cp != ' ' && cp != '\t' && maxx > minx) {
+        Uint64 t0 = SDL_GetTicksNS();
+        SDL_Surface *s = TTF_RenderGlyph_Blended(te->font, cp, (SDL_Color){255, 255, 255, 255});
+        if (s) {
+            SDL_Surface *rgba = (s->format == SDL_PIXELFORMAT_RGBA32) ? s : SDL_ConvertSurface(s, SDL_PIXELFORMAT_RGBA32);
+            if (rgba && atlas_alloc(te, rgba->w, rgba->h, &g.page, &g.src)) {
+                SDL_SetSurfaceBlendMode(rgba, SDL_BLENDMODE_NONE);
+                SDL_BlitSurface(rgba, NULL, te->pages[g.page].surf, &g.src);
+            }
+            if (rgba && rgba != s) SDL_DestroySurface(rgba);
+            SDL_DestroySurface(s);
+        }
+        te->raster_ns += SDL_GetTicksNS() - t0;
+    }
+
+    te->glyphs[i] = g;
+    te->glyph_count++;
+    return &te->glyphs[i];
+}
+
+/* ─── Layout ─── */
+
+static bool ensure_scratch(TextEngine *te, int n) {
+    if (n <= te->scratch_cap) return true;
+    int ncap = te->scratch_cap ? te->scratch_cap : 64;
+    while (ncap < n) ncap *= 2;
+    Uint32 *c = realloc(te->cps, ncap * sizeof(Uint32));
+    if (!c) return false;
+    te->cps = c;
+    int *a = realloc(te->adv, ncap * sizeof(int));
+    if (!a) return false;
+    te->adv = a;
+    /* A string of n code points has at most n + 1 lines */
+    int **lines[] = { &te->line_start, &te->line_end, &te->line_w };
+    for (int l = 0; l < 3; l++) {
+        int *b = realloc(*lines[l], (ncap + 1) * sizeof(int));
+        if (!b) return false;
+        *lines[l] = b;
+    }
+    te->scratch_cap = ncap;
+    return true;
+}
+
+static bool ensure_draw_buffers(TextEngine *te, int extra) {
+    if (extra > te->max_quads) {
+        /* Draw buffers are sized here so that drawing never allocates */
+        SDL_Vertex *v = realloc(te->verts, extra * 4 * sizeof(SDL_Vertex));
+        if (!v) return false;
+        te->verts = v;
+        int *idx = realloc(te->indices, extra * 6 * sizeof(int));
+        if (!idx) return false;
+        te->indices = idx;
+        for (int q = te->max_quads; q < extra; q++) {
+            int *p = &idx[q * 6], b = q * 4;
+            p[0] = b; p[1] = b + 1; p[2] = b + 2; p[3] = b; p[4] = b + 2; p[5] = b + 3;
+        }
+        te->max_quads = extra;
+    }
+    return true;
+}
+
+static int compare_quad_page(const void *a, const void *b) {
+    return ((const TextQuad *)a)->page - ((const TextQuad *)b)->page;
+}
+
+/* Decodes UTF-8 into te->cps, turning the two-character sequence "\n" into a line feed. */
+static int decode_text(TextEngine *te, const char *text) {
+    size_t len = strlen(text);
+    if (!ensure_scratch(te, (int)len + 1)) return -1;
+    int n = 0;
+    const char *p = text;
+    Uint32 cp;
+    while ((cp = SDL_StepUTF8(&p, NULL)) != 0) {
+        if (cp == '\\' && *p == 'n') { p++; cp = '\n'; }
+        te->cps[n++] = cp;
+    }
+    return n;
+}
+
+static LayoutBlock *build_layout(TextEngine *te, const char *text) {
+    int n = decode_text(te, text);
+    if (n < 0) return NULL;
+
+    /* Advances (with kerning) of each code point */
+    Uint32 prev = 0;
+    for (int i = 0; i < n; i++) {
+        Uint32 cp = te->cps[i];
+        if (cp == '\n') { te->adv[i] = 0; prev = 0; continue; }
+        const Glyph *g = get_glyph(te, cp);
+        int k = 0;
+        if (prev) TTF_GetGlyphKerning(te->font, prev, cp, &k);
+        te->adv[i] = (g ? g->advance : 0) + k;
+        prev = cp;
+    }
+
+    /* Greedy word wrap: each line is [start, end) of te->cps */
+    int *line_start = te->line_start, *line_end = te->line_end, *line_w = te->line_w, nlines = 0;
+    int start = 0, w = 0, last_space = -1, w_at_space = 0;
+    for (int i = 0; i <= n; i++) {
+        if (i == n || te->cps[i] == '\n') {
+            line_start[nlines] = start; line_end[nlines] = i; line_w[nlines++] = w;
+            start = i + 1; w = 0; last_space = -1;
+            continue;
+        }
+        if (te->cps[i] == ' ') { last_space = i; w_at_space = w; }
+        if (te->wrap_width > 0 && i > start && w + te->adv[i] > te->wrap_width && last_space > start) {
+            line_start[nlines] = start; line_end[nlines] = last_space; line_w[nlines++] = w_at_space;
+            w -= w_at_space + te->adv[last_space];
+            start = last_space + 1; last_space = -1;
+        }
+        w += te->adv[i];
+    }
+
+    int max_w = 0, visible = 0;
+    for (int l = 0; l < nlines; l++) {
+        if (line_w[l] > max_w) max_w = line_w[l];
+        visible += line_end[l] - line_start[l];
+    }
+    if (!ensure_draw_buffers(te, visible)) return NULL;
+
+    LayoutBlock *block = calloc(1, sizeof(LayoutBlock) + (size_t)visible * sizeof(TextQuad));
+    if (!block) return NULL;
+    TextLayout *layout = &block->layout;
+    layout->w = (float)max_w;
+    layout->h = (float)((nlines > 0 ? nlines - 1 : 0) * te->line_skip + te->font_h);
+
+    /* Lines are centred horizontally, like a single-line text stimulus */
+    for (int l = 0; l < nlines; l++) {
+        float pen_x = (max_w - line_w[l]) / 2.0f;
+        float pen_y = (float)(l * te->line_skip);
+        for (int i = line_start[l]; i < line_end[l]; i++) {
+            const Glyph *g = get_glyph(te, te->cps[i]);
+            if (g && g->page >= 0) {
+                TextQuad *q = &block->quads[layout->num_quads];
+                q->x = pen_x + g->xoff; q->y = pen_y;
+                q->w = (float)g->src.w; q->h = (float)g->src.h;
+                q->u0 = (float)g->src.x / ATLAS_SIZE; q->v0 = (float)g->src.y / ATLAS_SIZE;
+                q->u1 = (float)(g->src.x + g->src.w) / ATLAS_SIZE; q->v1 = (float)(g->src.y + g->src.h) / ATLAS_SIZE;
+                q->page = g->page;
+                layout->num_quads++;
+            }
+            pen_x += te->adv[i];
+        }
+    }
+    qsort(block->quads, layout->num_quads, sizeof(TextQuad), compare_quad_page);
+
+    te->naive_bytes += (size_t)max_w * (size_t)layout->h * 4;
+    te->glyph_uses += layout->num_quads;
+    return block;
+}
+
+static bool layout_table_grow(TextEngine *te) {
+    int ncap = te->layout_cap * 2;
+    LayoutSlot *nl = calloc(ncap, sizeof(LayoutSlot));
+    if (!nl) return false;
+    for (int i = 0; i < te->layout_cap; i++) {
+        if (!te->layouts[i].text) continue;
+        Uint32 j = hash_string(te->layouts[i].text) & (ncap - 1);
+        while (nl[j].text) j = (j + 1) & (ncap - 1);
+        nl[j] = te->layouts[i];
+    }
+    free(te->layouts);
+    te->layouts = nl; te->layout_cap = ncap;
+    return true;
+}
+
+const TextLayout *text_engine_layout(TextEngine *te, const char *text) {
+    if (!te || !text) return NULL;
+    if ((te->layout_count + 1) * 2 > te->layout_cap && !layout_table_grow(te)) return NULL;
+
+    Uint32 i = hash_string(text) & (te->layout_cap - 1);
+    while (te->layouts[i].text) {
+        if (strcmp(te->layouts[i].text, text) == 0) {
+            te->layouts[i].refs++;
+            return &te->layouts[i].layout->layout;
+        }
+        i = (i + 1) & (te->layout_cap - 1);
+    }
+
+    LayoutBlock *block = build_layout(te, text);
+    char *copy = block ? strdup(text) : NULL;
+    if (!copy) { free(block); return NULL; }
+    block->text = copy;
+    te->layouts[i] = (LayoutSlot){ copy, block, 1 };
+    te->layout_count++;
+    return &block->layout;
+}
+
+void text_engine_release(TextEngine *te, const TextLayout *layout) {
+    if (!te || !layout) return;
+    const LayoutBlock *block = (const LayoutBlock *)layout;
+    Uint32 mask = (Uint32)te->layout_cap - 1, i = hash_string(block->text) & mask;
+    while (te->layouts[i].layout != block) {
+        if (!te->layouts[i].text) return;
+        i = (i + 1) & mask;
+    }
+    if (--te->layouts[i].refs > 0) return;
+    free(te->layouts[i].text);
+    free(te->layouts[i].layout);
+    te->layout_count--;
+
+    /* Backward-shift deletion: move up the entries that probed past the freed slot */
+    Uint32 hole = i;
+    for (Uint32 j = (i + 1) & mask; te->layouts[j].text; j = (j + 1) & mask) {
+        Uint32 home = hash_string(te->layouts[j].text) & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            te->layouts[hole] = te->layouts[j];
+            hole = j;
+        }
+    }
+    te->layouts[hole] = (LayoutSlot){0};
+}
+
+/* ─── Rendering ─── */
+
+bool text_engine_upload(TextEngine *te, SDL_Renderer *renderer) {
+    if (!te) return false;
+    for (int i = 0; i < te->num_pages; i++) {
+        AtlasPage *p = &te->pages[i];
+        if (!p->dirty && p->tex) continue;
+        /* Only the rows written since the last upload are sent, so streaming new words stays cheap */
+        if (p->tex && p->tex->format == p->surf->format) {
+            SDL_Rect rows = {0, p->dirty_y0, ATLAS_SIZE, p->dirty_y1 - p->dirty_y0};
+            if (SDL_UpdateTexture(p->tex, &rows, (Uint8 *)p->surf->pixels + (size_t)rows.y * p->surf->pitch, p->surf->pitch)) {
+                p->dirty = false;
+                continue;
+            }
+        }
+        if (p->tex) SDL_DestroyTexture(p->tex);
+        p->tex = SDL_CreateTextureFromSurface(renderer, p->surf);
+        if (!p->tex) {
+            SDL_Log("text_engine: failed to upload atlas page %d: %s", i, SDL_GetError());
+            return false;
+        }
+        SDL_SetTextureBlendMode(p->tex, SDL_BLENDMODE_BLEND);
+        p->dirty = false;
+    }
+    return true;
+}
+
+void text_engine_draw(TextEngine *te, SDL_Renderer *renderer, const TextLayout *layout,
+                      float x, float y, float scale, SDL_Color color) {
+    if (!te || !layout || layout->num_quads == 0) return;
+    SDL_FColor fc = { color.r / 255.0f, color.g / 255.0f, color.b / 255.0f, color.a / 255.0f };
+    const TextQuad *q = ((const LayoutBlock *)layout)->quads;
+    int i = 0;
+    while (i < layout->num_quads) {
+        int page = q[i].page, n = 0;
+        for (; i < layout->num_quads && q[i].page == page; i++, n++) {
+            const TextQuad *g = &q[i];
+            SDL_Vertex *v = &te->verts[n * 4];
+            float x0 = x + g->x * scale, y0 = y + g->y * scale;
+            float x1 = x0 + g->w * scale, y1 = y0 + g->h * scale;
+            v[0] = (SDL_Vertex){{x0, y0}, fc, {g->u0, g->v0}};
+            v[1] = (SDL_Vertex){{x1, y0}, fc, {g->u1, g->v0}};
+            v[2] = (SDL_Vertex){{x1, y1}, fc, {g->u1, g->v1}};
+            v[3] = (SDL_Vertex){{x0, y1}, fc, {g->u0, g->v1}};
+        }
+        SDL_RenderGeometry(renderer, te->pages[page].tex, te->verts, n * 4, te->indices, n * 6);
+    }
+}
+
+size_t text_engine_layout_bytes(const TextLayout *layout) {
+    return layout ? sizeof(TextLayout) + (size_t)layout->num_quads * sizeof(TextQuad) : 0;
+}
+
+void text_engine_get_stats(const TextEngine *te, TextEngineStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!te) return;
+    stats->strings = te->layout_count;
+    stats->glyphs = te->glyph_count;
+    stats->pages = te->num_pages;
+    stats->atlas_bytes = (size_t)te->num_pages * ATLAS_SIZE * ATLAS_SIZE * 4;
+    stats->naive_bytes = te->naive_bytes;
+    stats->glyph_uses = te->glyph_uses;
+    stats->raster_ns = te->raster_ns;
+}
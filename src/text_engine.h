@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef TEXT_ENGINE_H
+#define TEXT_ENGINE_H
+
+#include <SDL3/SDL.h>
+#include <SDL3_ttf/SDL_ttf.h>
+
+/*
+ * Glyph-atlas text engine.
+ *
+ * Glyphs are rasterized once (in white) into shared atlas pages and every
+ * string is laid out as a list of glyph quads, drawn in a single
+ * SDL_RenderGeometry call per page. The colour is applied per vertex, so
+ * any number of strings and colours share the same few textures.
+ *
+ * Layout only touches CPU surfaces; text_engine_upload() must be called on
+ * the render thread before drawing.
+ */
+
+typedef struct TextEngine TextEngine;
+
+typedef struct {
+    float w, h;        /* Bounding box of the laid out string, in pixels */
+    int   num_quads;   /* Number of visible glyph quads */
+} TextLayout;
+
+typedef struct {
+    int    strings;      /* Distinct strings laid out */
+    int    glyphs;       /* Distinct glyphs rasterized */
+    int    pages;        /* Atlas pages in use */
+    size_t atlas_bytes;  /* Memory used by the atlas pages */
+    size_t naive_bytes;  /* Memory one RGBA texture per string would need */
+    int    glyph_uses;   /* Visible glyphs over all strings: what one texture per string rasterizes */
+    Uint64 raster_ns;    /* Time spent rasterizing the distinct glyphs */
+} TextEngineStats;
+
+/**
+ * @brief Creates a text engine for a font.
+ *
+ * @param font Font used for all strings (not owned).
+ * @param wrap_width Maximum line width in pixels (0 disables wrapping).
+ */
+TextEngine *text_engine_create(TTF_Font *font, float wrap_width);
+
+/**
+ * @brief Frees the engine, its atlas pages and all layouts.
+ */
+void text_engine_destroy(TextEngine *te);
+
+/**
+ * @brief Lays out a string, rasterizing any missing glyph into the atlas.
+ *
+ * Layouts are cached per string: laying out the same text twice returns the
+ * same pointer. The literal sequence "\n" forces a line break. The returned
+ * layout stays valid until it is released as many times as it was laid out,
+ * or until the engine is destroyed.
+ */
+const TextLayout *text_engine_layout(TextEngine *te, const char *text);
+
+/**
+ * @brief Gives back a layout; the last release frees it and its quads.
+ */
+void text_engine_release(TextEngine *te, const TextLayout *layout);
+
+/**
+ * @brief Creates or refreshes the atlas textures. Render thread only.
+ */
+bool text_engine_upload(TextEngine *te, SDL_Renderer *renderer);
+
+/**
+ * @brief Draws a layout with its top-left corner at (x, y).
+ */
+void text_engine_draw(TextEngine *te, SDL_Renderer *renderer, const TextLayout *layout,
+                      float x, float y, float scale, SDL_Color color);
+
+/**
+ * @brief Returns the CPU memory held by one layout (its glyph quads).
+ */
+size_t text_engine_layout_bytes(const TextLayout *layout);
+
+/**
+ * @brief Returns memory statistics about the atlas and the layout cache.
+ */
+void text_engine_get_stats(const TextEngine *te, TextEngineStats *stats);
+
+#endif // TEXT_ENGINE_H
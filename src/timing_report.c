@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "timing_report.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_EVENT_TYPES     32
+#define HISTOGRAM_BINS      1001    /* 0 to 999 ms, then 1 s or more: p95 is exact below 1 s */
+
+bool timing_report_init(TimingReport *report, StringTable *strings, double tolerance_ms) {
+    memset(report, 0, sizeof(*report));
+    report->tolerance_ms = tolerance_ms;
+    report->skipped[0] = strtab_intern(strings, "RESPONSE");
+    report->skipped[1] = strtab_intern(strings, "DLP_INPUT");
+    report->skipped[2] = strtab_intern(strings, "CONTROL");
+    report->skipped[3] = strtab_intern(strings, "MARK");
+    report->types = calloc(MAX_EVENT_TYPES, sizeof(TimingStats));
+    report->histograms = calloc((size_t)MAX_EVENT_TYPES * HISTOGRAM_BINS, sizeof(Uint32));
+    if (!report->types || !report->histograms) {
+        timing_report_free(report);
+        return false;
+    }
+    return true;
+}
+
+void timing_report_add(TimingReport *report, const EventLogEntry *entries, int n) {
+    for (int i = 0; i < n; i++) {
+        const EventLogEntry *e = &entries[i];
+        bool skip = false;
+        for (int j = 0; j < (int)SDL_arraysize(report->skipped); j++) skip |= e->type == report->skipped[j];
+        if (skip) continue;
+        /* Distinct event types, in order of first appearance */
+        int k = 0;
+        while (k < report->num_types && report->types[k].type != e->type) k++;
+        if (k == report->num_types) {
+            if (k == MAX_EVENT_TYPES) continue;
+            report->types[k].type = e->type;
+            report->types[k].histogram = report->histograms + (size_t)k * HISTOGRAM_BINS;
+            report->num_types++;
+        }
+        TimingStats *ts = &report->types[k];
+        double err = (double)e->timestamp_ms - (double)e->intended_ms;
+        ts->count++;
+        ts->sum_ms += err; ts->sum2_ms += err * err;
+        if (SDL_fabs(err) > ts->max_ms) ts->max_ms = SDL_fabs(err);
+        if (SDL_fabs(err) > report->tolerance_ms) ts->beyond++;
+        double bin = SDL_fabs(err) < HISTOGRAM_BINS - 1 ? SDL_fabs(err) : HISTOGRAM_BINS - 1;
+        ts->histogram[(int)bin]++;
+    }
+}
+
+void timing_report_finish(TimingReport *report) {
+    for (int k = 0; k < report->num_types; k++) {
+        TimingStats *ts = &report->types[k];
+        ts->mean_ms = ts->sum_ms / ts->count;
+        double var = ts->sum2_ms / ts->count - ts->mean_ms * ts->mean_ms;
+        ts->sd_ms = var > 0.0 ? SDL_sqrt(var) : 0.0;
+        /* The times are whole ms, so the bin is the error itself, up to the last bin */
+        int rank = (int)SDL_ceil(0.95 * ts->count), seen = 0, bin = 0;
+        while (bin < HISTOGRAM_BINS - 1 && (seen += (int)ts->histogram[bin]) < rank) bin++;
+        ts->p95_ms = bin < HISTOGRAM_BINS - 1 ? (double)bin : ts->max_ms;
+    }
+}
+
+size_t timing_report_format(const TimingReport *report, const StringTable *strings, char *buf, size_t size) {
+    if (size == 0) return 0;
+    int n = snprintf(buf, size, "# Timing Error (actual - intended), tolerance %.2f ms:\n", report->tolerance_ms);
+    if (n < 0) return 0;
+    size_t len = (size_t)n < size ? (size_t)n : size - 1;
+    for (int k = 0; k < report->num_types && len + 1 < size; k++) {
+        const TimingStats *ts = &report->types[k];
+        n = snprintf(buf + len, size - len, "#   %s: n=%d mean=%+.2f ms sd=%.2f ms p95=%.2f ms max=%.2f ms beyond tolerance=%d\n",
+                     strtab_get(strings, ts->type), ts->count, ts->mean_ms, ts->sd_ms, ts->p95_ms, ts->max_ms, ts->beyond);
+        if (n < 0) break;
+        len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+    }
+    return len;
+}
+
+static void write_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", (unsigned char)*s);
+        else fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+bool timing_report_write_json(const TimingReport *report, const StringTable *strings, const char *path, bool completed) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "{\n  \"completed\": %s,\n  \"tolerance_ms\": %.3f,\n  \"events\": {", completed ? "true" : "false", report->tolerance_ms);
+    for (int k = 0; k < report->num_types; k++) {
+        const TimingStats *ts = &report->types[k];
+        fprintf(f, "%s\n    ", k > 0 ? "," : "");
+        write_json_string(f, strtab_get(strings, ts->type));
+        fprintf(f, ": {\"count\": %d, \"mean_ms\": %.3f, \"sd_ms\": %.3f, \"p95_ms\": %.3f, \"max_ms\": %.3f, \"beyond_tolerance\": %d}",
+                ts->count, ts->mean_ms, ts->sd_ms, ts->p95_ms, ts->max_ms, ts->beyond);
+    }
+    fprintf(f, "%s}\n}\n", report->num_types > 0 ? "\n  " : "");
+    return fclose(f) == 0;
+}
+
+void timing_report_free(TimingReport *report) {
+    free(report->types);
+    free(report->histograms);
+    report->types = NULL;
+    report->histograms = NULL;
+    report->num_types = 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef TIMING_REPORT_H
+#define TIMING_REPORT_H
+
+#include <stdio.h>
+#include "experiment.h"
+
+/* Onset error statistics (actual - intended) of one event type */
+typedef struct {
+    StrId  type;
+    int    count;
+    double mean_ms;
+    double sd_ms;
+    double p95_ms;          /* 95th percentile of the absolute error */
+    double max_ms;          /* Largest absolute error */
+    int    beyond;          /* Events whose absolute error exceeds the tolerance */
+    double sum_ms, sum2_ms; /* Accumulated by timing_report_add() */
+    Uint32 *histogram;      /* Events per absolute error in ms, the last bin holding the larger ones */
+} TimingStats;
+
+/*
+ * The statistics are accumulated event by event as the results are written,
+ * so the events need not stay in memory until the end of the run.
+ */
+typedef struct {
+    TimingStats *types;
+    int          num_types;
+    double       tolerance_ms;
+    StrId        skipped[4];    /* Logged at their own time: no error */
+    Uint32      *histograms;
+} TimingReport;
+
+/**
+ * @brief Starts an empty report; the names of the event types are ids of strings.
+ */
+bool timing_report_init(TimingReport *report, StringTable *strings, double tolerance_ms);
+
+/**
+ * @brief Adds n events to the error statistics of their type, except responses, DLP inputs and control events.
+ */
+void timing_report_add(TimingReport *report, const EventLogEntry *entries, int n);
+
+/**
+ * @brief Computes the mean, standard deviation and percentiles once every event has been added.
+ */
+void timing_report_finish(TimingReport *report);
+
+/**
+ * @brief Writes the report as '#' comment lines into buf (truncated to size).
+ *
+ * @return The length of the text.
+ */
+size_t timing_report_format(const TimingReport *report, const StringTable *strings, char *buf, size_t size);
+
+/**
+ * @brief Writes the report as a JSON file.
+ */
+bool timing_report_write_json(const TimingReport *report, const StringTable *strings, const char *path, bool completed);
+
+void timing_report_free(TimingReport *report);
+
+#endif // TIMING_REPORT_H
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "trigger_output.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TRIGGER_QUEUE_SIZE 64       /* Power of two */
+#define NUM_LINES          8
+#define MAX_SCHEDULED      16       /* Commands waiting for their time on the thread */
+
+typedef struct {
+    Uint64 at_ticks;                /* SDL_GetTicks() time of the write, 0 for now */
+    Uint64 issued_ticks;            /* SDL_GetTicks() time it was queued */
+    Uint64 intended_ms;
+    StrId  label;
+    Uint32 width_ms;                /* Pulse width, 0 for a level change */
+    Uint8  lines;
+    bool   set;
+} TriggerCommand;
+
+typedef struct {
+    Uint64 issued_ms;
+    StrId  label;
+} DrainEntry;
+
+/* Single-producer, single-consumer rings: head is only written by the frame
+   loop (by the output thread for the drain ring), tail only by the thread
+   that consumes it. */
+struct TriggerOutput {
+    dlp_io8g_t *dlp;
+    EventQueue *events;
+    Uint64 origin_ms;
+    StrId ev_issued, ev_written, ev_drained, ev_failed;
+    TriggerCommand ring[TRIGGER_QUEUE_SIZE];
+    SDL_AtomicInt head;             /* Commands queued */
+    SDL_AtomicInt tail;             /* Commands taken by the thread */
+    SDL_AtomicInt dropped;
+    SDL_AtomicInt quit;
+    SDL_Semaphore *wake;
+    SDL_Thread *thread;
+    TriggerCommand scheduled[MAX_SCHEDULED];    /* Thread only, sorted by at_ticks */
+    int num_scheduled;
+    Uint64 unset_at_ns[NUM_LINES];  /* Thread only: end of the pulse on each line, 0 if none */
+    Uint64 unset_intended_ms[NUM_LINES];    /* Thread only: intended end of the pulse */
+    StrId unset_label[NUM_LINES];   /* Thread only: label of the pulse */
+    Uint8 state;                    /* Thread only: lines currently set */
+    SDL_AtomicU32 next_write_ms;    /* SDL_GetTicks() of the next due write (low 32 bits), 0 if none */
+
+    /* Drain timing, when drain_thread is not NULL */
+    DrainEntry drain_ring[TRIGGER_QUEUE_SIZE];
+    SDL_AtomicInt drain_head;       /* Commands written */
+    SDL_AtomicInt drain_tail;       /* Commands known to be sent */
+    SDL_AtomicInt drain_dropped;
+    SDL_AtomicInt drain_quit;
+    SDL_Semaphore *drain_wake;
+    SDL_Thread *drain_thread;
+};
+
+/* Returns false if the write failed; state then has the lines a short write did change */
+static bool write_lines(TriggerOutput *to, Uint8 lines, bool set) {
+    Uint8 state = set ? (to->state | lines) : (to->state & ~lines);
+    unsigned char written;
+    bool ok = dlp_write_mask(to->dlp, to->state, state, &written);
+    to->state = written;
+    return ok;
+}
+
+/* Hands a written command over to the drain thread; issued_ticks is when it was queued, or when a pulse end was due */
+static void push_drain(TriggerOutput *to, Uint64 issued_ticks, StrId label) {
+    int head = SDL_GetAtomicInt(&to->drain_head);
+    if (head - SDL_GetAtomicInt(&to->drain_tail) >= TRIGGER_QUEUE_SIZE) {
+        SDL_AddAtomicInt(&to->drain_dropped, 1);
+        return;
+    }
+    Uint64 issued_ms = issued_ticks > to->origin_ms ? issued_ticks - to->origin_ms : 0;
+    to->drain_ring[head & (TRIGGER_QUEUE_SIZE - 1)] = (DrainEntry){ issued_ms, label };
+    SDL_SetAtomicInt(&to->drain_head, head + 1);
+    SDL_SignalSemaphore(to->drain_wake);
+}
+
+static void run_command(TriggerOutput *to, const TriggerCommand *c) {
+    bool ok = write_lines(to, c->lines, c->set);
+    Uint64 now_ns = SDL_GetTicksNS();
+    if (to->events) event_queue_push(to->events, c->intended_ms, now_ns / SDL_NS_PER_MS, ok ? to->ev_written : to->ev_failed, c->label);
+    if (ok && to->drain_thread && to->events) push_drain(to, c->issued_ticks, c->label);
+    /* A pulse lasts width_ms from the end of its write; any later command on a line overrides it.
+       A line that a failed write did set still gets its end. */
+    for (int i = 0; i < NUM_LINES; i++) {
+        if (!(c->lines & (1u << i))) continue;
+        bool pulse = c->set && c->width_ms > 0 && (to->state & (1u << i));
+        to->unset_at_ns[i] = pulse ? now_ns + SDL_MS_TO_NS(c->width_ms) : 0;
+        to->unset_intended_ms[i] = c->intended_ms + c->width_ms;
+        to->unset_label[i] = c->label;
+    }
+}
+
+/* Unsets the lines whose pulse is over; returns the delay in ms (rounded up) until the next one ends, or -1.
+   Pulse ends are kept in ns: with ms ticks, a 5 ms pulse could last anywhere from 4 to 5 ms. */
+static Sint32 end_pulses(TriggerOutput *to) {
+    Uint64 now = SDL_GetTicksNS(), next = 0, due_ns[NUM_LINES];
+    Uint8 due = 0;
+    for (int i = 0; i < NUM_LINES; i++) {
+        if (!to->unset_at_ns[i]) continue;
+        if (to->unset_at_ns[i] <= now) {
+            due |= (Uint8)(1u << i);
+            due_ns[i] = to->unset_at_ns[i];
+            to->unset_at_ns[i] = 0;
+        } else if (!next || to->unset_at_ns[i] < next) next = to->unset_at_ns[i];
+    }
+    if (due) {
+        bool ok = write_lines(to, due, false);
+        Uint64 written_ns = SDL_GetTicksNS();
+        /* Logged like a commanded write, one event per pulse: lines pulsed by the same command share it.
+           For the drain, the pulse end is issued when it was due. */
+        for (int i = 0; i < NUM_LINES && to->events; i++) {
+            if (!(due & (1u << i))) continue;
+            bool logged = false;
+            for (int j = 0; j < i && !logged; j++) {
+                logged = (due & (1u << j)) && to->unset_label[j] == to->unset_label[i] && to->unset_intended_ms[j] == to->unset_intended_ms[i];
+            }
+            if (logged) continue;
+            event_queue_push(to->events, to->unset_intended_ms[i], written_ns / SDL_NS_PER_MS, ok ? to->ev_written : to->ev_failed, to->unset_label[i]);
+            if (ok && to->drain_thread) push_drain(to, due_ns[i] / SDL_NS_PER_MS, to->unset_label[i]);
+        }
+    }
+    return next ? (Sint32)((next - now + SDL_NS_PER_MS - 1) / SDL_NS_PER_MS) : -1;
+}
+
+/* Inserts after the commands due at the same time, so that they keep their order */
+static void schedule(TriggerOutput *to, const TriggerCommand *c) {
+    int i = to->num_scheduled;
+    while (i > 0 && to->scheduled[i - 1].at_ticks > c->at_ticks) {
+        to->scheduled[i] = to->scheduled[i - 1];
+        i--;
+    }
+    to->scheduled[i] = *c;
+    to->num_scheduled++;
+}
+
+/* Writes the commands that are due; returns the delay until the next one, or -1 */
+static Sint32 run_scheduled(TriggerOutput *to) {
+    int n = 0;
+    while (n < to->num_scheduled && to->scheduled[n].at_ticks <= SDL_GetTicks()) run_command(to, &to->scheduled[n++]);
+    to->num_scheduled -= n;
+    memmove(to->scheduled, to->scheduled + n, (size_t)to->num_scheduled * sizeof(TriggerCommand));
+    if (to->num_scheduled == 0) return -1;
+    Uint64 now = SDL_GetTicks();
+    return to->scheduled[0].at_ticks > now ? (Sint32)(to->scheduled[0].at_ticks - now) : 0;
+}
+
+/* Publishes when the thread will write next, for trigger_output_busy() */
+static void publish_next_write(TriggerOutput *to) {
+    Uint64 next_ns = to->num_scheduled > 0 ? SDL_MS_TO_NS(to->scheduled[0].at_ticks) : 0;
+    for (int i = 0; i < NUM_LINES; i++) {
+        if (to->unset_at_ns[i] && (!next_ns || to->unset_at_ns[i] < next_ns)) next_ns = to->unset_at_ns[i];
+    }
+    Uint32 next_ms = (Uint32)(next_ns / SDL_NS_PER_MS);
+    SDL_SetAtomicU32(&to->next_write_ms, next_ns && !next_ms ? 1 : next_ms);
+}
+
+static Sint32 sooner(Sint32 a, Sint32 b) {
+    if (a < 0) return b;
+    if (b < 0) return a;
+    return a < b ? a : b;
+}
+
+static int SDLCALL output_thread(void *data) {
+    TriggerOutput *to = (TriggerOutput *)data;
+    SDL_SetCurrentThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
+    for (;;) {
+        /* Read quit first: every command queued before it is then visible below */
+        bool quit = SDL_GetAtomicInt(&to->quit) != 0;
+        int tail = SDL_GetAtomicInt(&to->tail);
+        while (tail != SDL_GetAtomicInt(&to->head) && to->num_scheduled < MAX_SCHEDULED) {
+            schedule(to, &to->ring[tail & (TRIGGER_QUEUE_SIZE - 1)]);
+            SDL_SetAtomicInt(&to->tail, ++tail);
+        }
+        /* In this order: a pulse started by run_scheduled() must be seen by end_pulses() */
+        Sint32 wait = run_scheduled(to);
+        wait = sooner(wait, end_pulses(to));
+        if (quit && wait < 0 && tail == SDL_GetAtomicInt(&to->head)) break;
+        publish_next_write(to);
+        SDL_WaitSemaphoreTimeout(to->wake, wait);
+    }
+    return 0;
+}
+
+/* Waits until the commands written so far are sent, then logs them all with
+   the same time: a drain that started after a write also covers it. */
+static int SDLCALL drain_thread(void *data) {
+    TriggerOutput *to = (TriggerOutput *)data;
+    SDL_SetCurrentThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    bool failed = false;
+    for (;;) {
+        bool quit = SDL_GetAtomicInt(&to->drain_quit) != 0;
+        int tail = SDL_GetAtomicInt(&to->drain_tail), head = SDL_GetAtomicInt(&to->drain_head);
+        if (tail == head) {
+            if (quit) break;
+            SDL_WaitSemaphore(to->drain_wake);
+            continue;
+        }
+        /* After a failure, keep emptying the ring so that the output thread never sees it full */
+        if (!failed && !dlp_drain(to->dlp)) {
+            SDL_Log("Warning: cannot wait for the trigger port to drain, TRIGGER_DRAINED is no longer logged");
+            failed = true;
+        }
+        Uint64 now = SDL_GetTicks();
+        for (; tail != head && !failed; tail++) {
+            const DrainEntry *e = &to->drain_ring[tail & (TRIGGER_QUEUE_SIZE - 1)];
+            event_queue_push(to->events, e->issued_ms, now, to->ev_drained, e->label);
+        }
+        tail = head;
+        SDL_SetAtomicInt(&to->drain_tail, tail);
+    }
+    return 0;
+}
+
+TriggerOutput *trigger_output_start(dlp_io8g_t *dlp, EventQueue *events, StringTable *strings, bool drain_timing) {
+    TriggerOutput *to = calloc(1, sizeof(TriggerOutput));
+    if (!to) return NULL;
+    to->dlp = dlp;
+    to->events = events;
+    if (events) {
+        to->ev_issued = strtab_intern(strings, "TRIGGER_ISSUED");
+        to->ev_written = strtab_intern(strings, "TRIGGER_WRITTEN");
+        to->ev_drained = strtab_intern(strings, "TRIGGER_DRAINED");
+        to->ev_failed = strtab_intern(strings, "TRIGGER_FAILED");
+    }
+    /* The drain thread goes first: the output thread checks it is there before using it */
+    if (drain_timing && events) {
+        to->drain_wake = SDL_CreateSemaphore(0);
+        if (to->drain_wake) to->drain_thread = SDL_CreateThread(drain_thread, "expe3000-trigger-drain", to);
+        if (!to->drain_thread) {
+            SDL_Log("Warning: cannot start the trigger drain thread, TRIGGER_DRAINED will not be logged: %s", SDL_GetError());
+            if (to->drain_wake) SDL_DestroySemaphore(to->drain_wake);
+            to->drain_wake = NULL;
+        }
+    }
+    to->wake = SDL_CreateSemaphore(0);
+    if (to->wake) to->thread = SDL_CreateThread(output_thread, "expe3000-triggers", to);
+    if (!to->thread) {
+        SDL_Log("Error: cannot start the trigger output thread: %s", SDL_GetError());
+        if (to->wake) SDL_DestroySemaphore(to->wake);
+        if (to->drain_thread) {
+            SDL_SetAtomicInt(&to->drain_quit, 1);
+            SDL_SignalSemaphore(to->drain_wake);
+            SDL_WaitThread(to->drain_thread, NULL);
+            SDL_DestroySemaphore(to->drain_wake);
+        }
+        free(to);
+        return NULL;
+    }
+    return to;
+}
+
+bool trigger_output_busy(TriggerOutput *to, Uint64 within_ns) {
+    if (!to) return false;
+    if (SDL_GetAtomicInt(&to->tail) != SDL_GetAtomicInt(&to->head)) return true;
+    Uint32 next = SDL_GetAtomicU32(&to->next_write_ms);
+    /* In ms: the write may be up to 1 ms sooner than next */
+    Uint32 horizon = (Uint32)SDL_GetTicks() + (Uint32)((within_ns + SDL_NS_PER_MS - 1) / SDL_NS_PER_MS) + 1;
+    return next && (Sint32)(horizon - next) >= 0;
+}
+
+void trigger_output_set_origin(TriggerOutput *to, Uint64 origin_ms) {
+    to->origin_ms = origin_ms;
+    dlp_set_origin(to->dlp, origin_ms);
+}
+
+void trigger_output_stop(TriggerOutput *to) {
+    if (!to) return;
+    SDL_SetAtomicInt(&to->quit, 1);
+    SDL_SignalSemaphore(to->wake);
+    SDL_WaitThread(to->thread, NULL);
+    if (SDL_GetAtomicInt(&to->dropped) > 0)
+        SDL_Log("Warning: %d triggers were dropped because the trigger queue was full", SDL_GetAtomicInt(&to->dropped));
+    SDL_DestroySemaphore(to->wake);
+    /* After the output thread, so that its last writes are drained and logged */
+    if (to->drain_thread) {
+        SDL_SetAtomicInt(&to->drain_quit, 1);
+        SDL_SignalSemaphore(to->drain_wake);
+        SDL_WaitThread(to->drain_thread, NULL);
+        if (SDL_GetAtomicInt(&to->drain_dropped) > 0)
+            SDL_Log("Warning: %d TRIGGER_DRAINED events were dropped because the drain queue was full", SDL_GetAtomicInt(&to->drain_dropped));
+        SDL_DestroySemaphore(to->drain_wake);
+    }
+    free(to);
+}
+
+static bool enqueue(TriggerOutput *to, Uint8 lines, bool set, Uint32 width_ms, Uint64 at_ticks, Uint64 intended_ms, StrId label) {
+    if (!to) return false;
+    Uint64 now = SDL_GetTicks();
+    int head = SDL_GetAtomicInt(&to->head);
+    if (head - SDL_GetAtomicInt(&to->tail) >= TRIGGER_QUEUE_SIZE) {
+        SDL_AddAtomicInt(&to->dropped, 1);
+        return false;
+    }
+    to->ring[head & (TRIGGER_QUEUE_SIZE - 1)] = (TriggerCommand){ at_ticks, now, intended_ms, label, width_ms, lines, set };
+    if (to->events) event_queue_push(to->events, intended_ms, now, to->ev_issued, label);
+    SDL_SetAtomicInt(&to->head, head + 1);
+    SDL_SignalSemaphore(to->wake);
+    return true;
+}
+
+bool trigger_set(TriggerOutput *to, Uint8 lines, Uint64 intended_ms, StrId label) {
+    return enqueue(to, lines, true, 0, 0, intended_ms, label);
+}
+
+bool trigger_unset(TriggerOutput *to, Uint8 lines, Uint64 intended_ms, StrId label) {
+    return enqueue(to, lines, false, 0, 0, intended_ms, label);
+}
+
+bool trigger_pulse(TriggerOutput *to, Uint8 lines, Uint32 width_ms, Uint64 intended_ms, StrId label) {
+    return enqueue(to, lines, true, width_ms, 0, intended_ms, label);
+}
+
+bool trigger_set_at(TriggerOutput *to, Uint8 lines, Uint64 at_ticks, Uint64 intended_ms, StrId label) {
+    return enqueue(to, lines, true, 0, at_ticks, intended_ms, label);
+}
+
+bool trigger_unset_at(TriggerOutput *to, Uint8 lines, Uint64 at_ticks, Uint64 intended_ms, StrId label) {
+    return enqueue(to, lines, false, 0, at_ticks, intended_ms, label);
+}
+
+bool trigger_pulse_at(TriggerOutput *to, Uint8 lines, Uint32 width_ms, Uint64 at_ticks, Uint64 intended_ms, StrId label) {
+    return enqueue(to, lines, true, width_ms, at_ticks, intended_ms, label);
+}
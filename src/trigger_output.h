@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef TRIGGER_OUTPUT_H
+#define TRIGGER_OUTPUT_H
+
+#include <SDL3/SDL.h>
+#include "dlp.h"
+#include "event_queue.h"
+
+/*
+ * Trigger output thread.
+ *
+ * The frame loop only queues commands (set lines, unset lines, or a pulse
+ * that sets lines and unsets them after a width); a high-priority thread
+ * owns the device and does the writes, so serial I/O never stalls a frame.
+ * Each command logs TRIGGER_ISSUED when it is queued and TRIGGER_WRITTEN
+ * when its write returned. The end of a pulse logs TRIGGER_WRITTEN too,
+ * with the label of the pulse and its intended end as intended time. Lines
+ * are given as a mask: bit 0 is line 1.
+ *
+ * A write returns once the bytes are in the driver's buffer, not on the
+ * wire. With drain timing, a second thread waits for the port to send them
+ * (tcdrain) and logs TRIGGER_DRAINED, whose intended time is when the
+ * command was queued: its timing error is the issue-to-drain latency.
+ */
+
+#define TRIGGER_LINE(n) ((Uint8)(1u << ((n) - 1)))
+
+typedef struct TriggerOutput TriggerOutput;
+
+/**
+ * @brief Starts the output thread of an open device. events may be NULL (nothing logged).
+ *
+ * The device must not be written to by anyone else until trigger_output_stop().
+ */
+TriggerOutput *trigger_output_start(dlp_io8g_t *dlp, EventQueue *events, StringTable *strings, bool drain_timing);
+
+/**
+ * @brief Sets the origin of the event times (SDL_GetTicks() at the start of the run), before the first command.
+ */
+void trigger_output_set_origin(TriggerOutput *to, Uint64 origin_ms);
+
+/**
+ * @brief Returns true if a command is queued or a write (a pulse end included) is due within within_ns.
+ *
+ * Lets another user of the port, the input poller, keep the link free for
+ * the triggers. Lock-free, from any thread. to may be NULL.
+ */
+bool trigger_output_busy(TriggerOutput *to, Uint64 within_ns);
+
+/**
+ * @brief Writes the commands still queued, ends the pending pulses and stops the thread.
+ */
+void trigger_output_stop(TriggerOutput *to);
+
+/**
+ * @brief Queues a command. Lock-free, to be called from a single thread (the frame loop).
+ *
+ * @return false if the queue was full and the command was dropped.
+ */
+bool trigger_set(TriggerOutput *to, Uint8 lines, Uint64 intended_ms, StrId label);
+bool trigger_unset(TriggerOutput *to, Uint8 lines, Uint64 intended_ms, StrId label);
+bool trigger_pulse(TriggerOutput *to, Uint8 lines, Uint32 width_ms, Uint64 intended_ms, StrId label);
+
+/**
+ * @brief Queues a command to be written at a later SDL_GetTicks() time (0: as soon as possible).
+ *
+ * Commands due at the same time are written in the order they were queued.
+ */
+bool trigger_set_at(TriggerOutput *to, Uint8 lines, Uint64 at_ticks, Uint64 intended_ms, StrId label);
+bool trigger_unset_at(TriggerOutput *to, Uint8 lines, Uint64 at_ticks, Uint64 intended_ms, StrId label);
+bool trigger_pulse_at(TriggerOutput *to, Uint8 lines, Uint32 width_ms, Uint64 at_ticks, Uint64 intended_ms, StrId label);
+
+#endif // TRIGGER_OUTPUT_H
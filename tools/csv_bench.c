@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Parse time of a large CSV schedule.
+ *
+ * Generates a schedule of N rows (images, sounds and words, a few with a
+ * colour or a trigger code, like a long lexical decision task), parses it
+ * with parse_csv() a few times and reports the best time.
+ *
+ *   csv_bench [rows] [schedule.csv] [max_ms]
+ *
+ * With max_ms, exits non-zero if the best parse is slower than that.
+ */
+
+#include "csv_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RUNS 3
+
+static bool generate(const char *path, int rows) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("Cannot create the schedule");
+        return false;
+    }
+    fprintf(f, "# csv_bench schedule, %d rows\n", rows);
+    for (int i = 0; i < rows; i++) {
+        unsigned long long t = (unsigned long long)i * 500;
+        switch (i % 4) {
+            case 0: fprintf(f, "%llu,300,IMAGE,images/img%03d.png\n", t, i % 200); break;
+            case 1: fprintf(f, "%llu,0,SOUND,sounds/tone%02d.wav,,2:5\n", t, i % 20); break;
+            case 2: fprintf(f, "%llu,400,TEXT,word%06d\n", t, i); break;
+            default: fprintf(f, "%llu,400,TEXT,word%06d,#FF8000\n", t, i); break;
+        }
+    }
+    bool ok = !ferror(f);
+    if (fclose(f) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Cannot write the schedule %s\n", path);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    int rows = argc > 1 ? atoi(argv[1]) : 1000000;
+    const char *path = argc > 2 ? argv[2] : "csv_bench.csv";
+    double max_ms = argc > 3 ? atof(argv[3]) : 0.0;
+    if (rows < 1) rows = 1;
+
+    if (!generate(path, rows)) return 1;
+    double best_ms = 0.0;
+    for (int run = 0; run < RUNS; run++) {
+        Uint64 t0 = SDL_GetTicksNS();
+        Experiment *exp = parse_csv(path);
+        double ms = (double)(SDL_GetTicksNS() - t0) / 1e6;
+        if (!exp || exp->count != rows) {
+            fprintf(stderr, "Parse failed: %d rows read out of %d\n", exp ? exp->count : 0, rows);
+            free_experiment(exp);
+            return 1;
+        }
+        int num_strings; size_t string_bytes;
+        strtab_get_stats(exp->strings, &num_strings, &string_bytes);
+        free_experiment(exp);
+        if (run == 0) printf("%d rows, %d distinct contents\n", rows, num_strings);
+        printf("run %d: %.1f ms\n", run + 1, ms);
+        if (run == 0 || ms < best_ms) best_ms = ms;
+    }
+    printf("best: %.1f ms (%.0f rows/s)\n", best_ms, rows / (best_ms / 1000.0));
+    remove(path);
+    if (max_ms > 0.0 && best_ms > max_ms) {
+        fprintf(stderr, "Slower than %.1f ms\n", max_ms);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Per-trigger latency of the DLP-IO8-G string and mask APIs, measured
+ * against a pseudo-terminal instead of the device.
+ *
+ * A responder thread holds the master side of the pty: it answers the ping
+ * of dlp_new() and the input queries, and times every byte it receives as
+ * if the link ran at 9600 baud: a byte arrives one byte time after it was
+ * written, or after the previous byte if the link was still busy. Each
+ * trigger is timed from the call to the arrival of its last byte. Bytes
+ * that never arrive are counted as lost.
+ *
+ * The last two runs poll an input line on the same port while the
+ * triggers are sent a few ms apart, as with --dlp-inputs: first freely,
+ * then leaving the link free ahead of each trigger like the input poller
+ * of expe3000 does.
+ *
+ *   dlp_bench [iterations] [max_us]
+ *
+ * With max_us, exits non-zero if the 99th percentile arrival time of the
+ * last run is above it.
+ */
+
+#define _GNU_SOURCE
+#include "dlp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#define BYTE_NS         1041667LL   /* 10 bits at 9600 baud */
+#define POLLED_LINE     0x10        /* Line 5 */
+#define POLL_MIN_NS     1000000LL   /* As in dlp_input.c */
+#define SPACING_NS      5000000LL   /* Triggers 5 to 10 ms apart while polling */
+
+static int master_fd;
+static atomic_long bytes_received;      /* Trigger bytes only */
+static atomic_llong last_byte_ns;       /* Arrival of the last trigger byte */
+static atomic_int answers_pending;
+static atomic_llong answer_due_ns;
+static atomic_bool polling, pause_polling, quit;
+static atomic_llong next_trigger_ns;
+
+static long long now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void sleep_ns(long long ns) {
+    struct timespec t = { (time_t)(ns / 1000000000LL), (long)(ns % 1000000000LL) };
+    nanosleep(&t, NULL);
+}
+
+static void *responder(void *arg) {
+    (void)arg;
+    unsigned char buf[64];
+    long long wire_free = 0;
+    while (!atomic_load(&quit)) {
+        ssize_t n = read(master_fd, buf, sizeof(buf));
+        if (n <= 0) continue;
+        long long t = now_ns();
+        long triggers = 0;
+        for (ssize_t i = 0; i < n; i++) {
+            wire_free = (t > wire_free ? t : wire_free) + BYTE_NS;
+            if (buf[i] == 0x27) {
+                unsigned char q = 'Q';
+                if (write(master_fd, &q, 1) != 1) perror("responder write");
+            } else if (buf[i] == 0x5C) {
+                continue;
+            } else if (strchr("ASDFGHJK", buf[i])) {
+                /* The answer comes back once the query is in, and takes a byte time too */
+                atomic_store(&answer_due_ns, wire_free + BYTE_NS);
+                atomic_fetch_add(&answers_pending, 1);
+            } else {
+                atomic_store(&last_byte_ns, wire_free);
+                triggers++;
+            }
+        }
+        atomic_fetch_add(&bytes_received, triggers);
+    }
+    return NULL;
+}
+
+static void *answerer(void *arg) {
+    (void)arg;
+    while (!atomic_load(&quit)) {
+        if (atomic_load(&answers_pending) > 0 && now_ns() >= atomic_load(&answer_due_ns)) {
+            unsigned char low = 0;
+            atomic_fetch_sub(&answers_pending, 1);
+            if (write(master_fd, &low, 1) != 1) perror("answer write");
+        }
+        sleep_ns(20000);
+    }
+    return NULL;
+}
+
+/* Polls the input line, pausing ahead of the next trigger when asked to, as dlp_input.c does */
+static void *poller(void *arg) {
+    dlp_io8g_t *dlp = (dlp_io8g_t *)arg;
+    while (atomic_load(&polling)) {
+        long long next = atomic_load(&next_trigger_ns);
+        if (atomic_load(&pause_polling) && next && next - now_ns() <= BYTE_NS + 1000000LL) {
+            sleep_ns(250000);
+            continue;
+        }
+        long long t0 = now_ns();
+        unsigned char levels;
+        dlp_read_mask(dlp, POLLED_LINE, &levels);
+        long long elapsed = now_ns() - t0;
+        sleep_ns(elapsed > POLL_MIN_NS ? elapsed : POLL_MIN_NS);
+    }
+    return NULL;
+}
+
+#define WAIT_TIMEOUT_NS 50000000LL
+
+/* Returns the arrival time of the last byte once `expected` bytes have arrived in total, or -1 */
+static long long wait_bytes(long expected) {
+    long long deadline = now_ns() + WAIT_TIMEOUT_NS;
+    while (atomic_load(&bytes_received) < expected) {
+        if (now_ns() > deadline) return -1;
+        sleep_ns(10000);        /* The byte times come from the responder: leave it the CPU */
+    }
+    return atomic_load(&last_byte_ns);
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/* Returns the 99th percentile arrival time */
+static long long report(const char *name, long long *call, long long *latency, int n, long lost) {
+    double sum_call = 0.0, sum_lat = 0.0;
+    for (int i = 0; i < n; i++) { sum_call += (double)call[i]; sum_lat += (double)latency[i]; }
+    qsort(call, (size_t)n, sizeof(long long), compare_ll);
+    qsort(latency, (size_t)n, sizeof(long long), compare_ll);
+    printf("%-32s call %7.1f us mean %7.1f us p99 | arrival %7.1f us mean %7.1f us median %7.1f us p99 %8.1f us max | %ld bytes lost\n", name,
+           sum_call / n / 1000.0, call[n * 99 / 100] / 1000.0,
+           sum_lat / n / 1000.0, latency[n / 2] / 1000.0, latency[n * 99 / 100] / 1000.0, latency[n - 1] / 1000.0, lost);
+    return latency[n * 99 / 100];
+}
+
+typedef enum { STRING_PULSE, MASK_PULSE, STRING_SWAP, MASK_SWAP, POLLED_PULSE, PAUSED_PULSE } Scenario;
+
+/* One trigger: from the call to the arrival of its bytes. Returns the number of bytes lost. */
+static long trigger(dlp_io8g_t *dlp, Scenario sc, bool first, long *expected, long long *call, long long *latency) {
+    long long t0 = now_ns();
+    switch (sc) {
+        case STRING_PULSE: if (first) dlp_set(dlp, "1"); else dlp_unset(dlp, "1"); *expected += 1; break;
+        case MASK_PULSE:
+        case POLLED_PULSE:
+        case PAUSED_PULSE: dlp_write_mask(dlp, first ? 0x00 : 0x01, first ? 0x01 : 0x00, NULL); *expected += 1; break;
+        /* Line 1 goes down while line 2 goes up, and back */
+        case STRING_SWAP:  dlp_unset(dlp, first ? "1" : "2"); dlp_set(dlp, first ? "2" : "1"); *expected += 2; break;
+        case MASK_SWAP:    dlp_write_mask(dlp, first ? 0x01 : 0x02, first ? 0x02 : 0x01, NULL); *expected += 2; break;
+    }
+    *call = now_ns() - t0;
+    long long arrival = wait_bytes(*expected);
+    if (arrival >= 0) {
+        *latency = arrival - t0;
+        long long idle = arrival - now_ns();
+        if (idle > 0) sleep_ns(idle);       /* The next trigger finds the link idle */
+        return 0;
+    }
+    /* Timed out: count what was lost and measure up to the last byte that did arrive */
+    long received = atomic_load(&bytes_received), lost = *expected - received;
+    *expected = received;
+    *latency = atomic_load(&last_byte_ns) - t0;
+    return lost;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    double max_us = argc > 2 ? atof(argv[2]) : 0.0;
+    if (iterations < 1) iterations = 1;
+
+    master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd < 0 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0) {
+        perror("Cannot create a pseudo-terminal");
+        return 1;
+    }
+    struct termios raw;
+    tcgetattr(master_fd, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(master_fd, TCSANOW, &raw);
+
+    pthread_t thread, answer_thread;
+    pthread_create(&thread, NULL, responder, NULL);
+    pthread_create(&answer_thread, NULL, answerer, NULL);
+
+    dlp_io8g_t *dlp = dlp_new(ptsname(master_fd), 9600);
+    if (!dlp) {
+        atomic_store(&quit, true);
+        return 1;
+    }
+    /* Ping and binary mode are not trigger bytes: let them go by */
+    sleep_ns(10 * BYTE_NS);
+
+    long long *call = malloc(sizeof(long long) * (size_t)iterations);
+    long long *latency = malloc(sizeof(long long) * (size_t)iterations);
+    static const char *names[] = { "dlp_set/dlp_unset", "dlp_write_mask", "dlp_unset+dlp_set (2 lines)", "dlp_write_mask (2 lines)",
+                                   "dlp_write_mask, line 5 polled", "dlp_write_mask, polling paused" };
+    printf("%d triggers per API on %s, timed at 9600 baud\n", iterations, ptsname(master_fd));
+    long expected = 0;
+    long long p99 = 0;
+    for (int sc = STRING_PULSE; sc <= PAUSED_PULSE; sc++) {
+        pthread_t poll_thread;
+        bool polled = sc == POLLED_PULSE || sc == PAUSED_PULSE;
+        if (polled) {
+            atomic_store(&pause_polling, sc == PAUSED_PULSE);
+            atomic_store(&next_trigger_ns, 0);
+            atomic_store(&polling, true);
+            pthread_create(&poll_thread, NULL, poller, dlp);
+        }
+        long lost = 0;
+        long long ignored;
+        for (int i = 0; i < iterations; i++) {
+            if (polled) {
+                /* Spaced at random so that the triggers do not lock onto the polling period */
+                long long at = now_ns() + SPACING_NS + rand() % SPACING_NS;
+                atomic_store(&next_trigger_ns, at);
+                sleep_ns(at - now_ns());
+            }
+            lost += trigger(dlp, (Scenario)sc, i % 2 == 0, &expected, &call[i], &latency[i]);
+        }
+        if (polled) {
+            atomic_store(&polling, false);
+            pthread_join(poll_thread, NULL);
+        }
+        if (iterations % 2) trigger(dlp, (Scenario)sc, false, &expected, &ignored, &ignored);
+        p99 = report(names[sc], call, latency, iterations, lost);
+    }
+
+    free(call);
+    free(latency);
+    atomic_store(&quit, true);
+    dlp_write_mask(dlp, 0x00, 0x01, NULL);    /* Wakes the responder up */
+    pthread_join(thread, NULL);
+    pthread_join(answer_thread, NULL);
+    dlp_close(dlp);
+    close(master_fd);
+    if (max_us > 0.0 && p99 / 1000.0 > max_us) {
+        fprintf(stderr, "Paused polling: p99 arrival %.1f us, above %.1f us\n", p99 / 1000.0, max_us);
+        return 1;
+    }
+    return 0;
+}
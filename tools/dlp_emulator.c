@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) Christophe Pallier <Christophe@pallier.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * DLP-IO8-G emulator on a pseudo-terminal, to run expe3000 with --dlp
+ * without the device.
+ *
+ *   dlp_emulator [-o bytes.csv] [-l /tmp/dlp] [-r results.csv] [-m max_ms] [-- command...]
+ *   expe3000 experiment.csv --dlp /tmp/dlp --dlp-inputs 5
+ *
+ * It implements the subset of the protocol expe3000 uses: ping (0x27,
+ * answered 'Q'), binary mode (0x5C), set lines 1-8 ('1'-'8'), unset lines
+ * ('QWERTYUI') and read lines ('ASDFGHJK', answered 0 or 1). Every byte
+ * received is timestamped (ms since the emulator started) and written to
+ * the -o file. Input levels are driven from stdin:
+ *
+ *   5 1          line 5 high
+ *   5 0          line 5 low
+ *   pulse 5 10   line 5 high for 10 ms
+ *
+ * At the end of stdin (or on Ctrl-C) a summary gives, for each output line,
+ * the number of pulses and their widths, e.g. to check that every sound
+ * trigger lasted about 5 ms.
+ *
+ * After "--", the emulator runs the command (e.g. expe3000 with --dlp on
+ * the -l link) and stops when it exits. With -r, it then compares the
+ * bytes it received with the TRIGGER_WRITTEN events of that CSV results
+ * file: each write must have arrived, and arrived at most max_ms (default
+ * 5) after the intended time of its event. The two clocks are aligned on
+ * the trigger that arrived soonest after its logged write. Writes less than
+ * GROUP_MS apart are compared as one, since their bytes cannot be told
+ * apart. The exit status is non-zero if the check fails, or if the command
+ * did.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/wait.h>
+
+#define NUM_LINES 8
+#define GROUP_MS  2.0           /* Trigger bytes or writes closer than this are one write */
+#define CHILD_POLL_MS 50
+
+static const char set_cmd[NUM_LINES]   = {'1', '2', '3', '4', '5', '6', '7', '8'};
+static const char unset_cmd[NUM_LINES] = {'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I'};
+static const char read_cmd[NUM_LINES]  = {'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K'};
+
+typedef struct {
+    bool   output_high;
+    double high_since_ms;
+    int    pulses;
+    double min_width_ms, max_width_ms, sum_width_ms;
+    bool   input_high;          /* Level returned by the read command */
+    double input_low_at_ms;     /* End of a pulse started from stdin, 0 if none */
+} Line;
+
+typedef struct {
+    double *t;
+    size_t count, capacity;
+} Times;
+
+static Line lines[NUM_LINES];
+static volatile sig_atomic_t interrupted;
+static struct timespec start;
+static Times arrivals;          /* Set and unset bytes */
+
+static double now_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)(t.tv_sec - start.tv_sec) * 1000.0 + (double)(t.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+static int find(const char *table, unsigned char c) {
+    for (int i = 0; i < NUM_LINES; i++) if ((unsigned char)table[i] == c) return i;
+    return -1;
+}
+
+static void push_time(Times *ts, double t) {
+    if (ts->count == ts->capacity) {
+        size_t capacity = ts->capacity ? ts->capacity * 2 : 256;
+        double *grown = realloc(ts->t, capacity * sizeof(double));
+        if (!grown) {
+            perror("Cannot record the trigger times");
+            exit(1);
+        }
+        ts->t = grown;
+        ts->capacity = capacity;
+    }
+    ts->t[ts->count++] = t;
+}
+
+/* Handles one byte from expe3000; returns a short description for the log */
+static const char *handle_byte(int master, unsigned char c, double t) {
+    int i;
+    if (c == 0x27) {
+        unsigned char q = 'Q';
+        if (write(master, &q, 1) != 1) perror("write");
+        return "ping";
+    }
+    if (c == 0x5C) return "binary mode";
+    if (find(set_cmd, c) >= 0 || find(unset_cmd, c) >= 0) push_time(&arrivals, t);
+    if ((i = find(set_cmd, c)) >= 0) {
+        if (!lines[i].output_high) { lines[i].output_high = true; lines[i].high_since_ms = t; }
+        return "set";
+    }
+    if ((i = find(unset_cmd, c)) >= 0) {
+        if (lines[i].output_high) {
+            double w = t - lines[i].high_since_ms;
+            if (lines[i].pulses == 0 || w < lines[i].min_width_ms) lines[i].min_width_ms = w;
+            if (lines[i].pulses == 0 || w > lines[i].max_width_ms) lines[i].max_width_ms = w;
+            lines[i].sum_width_ms += w;
+            lines[i].pulses++;
+            lines[i].output_high = false;
+        }
+        return "unset";
+    }
+    if ((i = find(read_cmd, c)) >= 0) {
+        unsigned char level = lines[i].input_high ? 1 : 0;
+        if (write(master, &level, 1) != 1) perror("write");
+        return "read";
+    }
+    return "unknown";
+}
+
+static void handle_command(const char *cmd, double t) {
+    int line, level, width;
+    if (sscanf(cmd, "pulse %d %d", &line, &width) == 2 && line >= 1 && line <= NUM_LINES && width > 0) {
+        lines[line - 1].input_high = true;
+        lines[line - 1].input_low_at_ms = t + width;
+    } else if (sscanf(cmd, "%d %d", &line, &level) == 2 && line >= 1 && line <= NUM_LINES) {
+        lines[line - 1].input_high = level != 0;
+        lines[line - 1].input_low_at_ms = 0.0;
+    } else if (cmd[0] != '\n') {
+        fprintf(stderr, "Unknown command: %s", cmd);
+    }
+}
+
+/* Ends the input pulses that are due; returns the poll timeout until the next one */
+static int end_input_pulses(double t) {
+    double next = -1.0;
+    for (int i = 0; i < NUM_LINES; i++) {
+        if (lines[i].input_low_at_ms <= 0.0) continue;
+        if (lines[i].input_low_at_ms <= t) {
+            lines[i].input_high = false;
+            lines[i].input_low_at_ms = 0.0;
+        } else if (next < 0.0 || lines[i].input_low_at_ms < next) next = lines[i].input_low_at_ms;
+    }
+    return next < 0.0 ? -1 : (int)(next - t) + 1;
+}
+
+/* Keeps the first of each run of times less than GROUP_MS apart; other, if not NULL, is thinned alike */
+static void group(Times *ts, Times *other) {
+    size_t n = 0;
+    double previous = 0.0;
+    for (size_t i = 0; i < ts->count; i++) {
+        double t = ts->t[i];
+        bool joined = i > 0 && t - previous < GROUP_MS;
+        previous = t;
+        if (joined) continue;
+        if (other) other->t[n] = other->t[i];
+        ts->t[n++] = t;
+    }
+    ts->count = n;
+    if (other) other->count = n;
+}
+
+/* Compares the trigger bytes received with the TRIGGER_WRITTEN events of the results file */
+static bool check_results(const char *path, double max_ms) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror("Cannot open the results file");
+        return false;
+    }
+    Times written = {0}, intended = {0};
+    int failed = 0;
+    char line[1024], type[64];
+    uint64_t intended_ms, timestamp_ms;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%" SCNu64 ",%" SCNu64 ",%63[^,\n]", &intended_ms, &timestamp_ms, type) != 3) continue;
+        if (strcmp(type, "TRIGGER_FAILED") == 0) failed++;
+        if (strcmp(type, "TRIGGER_WRITTEN") != 0) continue;
+        push_time(&written, (double)timestamp_ms);
+        push_time(&intended, (double)intended_ms);
+    }
+    fclose(f);
+
+    group(&written, &intended);
+    group(&arrivals, NULL);
+    bool ok = true;
+    if (failed > 0) {
+        fprintf(stderr, "Check: %d TRIGGER_FAILED events in %s\n", failed, path);
+        ok = false;
+    }
+    if (written.count != arrivals.count) {
+        fprintf(stderr, "Check: %zu trigger writes logged in %s, %zu received\n", written.count, path, arrivals.count);
+        ok = false;
+    } else if (written.count > 0) {
+        /* A byte cannot arrive before its write returned: the soonest arrival gives the clock offset */
+        double offset = arrivals.t[0] - written.t[0];
+        for (size_t i = 1; i < written.count; i++)
+            if (arrivals.t[i] - written.t[i] < offset) offset = arrivals.t[i] - written.t[i];
+        double min_ms = 0.0, max_seen_ms = 0.0, sum_ms = 0.0;
+        int late = 0;
+        for (size_t i = 0; i < written.count; i++) {
+            double latency = arrivals.t[i] - offset - intended.t[i];
+            if (i == 0 || latency < min_ms) min_ms = latency;
+            if (i == 0 || latency > max_seen_ms) max_seen_ms = latency;
+            sum_ms += latency;
+            if (latency > max_ms) {
+                if (late++ < 10) fprintf(stderr, "Check: the write intended at %.0f ms arrived %.3f ms late\n", intended.t[i], latency);
+                ok = false;
+            }
+        }
+        printf("%zu trigger writes checked, arrival - intended: min %.3f ms, mean %.3f ms, max %.3f ms; %d above %.1f ms\n",
+               written.count, min_ms, sum_ms / (double)written.count, max_seen_ms, late, max_ms);
+    }
+    free(written.t);
+    free(intended.t);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    const char *log_path = NULL, *link_path = NULL, *results_path = NULL;
+    double max_ms = 5.0;
+    char **command = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) log_path = argv[++i];
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) link_path = argv[++i];
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) results_path = argv[++i];
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) max_ms = atof(argv[++i]);
+        else if (strcmp(argv[i], "--") == 0 && i + 1 < argc) {
+            command = &argv[i + 1];
+            break;
+        } else {
+            fprintf(stderr, "Usage: %s [-o bytes.csv] [-l link-to-device] [-r results.csv] [-m max_ms] [-- command...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("Cannot create a pseudo-terminal");
+        return 1;
+    }
+    struct termios raw;
+    tcgetattr(master, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(master, TCSANOW, &raw);
+    const char *device = ptsname(master);
+    /* Keep the slave side open, so that the master does not fail between two runs */
+    int slave = open(device, O_RDWR | O_NOCTTY);
+    if (link_path) {
+        unlink(link_path);
+        if (symlink(device, link_path) != 0) perror("Cannot create the link");
+        else device = link_path;
+    }
+
+    FILE *log = NULL;
+    if (log_path) {
+        log = fopen(log_path, "w");
+        if (!log) { perror("Cannot open the byte log"); return 1; }
+        fprintf(log, "time_ms,byte,command\n");
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    printf("DLP-IO8-G emulator on %s\n", device);
+    fflush(stdout);
+
+    pid_t child = 0;
+    int child_status = 0;
+    bool child_exited = false;
+    if (command) {
+        child = fork();
+        if (child < 0) {
+            perror("Cannot start the command");
+            return 1;
+        }
+        if (child == 0) {
+            close(master);
+            if (slave >= 0) close(slave);
+            execvp(command[0], command);
+            perror("Cannot run the command");
+            _exit(127);
+        }
+    }
+
+    struct pollfd fds[2] = { { master, POLLIN, 0 }, { STDIN_FILENO, POLLIN, 0 } };
+    int nfds = 2;
+    long total = 0;
+    while (!interrupted) {
+        int timeout = end_input_pulses(now_ms());
+        if (child > 0 && !child_exited && waitpid(child, &child_status, WNOHANG) == child) child_exited = true;
+        /* Once the command has exited, only its last bytes are left to read */
+        if (child_exited) timeout = 0;
+        else if (child > 0 && (timeout < 0 || timeout > CHILD_POLL_MS)) timeout = CHILD_POLL_MS;
+        if (poll(fds, (nfds_t)nfds, timeout) < 0) continue;
+        if (fds[0].revents & POLLIN) {
+            unsigned char buf[256];
+            ssize_t n = read(master, buf, sizeof(buf));
+            double t = now_ms();
+            for (ssize_t i = 0; i < n; i++) {
+                const char *what = handle_byte(master, buf[i], t);
+                if (log) fprintf(log, "%.3f,0x%02X,%s\n", t, buf[i], what);
+            }
+            if (n > 0) total += n;
+        } else if (child_exited) break;
+        if (nfds > 1 && (fds[1].revents & (POLLIN | POLLHUP))) {
+            char cmd[128];
+            if (fgets(cmd, sizeof(cmd), stdin)) handle_command(cmd, now_ms());
+            else if (isatty(STDIN_FILENO)) break;
+            else nfds = 1;      /* stdin is a closed pipe or file: keep serving until interrupted */
+        }
+    }
+
+    printf("%ld bytes received\n", total);
+    printf("line,pulses,min_width_ms,mean_width_ms,max_width_ms\n");
+    for (int i = 0; i < NUM_LINES; i++) {
+        const Line *l = &lines[i];
+        if (l->pulses == 0) continue;
+        printf("%d,%d,%.3f,%.3f,%.3f\n", i + 1, l->pulses, l->min_width_ms, l->sum_width_ms / l->pulses, l->max_width_ms);
+    }
+    if (log) fclose(log);
+    bool ok = true;
+    if (child > 0) {
+        if (!child_exited) {
+            kill(child, SIGTERM);
+            waitpid(child, &child_status, 0);
+        }
+        if (!WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0) {
+            fprintf(stderr, "The command failed\n");
+            ok = false;
+        }
+    }
+    if (results_path && !check_results(results_path, max_ms)) ok = false;
+    if (link_path) unlink(link_path);
+    if (slave >= 0) close(slave);
+    close(master);
+    return ok ? 0 : 1;
+}